@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "evsrv_manager.h"
+
+#define WORKERS_COUNT 4
+
+static evsrv* on_echo_create(evsrv_manager* self, size_t id, evsrv_info* info);
+static void on_echo_destroy(evsrv* self);
+void on_echo_read(evsrv_conn* conn, ssize_t nread);
+
+void on_started(evsrv_manager* mgr);
+void on_gracefully_stopped(evsrv_manager* mgr);
+void sigint_cb(struct ev_loop* loop, ev_signal* w, int revents);
+
+
+int main() {
+
+    evsrv_info hosts[] = {                                                     // specify all the servers
+            { "127.0.0.1", "9090", on_echo_create, on_echo_destroy },
+            { "127.0.0.1", "7070", on_echo_create, on_echo_destroy },
+    };
+    size_t hosts_len = sizeof(hosts) / sizeof(hosts[0]);
+
+    evsrv_manager mgr;
+    evsrv_manager_init_workers(EV_DEFAULT, &mgr, hosts, hosts_len, WORKERS_COUNT); // every worker gets its own loop and its own SO_REUSEPORT sockets
+    evsrv_manager_set_on_started(&mgr, on_started);                            // will be called when all workers are started
+    // evsrv_manager_set_dispatch(&mgr, EVSRV_DISPATCH_LEAST_CONNECTIONS);     // alternatively: accept on mgr.loop and hand sockets over to workers
+
+    evsrv_manager_bind(&mgr);                                                  // binds every server in every worker
+    evsrv_manager_listen(&mgr);                                                // starts listening every server in every worker
+
+    ev_signal sig;
+    ev_signal_init(&sig, sigint_cb, SIGINT);
+    sig.data = (void*) &mgr;
+    ev_signal_start(mgr.loop, &sig);
+
+    evsrv_manager_accept(&mgr);                                                // starts worker threads
+    ev_run(mgr.loop, 0);
+
+    evsrv_manager_destroy(&mgr);                                               // cleaning evsrv_manager and its workers
+    ev_loop_destroy(mgr.loop);
+}
+
+void on_started(evsrv_manager* mgr) {
+    printf("Started evsrv_manager with %zu workers\n", mgr->workers_len);
+}
+
+void on_gracefully_stopped(evsrv_manager* mgr) {
+    printf("Gracefully stopped evsrv_manager\n");
+    ev_break(mgr->loop, EVBREAK_ALL);
+}
+
+
+evsrv* on_echo_create(evsrv_manager* self, size_t id, evsrv_info* info) {
+    evsrv* s = (evsrv*) malloc(sizeof(evsrv));                                 // called once per server in every worker
+    evsrv_init(self->loop, s, info->host, info->port);                         // self->loop is the worker's loop
+    s->write_timeout = 0.0;
+    evsrv_set_on_read(s, on_echo_read);
+    return s;
+}
+
+void on_echo_destroy(evsrv* self) {
+    evsrv_destroy(self);
+    free(self);
+}
+
+void on_echo_read(evsrv_conn* conn, ssize_t nread) {
+    if (nread > 0) {
+        evsrv_conn_write(conn, conn->rbuf, (size_t) nread);                    // just replying with what we got
+        conn->ruse = 0;
+    }
+}
+
+void sigint_cb(struct ev_loop* loop, ev_signal* w, int revents) {
+    ev_signal_stop(loop, w);
+    evsrv_manager* mgr = (evsrv_manager*) w->data;
+    evsrv_manager_graceful_stop(mgr, on_gracefully_stopped);                   // every worker is stopped gracefully, callback is called once all are done
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "evsrv.h"
+#include "evsrv_http.h"
+
+// A keep-alive HTTP/1.1 server: GET /health, GET /metrics, POST /echo and GET /slow, answered 100 ms
+// later without blocking the requests pipelined after it. Try it with curl or wrk -t1 -c64 http://127.0.0.1:9090/health
+typedef struct {
+    evsrv_http_conn http;
+    ev_timer slow;
+} http_conn;
+
+static uint64_t requests;
+
+void on_started(evsrv* srv);
+evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info);
+void on_conn_destroy(evsrv_conn* conn, int err);
+void on_request(evsrv_http_conn* c, struct evsrv_http_request* req);
+void slow_cb(struct ev_loop* loop, ev_timer* w, int revents);
+void sigint_cb(struct ev_loop* loop, ev_signal* w, int revents);
+
+
+int main() {
+    struct ev_loop* loop = EV_DEFAULT;
+    ev_signal sig;
+    ev_signal_init(&sig, sigint_cb, SIGINT);
+    ev_signal_start(loop, &sig);
+
+    evsrv srv;
+    evsrv_init(loop, &srv, "127.0.0.1", "9090");
+    evsrv_set_on_started(&srv, on_started);                                // will be called on server start
+    evsrv_set_conn_size(&srv, sizeof(http_conn));                          // connections are allocated from server's pool
+    evsrv_set_on_conn(&srv, on_conn_create, on_conn_destroy);              // HTTP connections are custom ones
+    srv.read_timeout = 15.0;                                               // keep-alive timeout
+
+    if (evsrv_bind(&srv) == -1) {                                          // binds to host:port
+        return EXIT_FAILURE;
+    }
+    if (evsrv_listen(&srv) == -1) {                                        // starts listening on host:port
+        return EXIT_FAILURE;
+    }
+
+    evsrv_accept(&srv);                                                    // beginning to accept connections
+    ev_run(loop, 0);
+    evsrv_destroy(&srv);                                                   // cleaning evsrv
+    ev_loop_destroy(srv.loop);
+    return EXIT_SUCCESS;
+}
+
+void on_started(evsrv* srv) {
+    printf("Started HTTP demo server at %s:%s\n", srv->host, srv->port);
+}
+
+evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
+    http_conn* c = (http_conn*) evsrv_alloc_conn(srv);
+    evsrv_http_conn_init(&c->http, srv, info, on_request);                 // parses requests out of pooled read buffer
+    ev_timer_init(&c->slow, slow_cb, 0.1, 0.0);
+    return &c->http.conn;
+}
+
+void on_conn_destroy(evsrv_conn* conn, int err) {
+    evsrv* srv = conn->srv;
+    http_conn* c = (http_conn*) conn;
+    ev_timer_stop(srv->loop, &c->slow);
+    evsrv_http_conn_destroy(&c->http);
+    evsrv_free_conn(srv, conn);
+}
+
+void on_request(evsrv_http_conn* c, struct evsrv_http_request* req) {
+    ++requests;
+    bool get = evsrv_http_str_is(&req->method, "GET") || evsrv_http_str_is(&req->method, "HEAD");
+    if (get && evsrv_http_str_is(&req->target, "/health")) {
+        evsrv_http_respond(c, 200, "text/plain", "OK\n", 3);
+    } else if (get && evsrv_http_str_is(&req->target, "/metrics")) {
+        evsrv* srv = c->conn.srv;
+        char body[256];
+        int len = snprintf(body, sizeof(body), "connections %d\nrequests %llu\n",
+                           srv->active_connections, (unsigned long long) requests);
+        evsrv_http_respond(c, 200, "text/plain", body, (size_t) len);
+    } else if (evsrv_http_str_is(&req->method, "POST") && evsrv_http_str_is(&req->target, "/echo")) {
+        evsrv_http_respond(c, 200, "application/octet-stream", req->body.ptr, req->body.len);
+    } else if (get && evsrv_http_str_is(&req->target, "/slow")) {
+        http_conn* hc = (http_conn*) c;
+        evsrv_http_suspend(c);                                             // the request views are gone once we return
+        ev_timer_start(c->conn.srv->loop, &hc->slow);
+    } else {
+        evsrv_http_respond(c, 404, "text/plain", "Not Found\n", 10);
+    }
+}
+
+void slow_cb(struct ev_loop* loop, ev_timer* w, int revents) {
+    http_conn* c = SELFby(w, http_conn, slow);
+    evsrv_http_respond(&c->http, 200, "text/plain", "slow\n", 5);
+    evsrv_http_resume(&c->http);                                           // handles requests pipelined meanwhile
+}
+
+void sigint_cb(struct ev_loop* loop, ev_signal* w, int revents) {
+    ev_signal_stop(loop, w);
+    ev_break(loop, EVBREAK_ALL);
+}
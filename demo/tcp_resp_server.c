@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "evsrv.h"
+#include "evsrv_resp.h"
+
+
+// A tiny cache speaking RESP: PING, ECHO, HELLO, SET, GET, DEL and QUIT. Try it with redis-cli -p 9090
+typedef struct kv_s {
+    struct kv_s* next;
+    char* key;
+    size_t key_len;
+    char* value;
+    size_t value_len;
+} kv;
+
+#define KV_BUCKETS 4096
+static kv* kv_table[KV_BUCKETS];
+
+void on_started(evsrv* srv);
+evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info);
+void on_conn_destroy(evsrv_conn* conn, int err);
+void on_command(evsrv_resp_conn* c, int argc, struct evsrv_resp_arg* argv);
+void sigint_cb(struct ev_loop* loop, ev_signal* w, int revents);
+
+
+int main() {
+    struct ev_loop* loop = EV_DEFAULT;
+    ev_signal sig;
+    ev_signal_init(&sig, sigint_cb, SIGINT);
+    ev_signal_start(loop, &sig);
+
+    evsrv srv;
+    evsrv_init(loop, &srv, "127.0.0.1", "9090");
+    evsrv_set_on_started(&srv, on_started);                                // will be called on server start
+    evsrv_set_conn_size(&srv, sizeof(evsrv_resp_conn));                    // connections are allocated from server's pool
+    evsrv_set_on_conn(&srv, on_conn_create, on_conn_destroy);              // RESP connections are custom ones
+
+    if (evsrv_bind(&srv) == -1) {                                          // binds to host:port
+        return EXIT_FAILURE;
+    }
+    if (evsrv_listen(&srv) == -1) {                                        // starts listening on host:port
+        return EXIT_FAILURE;
+    }
+
+    evsrv_accept(&srv);                                                    // beginning to accept connections
+    ev_run(loop, 0);
+    evsrv_destroy(&srv);                                                   // cleaning evsrv
+    ev_loop_destroy(srv.loop);
+    return EXIT_SUCCESS;
+}
+
+void on_started(evsrv* srv) {
+    printf("Started RESP demo server at %s:%s\n", srv->host, srv->port);
+}
+
+evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
+    evsrv_resp_conn* c = (evsrv_resp_conn*) evsrv_alloc_conn(srv);
+    evsrv_resp_conn_init(c, srv, info, on_command);                        // parses commands out of pooled read buffer
+    return &c->conn;
+}
+
+void on_conn_destroy(evsrv_conn* conn, int err) {
+    evsrv* srv = conn->srv;
+    evsrv_resp_conn_destroy((evsrv_resp_conn*) conn);
+    evsrv_free_conn(srv, conn);
+}
+
+static kv** kv_find(const struct evsrv_resp_arg* key) {
+    size_t h = 5381;
+    for (size_t i = 0; i < key->len; ++i) {
+        h = h * 33 + (unsigned char) key->ptr[i];
+    }
+    kv** slot = &kv_table[h % KV_BUCKETS];
+    while (*slot && ((*slot)->key_len != key->len || memcmp((*slot)->key, key->ptr, key->len) != 0)) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+void on_command(evsrv_resp_conn* c, int argc, struct evsrv_resp_arg* argv) {
+    if (evsrv_resp_arg_is(&argv[0], "PING")) {
+        if (argc > 1) {
+            evsrv_resp_write_bulk(c, argv[1].ptr, argv[1].len);
+        } else {
+            evsrv_resp_write_simple(c, "PONG", 4);
+        }
+    } else if (evsrv_resp_arg_is(&argv[0], "ECHO") && argc == 2) {
+        evsrv_resp_write_bulk(c, argv[1].ptr, argv[1].len);
+    } else if (evsrv_resp_arg_is(&argv[0], "HELLO")) {
+        int proto = argc > 1 ? atoi(argv[1].ptr) : c->proto;               // the argument is followed by CRLF in rbuf
+        if (proto != 2 && proto != 3) {
+            evsrv_resp_write_error(c, "NOPROTO unsupported protocol version", 0);
+            return;
+        }
+        evsrv_resp_set_proto(c, proto);
+        evsrv_resp_write_map(c, 2);
+        evsrv_resp_write_bulk(c, "server", 6);
+        evsrv_resp_write_bulk(c, "libevserver", 11);
+        evsrv_resp_write_bulk(c, "proto", 5);
+        evsrv_resp_write_int(c, proto);
+    } else if (evsrv_resp_arg_is(&argv[0], "SET") && argc == 3) {
+        kv** slot = kv_find(&argv[1]);
+        kv* e = *slot;
+        if (e == NULL) {
+            e = (kv*) calloc(1, sizeof(kv));
+            e->key = (char*) memdup(argv[1].ptr, argv[1].len);
+            e->key_len = argv[1].len;
+            *slot = e;
+        }
+        free(e->value);
+        e->value = (char*) memdup(argv[2].ptr, argv[2].len);
+        e->value_len = argv[2].len;
+        evsrv_resp_write_simple(c, "OK", 2);
+    } else if (evsrv_resp_arg_is(&argv[0], "GET") && argc == 2) {
+        kv* e = *kv_find(&argv[1]);
+        if (e) {
+            evsrv_resp_write_bulk(c, e->value, e->value_len);
+        } else {
+            evsrv_resp_write_null(c);
+        }
+    } else if (evsrv_resp_arg_is(&argv[0], "DEL")) {
+        int64_t deleted = 0;
+        for (int i = 1; i < argc; ++i) {
+            kv** slot = kv_find(&argv[i]);
+            kv* e = *slot;
+            if (e) {
+                *slot = e->next;
+                free(e->key);
+                free(e->value);
+                free(e);
+                ++deleted;
+            }
+        }
+        evsrv_resp_write_int(c, deleted);
+    } else if (evsrv_resp_arg_is(&argv[0], "QUIT")) {
+        evsrv_resp_write_simple(c, "OK", 2);
+        evsrv_conn_end(&c->conn);                                          // closed once the reply is sent
+    } else {
+        evsrv_resp_write_error(c, "ERR unknown command or wrong number of arguments", 0);
+    }
+}
+
+void sigint_cb(struct ev_loop* loop, ev_signal* w, int revents) {
+    ev_signal_stop(loop, w);
+    ev_break(loop, EVBREAK_ALL);
+}
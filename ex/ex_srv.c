@@ -10,7 +10,7 @@ typedef struct {
     ev_timer tw;
 } my1_conn;
 
-static void on_read(evsrv_conn* conn, ssize_t nread);
+static void on_frame(evsrv_conn* conn, char* frame, size_t len);
 static bool on_graceful_conn_close(evsrv_conn* conn);
 static void on_graceful_conn_timeout(struct ev_loop* loop, ev_timer* timer, int revents) {
     ev_timer_stop(loop, timer);
@@ -21,12 +21,12 @@ static void on_graceful_conn_timeout(struct ev_loop* loop, ev_timer* timer, int
 }
 
 static evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
-    my1_conn* c = (my1_conn*) malloc(sizeof(my1_conn));
+    my1_conn* c = (my1_conn*) evsrv_alloc_conn(srv);
     evsrv_conn_init(&c->conn, srv, info);
 
     c->conn.wnow = 0;
     evsrv_conn_set_rbuf(&c->conn, (char*) malloc(EVSRV_DEFAULT_BUF_LEN), EVSRV_DEFAULT_BUF_LEN);
-    evsrv_conn_set_on_read(&c->conn, on_read);
+    evsrv_framing_set_fixed(&c->conn.framing, 10, on_frame);
     evsrv_conn_set_on_graceful_close(&c->conn, on_graceful_conn_close);
 
     c->tw.data = (void*) c;
@@ -37,39 +37,16 @@ static evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
 
 static void on_conn_destroy(evsrv_conn* conn, int err) {
     my1_conn* c = (my1_conn*) conn;
+    evsrv* srv = conn->srv;
     cwarn("[%d] user: on_conn_destroy", c->conn.info->sock);
     evsrv_conn_destroy(&c->conn);
     free(c->conn.rbuf);
     c->conn.rbuf = NULL;
-    free(c);
+    evsrv_free_conn(srv, &c->conn);
 }
 
-void on_read(evsrv_conn* conn, ssize_t nread) {
-    char* rbuf = conn->rbuf;
-    char* end = rbuf + conn->ruse;
-
-    size_t size = 10;
-
-    while (rbuf < end) {
-        ptrdiff_t buf_len = end - rbuf;
-        if (buf_len < size) {
-            break;
-        }
-
-        evsrv_conn_write(conn, rbuf, size);
-        rbuf += size;
-
-        if (rbuf == end) {
-            conn->ruse = 0;
-            break;
-        }
-    }
-
-    // printf("%.*s", (int) nread, buf);
-    conn->ruse = (uint32_t) (end - rbuf);
-    if (conn->ruse > 0) {
-        memmove(conn->rbuf, rbuf, conn->ruse);
-    }
+void on_frame(evsrv_conn* conn, char* frame, size_t len) {
+    evsrv_conn_write(conn, frame, len);
 }
 
 static bool on_graceful_conn_close(evsrv_conn* conn) {
@@ -105,10 +82,11 @@ int main() {
     // evsrv_init(loop, &srv, "unix/", "/var/tmp/ev_srv.sock");
 
     srv.write_timeout = 0.0;
+    evsrv_set_conn_size(&srv, sizeof(my1_conn));
+    evsrv_prewarm(&srv, 128);
 
     evsrv_set_on_started(&srv, on_started);
     evsrv_set_on_conn(&srv, on_conn_create, on_conn_destroy);
-    evsrv_set_on_read(&srv, on_read);
 
     if (evsrv_bind(&srv) == -1) {
         goto error;
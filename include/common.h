@@ -37,10 +37,108 @@ struct evsrv_sockaddr {
 #  define EVSRV_USE_TCP_NO_DELAY 1
 #endif
 
+#ifndef EVSRV_USE_ZEROCOPY
+#  if defined(__linux__) && defined(MSG_ZEROCOPY)
+#    define EVSRV_USE_ZEROCOPY 1
+#  else
+#    define EVSRV_USE_ZEROCOPY 0
+#  endif
+#endif
+
+#ifndef EVSRV_ZEROCOPY_LINGER
+#  define EVSRV_ZEROCOPY_LINGER 1.0 // seconds a closed connection's socket waits for zero-copy completions
+#  define EVSRV_ZEROCOPY_POLL 0.01  // seconds between polls of the error queues of closed connections
+#endif
+
+#ifndef EVSRV_USE_SIMD
+#  define EVSRV_USE_SIMD 1          // SSE2/AVX2 delimiter search on x86-64
+#endif
+
+#ifndef EVSRV_USE_URING
+#  define EVSRV_USE_URING 0
+#endif
+
+#ifndef EVSRV_URING_ENTRIES
+#  define EVSRV_URING_ENTRIES 1024
+#endif
+
+#ifndef EVSRV_URING_BUFS
+#  define EVSRV_URING_BUFS 1024     // provided receive buffers per ring, must be a power of 2
+#  define EVSRV_URING_BUF_LEN 4096
+#endif
+
+#ifndef EVSRV_URING_SEND_LINK
+#  define EVSRV_URING_SEND_LINK 64  // max chunks sent by one chain of linked sends
+#endif
+
 #ifndef EVSRV_DEFAULT_BUF_LEN
 #  define EVSRV_DEFAULT_BUF_LEN 4096
 #endif
 
+#ifndef EVSRV_CONN_PAGE_BITS
+#  define EVSRV_CONN_PAGE_BITS 10 // 1024 connection slots per page
+#endif
+
+#ifndef EVSRV_POOL_SLAB_OBJS
+#  define EVSRV_POOL_SLAB_OBJS 64
+#endif
+
+#ifndef EVSRV_BUFPOOL_MIN_SHIFT
+#  define EVSRV_BUFPOOL_MIN_SHIFT 10 // smallest buffer class is 1 KB
+#  define EVSRV_BUFPOOL_CLASSES 11   // largest buffer class is 1 MB
+#endif
+
+#ifndef EVSRV_DISPATCH_QUEUE_LEN
+#  define EVSRV_DISPATCH_QUEUE_LEN 4096 // must be a power of 2
+#endif
+
+#ifndef EVSRV_DEFAULT_ACCEPT_BATCH
+#  define EVSRV_DEFAULT_ACCEPT_BATCH 64 // connections accepted per wakeup, the rest wait for the next loop iteration
+#endif
+
+#ifndef EVSRV_ACCEPT_RETRY_DELAY
+#  define EVSRV_ACCEPT_RETRY_DELAY 1.0 // seconds accepting stays paused after EMFILE/ENFILE, unless a connection closes earlier
+#endif
+
+#ifndef EVSRV_LAG_INTERVAL
+#  define EVSRV_LAG_INTERVAL 0.05 // seconds between event loop lag samples
+#endif
+
+#ifndef EVSRV_FRAME_DELIM_MAX
+#  define EVSRV_FRAME_DELIM_MAX 8 // longest frame delimiter
+#endif
+
+#ifndef EVSRV_RESP_INLINE_ARGS
+#  define EVSRV_RESP_INLINE_ARGS 16         // arguments of a RESP command parsed without allocations
+#  define EVSRV_RESP_MAX_ARGS (1024 * 1024)
+#  define EVSRV_RESP_PREALLOC_ARGS 1024     // arguments allocated for on a multibulk header, the rest as they arrive
+#  define EVSRV_RESP_MAX_INLINE (64 * 1024) // longest inline command
+#  define EVSRV_RESP_SMALL_REPLY 256        // replies up to this size are written with one call
+#endif
+
+#ifndef EVSRV_HTTP_MAX_HEADERS
+#  define EVSRV_HTTP_MAX_HEADERS 32         // headers of an HTTP request, more are answered with 431
+#  define EVSRV_HTTP_MAX_HEAD (8 * 1024)    // longest request line and headers
+#  define EVSRV_HTTP_SMALL_RESPONSE 512     // responses up to this size are written with one call
+#endif
+
+#ifndef EVSRV_IP_THROTTLE_DELAY
+#  define EVSRV_IP_THROTTLE_DELAY 0.05 // seconds reading stays paused once an address exceeds its read rate
+#endif
+
+#ifndef EVSRV_DEFAULT_BUF_MAX
+#  define EVSRV_DEFAULT_BUF_MAX (1024 * 1024)
+#endif
+
+#ifndef EVSRV_WBLOCK_LEN
+#  define EVSRV_WBLOCK_LEN 16384 // size of pooled write queue blocks, including header
+#endif
+
+#ifndef EVSRV_DEFAULT_WBUF_HIGH
+#  define EVSRV_DEFAULT_WBUF_HIGH (1024 * 1024) // reading is paused when write queue grows above
+#  define EVSRV_DEFAULT_WBUF_LOW  (256 * 1024)  // and resumed once it drains down to
+#endif
+
 #ifndef EVSRV_SHUT_RD
 #  define EVSRV_SHUT_RD SHUT_RD
 #  define EVSRV_SHUT_WR SHUT_WR
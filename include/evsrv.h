@@ -7,6 +7,8 @@
 
 #include "common.h"
 #include "evsrv_conn.h"
+#include "evsrv_pool.h"
+#include "evsrv_iplimit.h"
 
 EV_CPP(extern "C" {)
 
@@ -17,6 +19,29 @@ typedef evsrv_conn* (* evsrv_on_conn_create_cb)(evsrv*, struct evsrv_conn_info*)
 typedef void        (* evsrv_on_conn_ready_cb)(evsrv_conn*);
 typedef void        (* evsrv_on_conn_destroy_cb)(evsrv_conn*, int err);
 typedef void        (* evsrv_on_graceful_stop_cb)(evsrv*);
+typedef void        (* evsrv_on_dispatch_cb)(evsrv*, const struct evsrv_conn_info*);
+typedef void        (* evsrv_on_reject_cb)(evsrv*, const struct evsrv_conn_info*);
+
+// what to do once queued writes of all the connections exceed wbuf_budget
+enum evsrv_wbuf_shed {
+    EVSRV_SHED_NONE,
+    EVSRV_SHED_LARGEST,     // close connections with the largest write queues
+    EVSRV_SHED_OLDEST,      // close connections whose write queues stay non-empty the longest
+    EVSRV_SHED_REFUSE       // stop accepting new connections until queues drain
+};
+
+enum evsrv_engine {
+    EVSRV_ENGINE_EV,        // readiness: ev_io + accept/read/writev
+    EVSRV_ENGINE_URING      // completion: io_uring multishot accept/recv and linked sends (EVSRV_USE_URING)
+};
+
+// reasons of paused accepting, a server accepts only when none is set
+enum evsrv_accept_pause_reason {
+    EVSRV_ACCEPT_PAUSE_WBUF = 1 << 0,
+    EVSRV_ACCEPT_PAUSE_CONNS = 1 << 1,      // max_connections of the server or its manager reached
+    EVSRV_ACCEPT_PAUSE_FDS = 1 << 2,        // out of file descriptors
+    EVSRV_ACCEPT_PAUSE_LAG = 1 << 3         // event loop lags behind more than lag_threshold
+};
 
 enum evsrv_state {
     EVSRV_IDLE,
@@ -27,7 +52,14 @@ enum evsrv_state {
     EVSRV_STOPPED
 };
 
+// fd-indexed page of connections, allocated on demand and released once empty
+struct evsrv_conn_page {
+    size_t used;
+    evsrv_conn* conns[1 << EVSRV_CONN_PAGE_BITS];
+};
+
 struct evsrv_manager_s;
+struct evsrv_uring_s;
 struct evsrv_s {
     struct ev_loop* loop;
     struct evsrv_manager_s* manager;
@@ -41,11 +73,60 @@ struct evsrv_s {
 
     int sock;
     int backlog;
+    bool reuseport;
 
     double read_timeout;
     double write_timeout;
+    struct evsrv_tlist rtimeouts;
+    struct evsrv_tlist wtimeouts;
+
+    // idle eviction: least recently active connections with nothing to write make room for new ones
+    bool idle_evict;                    // evict on reaching idle_limit and when out of file descriptors
+    int32_t idle_limit;                 // soft limit of connections, 0 - only when out of file descriptors
+    double idle_min;                    // connections active within this many seconds are never evicted
+    bool idle_graceful;                 // evict through conn->on_graceful_close, when set
+    struct evsrv_tlist idle;            // by last activity, its timer is not used
+
+    evsrv_iplimit iplimit;              // per source address connection caps and rates
+    struct evsrv_tlist throttled;       // connections over the read rate of their address
+
+    // fair reads: a connection reads up to read_budget per wakeup, on_read may defer the rest of its input
+    size_t read_budget;                 // bytes read until EAGAIN per wakeup, 0 - a single read
+    struct evsrv_tlist deferred;        // resumed round-robin once per loop iteration, its timer is not used
+    ev_check defer_w;
+    ev_idle defer_idle_w;               // keeps the loop from blocking in poll while connections are deferred
+
+    enum evsrv_engine engine;
+    struct evsrv_uring_s* uring;        // started on accept when engine is EVSRV_ENGINE_URING
+    uint32_t uring_gen;
+    uint32_t uring_accept_gen;
+    bool uring_accepting;
+    struct evsrv_orphan* uring_orphans; // write queue chunks of closed connections with sends in flight
 
     ev_io accept_rw;
+    size_t accept_batch;                // max connections accepted per wakeup, 0 - until EAGAIN
+    unsigned accept_flags;              // evsrv_conn_info_flags of accepted sockets
+    ev_timer accept_retry_w;            // resumes accepting paused by EMFILE/ENFILE
+    int spare_fd;                       // released on EMFILE/ENFILE to accept and close the pending connection
+
+    double lag_threshold;               // loop lag that stops admitting new connections, 0 - never
+    double lag;                         // last measured lag of the loop
+    bool lag_shedding;                  // set above lag_threshold, cleared once lag drops below half of it
+    ev_tstamp lag_due;                  // when lag_w should fire on an idle loop
+    ev_timer lag_w;
+    ev_prepare flush_w;                 // flushes corked connections at the end of loop iteration
+    evsrv_conn* flush_conns;
+    bool wcork;                         // wcork of default connections
+    size_t wbuf_high;                   // write queue watermarks of connections, 0 - unlimited
+    size_t wbuf_low;
+    size_t zerocopy_min;                // write_ref of at least this size is sent with MSG_ZEROCOPY, 0 - never
+    struct evsrv_orphan* orphans;       // zero-copy chunks of closed connections waiting for completion
+    ev_timer orphans_w;                 // polls error queues of the orphans
+    size_t wbuf_budget;                 // limit of bytes queued by all the connections, 0 - unlimited
+    size_t wbuf_total;
+    enum evsrv_wbuf_shed wbuf_shed;
+    bool wbuf_shed_pending;
+    unsigned accept_paused;             // mask of evsrv_accept_pause_reason
 
     evsrv_on_destroy_cb on_destroy;
     evsrv_on_started_cb on_started;
@@ -53,12 +134,31 @@ struct evsrv_s {
     evsrv_on_conn_ready_cb on_conn_ready;
     evsrv_on_conn_destroy_cb on_conn_destroy;
     evsrv_on_read_cb on_read;
+    struct evsrv_framing framing;       // framing of default connections
+    evsrv_conn_on_drain_cb on_drain;
 
     evsrv_on_graceful_stop_cb on_graceful_stop;
+    evsrv_on_dispatch_cb on_dispatch;
+    evsrv_on_reject_cb on_reject;       // while shedding, accepted connections are passed here and closed
+
+    int32_t active_connections;         // changed on the server's loop only, other threads load it relaxed
+    int32_t max_connections;            // 0 - unlimited
+    struct evsrv_conn_page** conn_pages;
+    size_t conn_pages_len;
+    evsrv_conn* conns;                  // intrusive list of live connections
+    struct evsrv_conn_watch* watches;   // of connections whose callbacks are running
 
-    int32_t active_connections;
-    evsrv_conn** connections;
-    size_t connections_len;
+    size_t conn_size;                   // size of connections allocated by evsrv_alloc_conn
+    evsrv_pool conn_pool;
+    evsrv_pool info_pool;
+    evsrv_pool wblock_pool;
+    evsrv_pool wchunk_pool;             // headers of write queue chunks that reference external data
+
+    evsrv_bufpool* bufpool;             // may be shared by all the servers of one loop
+    bool own_bufpool;
+    size_t rbuf_size;                   // initial (and minimal) read buffer size of pooled buffers
+    size_t rbuf_max;                    // pooled buffers grow up to this size, 0 - never grow
+    enum evsrv_conn_rbuf_mode rbuf_mode;
 
     void* data;
 };
@@ -68,8 +168,23 @@ typedef struct evsrv_s evsrv;
 void evsrv_init(struct ev_loop* loop, evsrv* self, const char* host, const char* port);
 void evsrv_destroy(evsrv* self);
 int evsrv_bind(evsrv* self);
+int evsrv_bind_shared(evsrv* self, const evsrv* origin);
 int evsrv_listen(evsrv* self);
 int evsrv_accept(evsrv* self);
+int evsrv_prewarm(evsrv* self, size_t conns_count);
+void evsrv_add_conn(evsrv* self, const struct evsrv_conn_info* info);
+evsrv_bufpool* evsrv_get_bufpool(evsrv* self);
+evsrv_conn* evsrv_alloc_conn(evsrv* self);
+void evsrv_free_conn(evsrv* self, evsrv_conn* conn);
+void evsrv_free_conn_info(evsrv* self, struct evsrv_conn_info* info);
+evsrv_conn* evsrv_get_conn(evsrv* self, int sock);
+void evsrv_register_conn(evsrv* self, evsrv_conn* conn);
+void evsrv_unregister_conn(evsrv* self, evsrv_conn* conn);
+void evsrv_accept_pause(evsrv* self, unsigned reason);
+void evsrv_accept_resume(evsrv* self, unsigned reason);
+void evsrv_conns_shrunk(evsrv* self);
+void evsrv_wbuf_grown(evsrv* self);
+void evsrv_wbuf_shrunk(evsrv* self);
 void evsrv_stop(evsrv* self);
 void evsrv_graceful_stop(evsrv* self, evsrv_on_graceful_stop_cb cb);
 
@@ -84,11 +199,86 @@ void evsrv_graceful_stop(evsrv* self, evsrv_on_graceful_stop_cb cb);
 } while (0)
 
 
+#define evsrv_set_on_drain(srv, on_drain_cb) do { \
+    (srv)->on_drain = (evsrv_conn_on_drain_cb) (on_drain_cb); \
+} while (0)
+
+
+#define evsrv_set_wbuf_watermarks(srv, low, high) do { \
+    (srv)->wbuf_low = (low); \
+    (srv)->wbuf_high = (high); \
+} while (0)
+
+
+#define evsrv_set_wbuf_budget(srv, budget, shed) do { \
+    (srv)->wbuf_budget = (budget); \
+    (srv)->wbuf_shed = (shed); \
+} while (0)
+
+
+#define evsrv_set_read_budget(srv, budget) do { \
+    (srv)->read_budget = (budget); \
+} while (0)
+
+
 #define evsrv_set_on_conn_ready(srv, on_conn_ready_cb) do { \
     (srv)->on_conn_ready = (evsrv_on_conn_ready_cb) (on_conn_ready_cb); \
 } while (0)
 
 
+#define evsrv_set_accept_batch(srv, batch) do { \
+    (srv)->accept_batch = (batch); \
+} while (0)
+
+
+#define evsrv_set_max_connections(srv, max) do { \
+    (srv)->max_connections = (max); \
+} while (0)
+
+
+#define evsrv_set_idle_evict(srv, soft_limit, min_idle, graceful) do { \
+    (srv)->idle_evict = true; \
+    (srv)->idle_limit = (soft_limit); \
+    (srv)->idle_min = (min_idle); \
+    (srv)->idle_graceful = (graceful); \
+} while (0)
+
+
+// burst of 0 allows one second worth of the rate
+#define evsrv_set_ip_limits(srv, max, rate, burst) do { \
+    (srv)->iplimit.max_conns = (max); \
+    (srv)->iplimit.conn_rate = (rate); \
+    (srv)->iplimit.conn_burst = (burst) > 0 ? (burst) : (rate); \
+} while (0)
+
+
+#define evsrv_set_ip_read_rate(srv, rate, burst) do { \
+    (srv)->iplimit.read_rate = (rate); \
+    (srv)->iplimit.read_burst = (burst) > 0 ? (burst) : (rate); \
+} while (0)
+
+
+#define evsrv_set_lag_threshold(srv, threshold) do { \
+    (srv)->lag_threshold = (threshold); \
+} while (0)
+
+
+// called with sockets accepted while the loop lags, e.g. to write a canned "busy" reply before they are closed
+#define evsrv_set_on_reject(srv, on_reject_cb) do { \
+    (srv)->on_reject = (evsrv_on_reject_cb) (on_reject_cb); \
+} while (0)
+
+
+#define evsrv_set_engine(srv, eng) do { \
+    (srv)->engine = (eng); \
+} while (0)
+
+
+#define evsrv_set_conn_size(srv, size) do { \
+    (srv)->conn_size = (size); \
+} while (0)
+
+
 #define evsrv_set_on_conn(srv, on_create_cb, on_destroy_cb) do { \
     (srv)->on_conn_create = (evsrv_on_conn_create_cb) (on_create_cb); \
     (srv)->on_conn_destroy = (evsrv_on_conn_destroy_cb) (on_destroy_cb); \
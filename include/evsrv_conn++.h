@@ -28,15 +28,15 @@ namespace ev {
         size_t& ruse() { return evsrv_conn::ruse; }
         size_t rlen() const { return evsrv_conn::rlen; }
 
-        iovec* wbuf() const { return evsrv_conn::wbuf; }
-        size_t wuse() const { return evsrv_conn::wuse; }
-        size_t wlen() const { return evsrv_conn::wlen; }
+        size_t wbytes() const { return evsrv_conn::wbytes; }
         bool write_now() const { return evsrv_conn::wnow; }
+        bool write_cork() const { return evsrv_conn::wcork; }
 
         virtual void set_rbuf(char* buf, size_t len) {
             evsrv_conn_set_rbuf(static_cast<evsrv_conn*>(this), buf, len);
         }
         void set_write_now(bool write_now) { evsrv_conn::wnow = write_now; }
+        void set_write_cork(bool write_cork) { evsrv_conn::wcork = write_cork; }
 
         template <class K, void (K::*method)(srv_conn&, ssize_t)>
         void set_on_read(K* object) {
@@ -48,6 +48,18 @@ namespace ev {
             _set_on_read(_on_read_function_thunk<function>, NULL);
         }
 
+        template <class K, void (K::*method)(srv_conn&)>
+        void set_on_drain(K* object) {
+            _set_on_drain(_on_drain_method_thunk<K, method>, object);
+        }
+
+        template <void (*function)(srv_conn&)>
+        void set_on_drain() {
+            _set_on_drain(_on_drain_function_thunk<function>, NULL);
+        }
+
+        bool wbuf_full() const { return evsrv_conn_wbuf_full(static_cast<const evsrv_conn*>(this)); }
+
         template <class K, void (K::*method)(srv_conn&)>
         void set_on_graceful_close(K* object) {
             _set_on_graceful_close(_on_graceful_close_method_thunk<K, method>, object);
@@ -83,6 +95,26 @@ namespace ev {
             evsrv_conn_write(this, buffer, len);
         }
 
+        void flush() {
+            evsrv_conn_flush(this);
+        }
+
+        void defer() {
+            evsrv_conn_defer(this);
+        }
+
+        void write_owned(void* buffer, size_t len, evsrv_wchunk_release_cb release = NULL, void* ctx = NULL) {
+            evsrv_conn_write_owned(this, buffer, len, release, ctx);
+        }
+
+        void write_ref(const void* buffer, size_t len, evsrv_wchunk_release_cb release = NULL, void* ctx = NULL) {
+            evsrv_conn_write_ref(this, buffer, len, release, ctx);
+        }
+
+        int sendfile(int fd, off_t offset, size_t len) {
+            return evsrv_conn_sendfile(this, fd, offset, len);
+        }
+
         void read_timer_stop() {
             evsrv_conn_read_timer_stop(this);
         }
@@ -109,6 +141,22 @@ namespace ev {
         }
 
 
+        void _set_on_drain(evsrv_conn_on_drain_cb cb, const void* data = NULL) {
+            evsrv_conn_set_on_drain(static_cast<evsrv_conn*>(this), cb);
+            this->data = (void*) data;
+        }
+
+        template <class K, void (K::*method)(srv_conn&)>
+        static void _on_drain_method_thunk(evsrv_conn* c) {
+            (static_cast<K*>(c->data)->*method)(*static_cast<srv_conn*>(c));
+        }
+
+        template <void (*function)(srv_conn&)>
+        static void _on_drain_function_thunk(evsrv_conn* c) {
+            function(*static_cast<srv_conn*>(c));
+        }
+
+
         void _set_on_graceful_close(evsrv_conn_on_graceful_close_cb cb, const void* data = NULL) {
             evsrv_conn_set_on_graceful_close(static_cast<evsrv_conn*>(this), cb);
             this->data = (void*) data;
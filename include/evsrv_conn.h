@@ -4,9 +4,11 @@
 #include <ev.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 #include "common.h"
 #include "util.h"
+#include "evsrv_frame.h"
 
 EV_CPP(extern "C" {)
 
@@ -14,11 +16,97 @@ typedef struct evsrv_conn_s evsrv_conn;
 typedef struct evsrv_s evsrv;
 
 typedef void (* evsrv_on_read_cb)(evsrv_conn*, ssize_t);
+
+// nread passed to on_read (or framing) of a connection resumed after evsrv_conn_defer, no new data was read
+#define EVSRV_READ_RESUMED ((ssize_t) -1)
 typedef bool (* evsrv_conn_on_graceful_close_cb)(evsrv_conn*);
+typedef void (* evsrv_conn_on_drain_cb)(evsrv_conn*);
+typedef void (* evsrv_wchunk_release_cb)(void* buf, void* ctx);
+
+// what was already done to an accepted socket, so evsrv_conn_init does not repeat it
+enum evsrv_conn_info_flags {
+    EVSRV_CONN_INFO_NONBLOCK = 1 << 0,      // accepted with SOCK_NONBLOCK
+    EVSRV_CONN_INFO_SOCKOPTS = 1 << 1       // SO_LINGER is inherited from the listening socket
+};
 
 struct evsrv_conn_info {
     struct evsrv_sockaddr addr;
     int sock;
+    unsigned flags;                         // mask of evsrv_conn_info_flags
+};
+
+// connections of a server waiting for one kind of timeout, ordered by deadline. All of them share
+// the server's timeout, so a touch moves the node to the tail and one timer waits for the head
+struct evsrv_tnode {
+    ev_tstamp deadline;                     // 0 - not linked
+    struct evsrv_tnode* prev;
+    struct evsrv_tnode* next;
+};
+
+struct evsrv_tlist {
+    struct evsrv_tnode* head;
+    struct evsrv_tnode* tail;
+    ev_timer w;
+};
+
+// lets code calling into user callbacks learn that a connection was closed without touching it, as the
+// destroy callback may have freed it by then. evsrv_conn_close sets closed of all the watches of the
+// connection, the watch itself lives on the caller's stack
+struct evsrv_conn_watch {
+    struct evsrv_conn_watch* next;
+    evsrv_conn* conn;
+    bool closed;
+};
+
+// reasons of paused reading, a connection reads only when none is set
+enum evsrv_conn_rpause_reason {
+    EVSRV_CONN_RPAUSE_WBUF = 1 << 0,        // until write queue drains to srv->wbuf_low
+    EVSRV_CONN_RPAUSE_RATE = 1 << 1,        // until the peer's address earns read tokens back
+    EVSRV_CONN_RPAUSE_DEFER = 1 << 2,       // until on_read is resumed with EVSRV_READ_RESUMED
+    EVSRV_CONN_RPAUSE_USER = 1 << 3         // until evsrv_conn_read_resume
+};
+
+enum evsrv_wchunk_type {
+    EVSRV_WCHUNK_BLOCK,     // pooled block, consecutive small writes are appended to it
+    EVSRV_WCHUNK_REF,       // caller's buffer, released through the callback once written
+    EVSRV_WCHUNK_FILE       // range of a file, sent with sendfile(2) and not counted in wbytes
+};
+
+// element of connection's write queue
+struct evsrv_wchunk {
+    struct evsrv_wchunk* next;
+    enum evsrv_wchunk_type type;
+    char* data;
+    size_t head;                        // bytes already written
+    size_t len;                         // bytes queued
+    size_t cap;
+
+    evsrv_wchunk_release_cb release;
+    void* ctx;
+
+    int fd;                             // file chunks only: own duplicate of caller's fd
+    off_t offset;
+
+    bool zerocopy;                      // sent with MSG_ZEROCOPY while connection allows it
+    bool zpending;                      // some bytes were sent zero-copy, release waits for completion
+    uint32_t zseq;                      // sequence number of the last zero-copy send of the chunk
+};
+
+// chunks of a closed connection the kernel may still read. Zero-copy ones keep its socket open until completion
+struct evsrv_orphan {
+    struct evsrv_orphan* next;
+    int sock;                           // -1 once closed past the deadline, the chunks are released on the next poll
+    ev_tstamp deadline;
+    uint32_t ugen;                      // io_uring engine: the connection's generation and its linked sends in flight,
+    unsigned usends;                    // the chunks are released along with the last completion
+    struct evsrv_wchunk* head;
+    struct evsrv_wchunk* tail;
+};
+
+enum evsrv_conn_rbuf_mode {
+    EVSRV_RBUF_USER,    // rbuf is provided and released by the user (see evsrv_conn_set_rbuf)
+    EVSRV_RBUF_POOLED,  // rbuf is taken from server's bufpool for the whole connection lifetime
+    EVSRV_RBUF_LAZY     // rbuf is borrowed from server's bufpool only while it holds unconsumed data
 };
 
 enum evsrv_conn_state {
@@ -35,23 +123,54 @@ struct evsrv_conn_s {
     struct evsrv_conn_info* info;
     enum evsrv_conn_state state;
 
+    evsrv_conn* prev;
+    evsrv_conn* next;
+
     ev_io rw;
-    ev_timer trw;
+    struct evsrv_tnode rto;             // in srv->rtimeouts while read timer is running
 
     ev_io ww;
-    ev_timer tww;
+    struct evsrv_tnode wto;             // in srv->wtimeouts while waiting for the socket to take queued data
+
+    struct evsrv_tnode ito;             // in srv->idle, deadline is the time of the last received data
+    struct evsrv_tnode tto;             // in srv->throttled while reading is paused by the read rate
+    bool iplimited;                     // admitted by srv->iplimit, released on close
+    uint32_t iphint;                    // slot of the peer's address in srv->iplimit
+    struct evsrv_tnode dto;             // in srv->deferred while on_read has buffered input left to process
 
     char* rbuf;
     size_t ruse;
     size_t rlen;
+    enum evsrv_conn_rbuf_mode rmode;
+    size_t ravg;                        // moving average of buffered bytes, drives pooled rbuf size
 
-    struct iovec* wbuf;
-    size_t wuse;
-    size_t wlen;
+    struct evsrv_wchunk* whead;
+    struct evsrv_wchunk* wtail;
+    size_t wbytes;                      // bytes waiting in the write queue
+    ev_tstamp wsince;                   // when the write queue became non-empty
     bool wnow;
+    bool wcork;                         // collect writes and flush them once per loop iteration
+    bool wend;                          // half-close once the write queue drains, see evsrv_conn_end
+    unsigned rpaused;                   // mask of evsrv_conn_rpause_reason
+
+    bool zcopy;                         // SO_ZEROCOPY is enabled and the kernel doesn't fall back to copying
+    uint32_t zseq;                      // sequence number of the next zero-copy send
+    struct evsrv_wchunk* zhead;         // written chunks waiting for zero-copy completion
+    struct evsrv_wchunk* ztail;
+
+    uint32_t ugen;                      // io_uring engine: generation tagging the connection's requests
+    bool urecv;                         // multishot receive is armed
+    bool uheld;                         // rbuf holds data received while reading was paused, not delivered yet
+    unsigned usends;                    // linked sends in flight
+
+    bool flush_pending;
+    evsrv_conn* flush_prev;
+    evsrv_conn* flush_next;
 
     evsrv_on_read_cb on_read;
+    struct evsrv_framing framing;       // when framing.on_frame is set it is called instead of on_read with data
     evsrv_conn_on_graceful_close_cb on_graceful_close;
+    evsrv_conn_on_drain_cb on_drain;
 
     void* data;
 };
@@ -61,17 +180,37 @@ void evsrv_conn_start(evsrv_conn* self);
 void evsrv_conn_stop(evsrv_conn* self);
 void evsrv_conn_read_timer_again(evsrv_conn* self);
 void evsrv_conn_read_timer_stop(evsrv_conn* self);
+void evsrv_conn_read_pause(evsrv_conn* self);
+void evsrv_conn_read_resume(evsrv_conn* self);
+void evsrv_conn_timeouts_init(evsrv* srv);
+void evsrv_conn_defer(evsrv_conn* self);
+void evsrv_conn_defer_stop(evsrv* srv);
+void evsrv_conn_orphans_destroy(evsrv* srv);
+int evsrv_conn_evict_idle(evsrv* srv, int count);
 void evsrv_conn_destroy(evsrv_conn* self);
 void evsrv_conn_shutdown(evsrv_conn* self, int how);
 void evsrv_conn_close(evsrv_conn* self, int err);
+void evsrv_conn_end(evsrv_conn* self);
+void evsrv_conn_watch(evsrv_conn* self, struct evsrv_conn_watch* watch);
+bool evsrv_conn_unwatch(evsrv* srv, struct evsrv_conn_watch* watch);
+
+void evsrv_conn_set_rbuf_mode(evsrv_conn* self, enum evsrv_conn_rbuf_mode mode);
+
+struct io_uring_cqe;
+void evsrv_conn_uring_complete(evsrv* srv, const struct io_uring_cqe* cqe);
 
 void evsrv_conn_write(evsrv_conn* conn, const void* buffer, size_t len);
+void evsrv_conn_flush(evsrv_conn* self);
+void evsrv_conn_write_owned(evsrv_conn* conn, void* buffer, size_t len, evsrv_wchunk_release_cb release, void* ctx);
+void evsrv_conn_write_ref(evsrv_conn* conn, const void* buffer, size_t len, evsrv_wchunk_release_cb release, void* ctx);
+int evsrv_conn_sendfile(evsrv_conn* conn, int fd, off_t offset, size_t len);
 
 
 #define evsrv_conn_set_rbuf(conn, buf, len) do { \
     (conn)->rbuf = (buf); \
     (conn)->rlen = (len); \
     (conn)->ruse = 0; \
+    (conn)->rmode = EVSRV_RBUF_USER; \
 } while (0)
 
 
@@ -80,6 +219,15 @@ void evsrv_conn_write(evsrv_conn* conn, const void* buffer, size_t len);
 } while (0)
 
 
+#define evsrv_conn_set_on_drain(conn, on_drain_cb) do { \
+    (conn)->on_drain = (evsrv_conn_on_drain_cb) (on_drain_cb); \
+} while (0)
+
+
+#define evsrv_conn_wbuf_full(conn) \
+    ((conn)->srv->wbuf_high > 0 && (conn)->wbytes > (conn)->srv->wbuf_high)
+
+
 #define evsrv_conn_set_on_graceful_close(conn, on_graceful_close_cb) do { \
     (conn)->on_graceful_close = (evsrv_conn_on_graceful_close_cb) (on_graceful_close_cb); \
 } while (0)
@@ -0,0 +1,52 @@
+#ifndef LIBEVSERVER_EVSRV_FRAME_H
+#define LIBEVSERVER_EVSRV_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+EV_CPP(extern "C" {)
+
+// Framing stage of a connection: instead of on_read, on_frame is called with every complete frame
+// found in rbuf. Frames point right into rbuf and are valid only until on_frame returns, the rest of
+// the buffer is compacted once after all the complete frames are handled.
+
+struct evsrv_conn_s;
+typedef void (* evsrv_on_frame_cb)(struct evsrv_conn_s*, char* frame, size_t len);
+
+enum evsrv_frame_mode {
+    EVSRV_FRAME_NONE,
+    EVSRV_FRAME_FIXED,      // frames of the same size
+    EVSRV_FRAME_PREFIX,     // length prefix of 1, 2, 4 or 8 bytes followed by as many bytes of frame
+    EVSRV_FRAME_DELIM       // frames end with a delimiter
+};
+
+struct evsrv_framing {
+    enum evsrv_frame_mode mode;
+    size_t size;                        // FIXED: frame size, PREFIX: size of the length prefix
+    bool big_endian;                    // PREFIX: byte order of the length prefix
+    char delim[EVSRV_FRAME_DELIM_MAX];
+    size_t delim_len;
+    size_t max_len;                     // longer frames (with the prefix) close the connection with EMSGSIZE, 0 - limited by rbuf_max
+    size_t max_frames;                  // frames handled per read before the rest is deferred, 0 - all of them
+    size_t scanned;                     // DELIM: bytes of the incomplete frame already searched for the delimiter
+    evsrv_on_frame_cb on_frame;
+};
+
+void evsrv_framing_init(struct evsrv_framing* self);
+int evsrv_framing_set_fixed(struct evsrv_framing* self, size_t size, evsrv_on_frame_cb on_frame);
+int evsrv_framing_set_prefix(struct evsrv_framing* self, size_t size, bool big_endian, evsrv_on_frame_cb on_frame);
+int evsrv_framing_set_delim(struct evsrv_framing* self, const char* delim, size_t delim_len, evsrv_on_frame_cb on_frame);
+void evsrv_frame_process(struct evsrv_conn_s* conn);
+
+
+#define evsrv_framing_set_limits(framing, max_frame_len, max_frames_per_read) do { \
+    (framing)->max_len = (max_frame_len); \
+    (framing)->max_frames = (max_frames_per_read); \
+} while (0)
+
+EV_CPP(})
+
+#endif //LIBEVSERVER_EVSRV_FRAME_H
@@ -0,0 +1,119 @@
+#ifndef LIBEVSERVER_EVSRV_HTTP_H
+#define LIBEVSERVER_EVSRV_HTTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <strings.h>
+
+#include "common.h"
+#include "evsrv_conn.h"
+
+EV_CPP(extern "C" {)
+
+// HTTP/1.x connections. Requests are parsed incrementally out of rbuf, line ends of the head are found
+// with evsrv_scan, and passed to on_request as views pointing right into rbuf, valid until on_request
+// returns. Chunked bodies are decoded in place, so a body is always contiguous. Pipelined requests are
+// handled one by one and their responses corked, a handler answering later suspends the connection and
+// the following requests wait until evsrv_http_resume. Idle keep-alive connections are closed by the
+// server's read_timeout, which also bounds how long a request may take to arrive.
+
+typedef struct evsrv_http_conn_s evsrv_http_conn;
+
+struct evsrv_http_str {
+    const char* ptr;
+    size_t len;
+};
+
+struct evsrv_http_header {
+    struct evsrv_http_str name;
+    struct evsrv_http_str value;
+};
+
+struct evsrv_http_request {
+    struct evsrv_http_str method;
+    struct evsrv_http_str target;
+    int minor;                          // HTTP/1.<minor>
+    struct evsrv_http_header* headers;
+    size_t nheaders;
+    struct evsrv_http_str body;
+    bool keep_alive;
+};
+
+typedef void (* evsrv_http_on_request_cb)(evsrv_http_conn*, struct evsrv_http_request*);
+
+// offsets of the head, from the start of the request, survive rbuf being moved between reads
+struct evsrv_http_span {
+    uint32_t off;
+    uint32_t len;
+};
+
+enum evsrv_http_state {
+    EVSRV_HTTP_HEAD,
+    EVSRV_HTTP_BODY,
+    EVSRV_HTTP_CHUNK_SIZE,
+    EVSRV_HTTP_CHUNK_DATA,
+    EVSRV_HTTP_CHUNK_END,
+    EVSRV_HTTP_TRAILERS,
+};
+
+struct evsrv_http_conn_s {
+    evsrv_conn conn;
+
+    // request being parsed
+    enum evsrv_http_state state;
+    size_t scanned;                     // start of the head line being received
+    size_t head_len;
+    size_t body_len;                    // Content-Length or the part of a chunked body decoded so far
+    size_t raw;                         // chunked: parse position in the encoded body
+    uint64_t chunk_left;
+    ev_tstamp since;                    // when the request started to arrive
+    bool sized;                         // Content-Length was given
+    bool chunked;
+    bool keep_alive;
+    bool expect;                        // the client waits for 100 Continue before sending the body
+    struct evsrv_http_span method;
+    struct evsrv_http_span target;
+    int minor;
+    size_t nheaders;
+    struct evsrv_http_span names[EVSRV_HTTP_MAX_HEADERS];
+    struct evsrv_http_span values[EVSRV_HTTP_MAX_HEADERS];
+    struct evsrv_http_header headers[EVSRV_HTTP_MAX_HEADERS];
+    struct evsrv_http_request req;
+
+    // request being answered
+    bool head_only;                     // HEAD gets no response body
+    bool closing;                       // the response is the last one
+    bool suspended;                     // answered later, see evsrv_http_suspend
+
+    size_t max_head;
+    size_t max_body;                    // 0 - limited by the largest rbuf the connection may get
+    size_t max_requests;                // requests handled per read before the rest is deferred, 0 - all of them
+    evsrv_http_on_request_cb on_request;
+};
+
+void evsrv_http_conn_init(evsrv_http_conn* self, evsrv* srv, struct evsrv_conn_info* info,
+                          evsrv_http_on_request_cb on_request);
+void evsrv_http_conn_destroy(evsrv_http_conn* self);
+
+const struct evsrv_http_str* evsrv_http_header(const struct evsrv_http_request* req, const char* name);
+
+void evsrv_http_write_head(evsrv_http_conn* self, int status, const char* headers, size_t content_length);
+void evsrv_http_respond(evsrv_http_conn* self, int status, const char* content_type, const void* body, size_t len);
+void evsrv_http_suspend(evsrv_http_conn* self);
+void evsrv_http_resume(evsrv_http_conn* self);
+
+
+#define evsrv_http_set_limits(http, head, body, requests) do { \
+    (http)->max_head = (head); \
+    (http)->max_body = (body); \
+    (http)->max_requests = (requests); \
+} while (0)
+
+
+#define evsrv_http_str_is(str, lit) \
+    ((str)->len == sizeof(lit) - 1 && strncasecmp((str)->ptr, (lit), sizeof(lit) - 1) == 0)
+
+EV_CPP(})
+
+#endif //LIBEVSERVER_EVSRV_HTTP_H
@@ -0,0 +1,51 @@
+#ifndef LIBEVSERVER_EVSRV_IPLIMIT_H
+#define LIBEVSERVER_EVSRV_IPLIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ev.h>
+
+#include "common.h"
+
+EV_CPP(extern "C" {)
+
+// Per source address limits: concurrent connections, a token bucket of accepted connections
+// and a token bucket of received bytes. Addresses live in an open addressing table with linear
+// probing, IPv4 ones are stored as IPv4-mapped IPv6. Unix socket peers are never limited.
+// Not thread-safe: a table belongs to one loop.
+
+struct evsrv_ipentry {
+    uint64_t key[2];
+    uint32_t hash;                      // 0 - free slot
+    uint32_t conns;
+    double conn_tokens;
+    double read_tokens;
+    ev_tstamp stamp;                    // when the buckets were refilled last time
+};
+
+typedef struct evsrv_iplimit_s {
+    struct evsrv_ipentry* slots;
+    uint32_t mask;
+    uint32_t used;
+    uint64_t seed;
+
+    uint32_t max_conns;                 // concurrent connections per address, 0 - unlimited
+    double conn_rate;                   // accepted connections per second per address, 0 - unlimited
+    double conn_burst;
+    double read_rate;                   // received bytes per second per address, 0 - unlimited
+    double read_burst;
+} evsrv_iplimit;
+
+#define evsrv_iplimit_enabled(self) ((self)->max_conns > 0 || (self)->conn_rate > 0 || (self)->read_rate > 0)
+
+void evsrv_iplimit_init(evsrv_iplimit* self);
+void evsrv_iplimit_destroy(evsrv_iplimit* self);
+int evsrv_iplimit_admit(evsrv_iplimit* self, const struct evsrv_sockaddr* addr, ev_tstamp now);
+void evsrv_iplimit_release(evsrv_iplimit* self, const struct evsrv_sockaddr* addr, ev_tstamp now);
+double evsrv_iplimit_read(evsrv_iplimit* self, const struct evsrv_sockaddr* addr, size_t bytes, ev_tstamp now,
+                          uint32_t* hint);
+
+EV_CPP(})
+
+#endif //LIBEVSERVER_EVSRV_IPLIMIT_H
@@ -18,6 +18,10 @@ namespace ev {
             evsrv_manager_init(loop.raw_loop, static_cast<evsrv_manager*>(this), servers, servers_count);
         }
 
+        srv_manager(ev::loop_ref loop, evsrv_info* servers, size_t servers_count, size_t workers_count) {
+            evsrv_manager_init_workers(loop.raw_loop, static_cast<evsrv_manager*>(this), servers, servers_count, workers_count);
+        }
+
         virtual ~srv_manager() {
             evsrv_manager_destroy(static_cast<evsrv_manager*>(this));
         }
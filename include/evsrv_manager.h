@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #include "evsrv.h"
 
@@ -12,6 +13,7 @@ EV_CPP(extern "C" {)
 
 typedef struct evsrv_manager_s evsrv_manager;
 typedef struct evsrv_info_s evsrv_info;
+typedef struct evsrv_worker_s evsrv_worker;
 
 typedef void   (* evsrv_manager_on_started_cb)(evsrv_manager*);
 typedef evsrv* (* evsrv_manger_on_create_t)(evsrv_manager*, size_t, evsrv_info*);
@@ -26,6 +28,17 @@ struct evsrv_info_s {
     evsrv_on_destroy_cb on_destroy;
 };
 
+enum evsrv_manager_mode {
+    EVSRV_MANAGER_MODE_SINGLE,     // all servers on the manager's loop
+    EVSRV_MANAGER_MODE_REUSEPORT,  // every worker accepts on its own SO_REUSEPORT socket
+    EVSRV_MANAGER_MODE_DISPATCH    // manager's loop accepts and hands sockets over to workers
+};
+
+enum evsrv_dispatch_policy {
+    EVSRV_DISPATCH_ROUND_ROBIN,
+    EVSRV_DISPATCH_LEAST_CONNECTIONS
+};
+
 enum evsrv_manager_state {
     EVSRV_MANAGER_IDLE,
     EVSRV_MANAGER_BOUND,
@@ -44,11 +57,72 @@ struct evsrv_manager_s {
 
     evsrv** srvs;
     size_t srvs_len;
+    evsrv_bufpool bufpool;              // read buffers shared by all the servers of the manager's loop
     size_t stopped_srvs;
     int active_srvs;
+
+    int32_t active_connections;         // changed on the manager's loop only, other threads load it relaxed
+    int32_t max_connections;            // limit of connections of all the servers, 0 - unlimited
+    bool conns_refusing;
+
+    size_t wbuf_budget;                 // limit of bytes queued by connections of all the servers, 0 - unlimited
+    size_t wbuf_total;
+    enum evsrv_wbuf_shed wbuf_shed;
+    bool wbuf_refusing;
+
+    // multi-threaded modes: every worker runs its own loop with its own set of servers
+    enum evsrv_manager_mode mode;
+    enum evsrv_dispatch_policy dispatch_policy;
+    evsrv* acceptors;
+    size_t next_worker;
+
+    evsrv_manager* parent;
+    evsrv_worker* worker;
+    evsrv_worker* workers;
+    size_t workers_len;
+    size_t started_workers;
+    size_t stopped_workers;
+    ev_async notify_w;
+};
+
+enum evsrv_worker_cmd {
+    EVSRV_WORKER_CMD_NONE,
+    EVSRV_WORKER_CMD_STOP,
+    EVSRV_WORKER_CMD_GRACEFUL_STOP
+};
+
+struct evsrv_dispatch_item {
+    struct evsrv_conn_info info;
+    size_t srv_idx;
+};
+
+// single producer (acceptor) / single consumer (worker) ring
+struct evsrv_dispatch_queue {
+    struct evsrv_dispatch_item* items;
+    size_t mask;
+    size_t head __attribute__((aligned(64)));
+    size_t tail __attribute__((aligned(64)));
+};
+
+struct evsrv_worker_s {
+    evsrv_manager* parent;
+    size_t id;
+    struct ev_loop* loop;
+    pthread_t thread;
+    bool running;
+
+    evsrv_manager mgr;
+    ev_async cmd_w;
+    int cmd;
+
+    struct evsrv_dispatch_queue queue;
+    ev_async dispatch_w;
 };
 
 void evsrv_manager_init(struct ev_loop* loop, evsrv_manager* self, evsrv_info* servers, size_t servers_count);
+void evsrv_manager_init_workers(struct ev_loop* loop, evsrv_manager* self, evsrv_info* servers, size_t servers_count,
+                                size_t workers_count);
+void evsrv_manager_set_dispatch(evsrv_manager* self, enum evsrv_dispatch_policy policy);
 void evsrv_manager_destroy(evsrv_manager* self);
 void evsrv_manager_bind(evsrv_manager* self);
 void evsrv_manager_listen(evsrv_manager* self);
@@ -57,6 +131,19 @@ void evsrv_manager_stop(evsrv_manager* self);
 void evsrv_manager_graceful_stop(evsrv_manager* self, evsrv_manager_on_graceful_stop_cb cb);
 
 
+// with workers every worker gets an equal share of the connections
+#define evsrv_manager_set_max_connections(mgr, max) do { \
+    (mgr)->max_connections = (max); \
+} while (0)
+
+
+// with workers every worker gets an equal share of the budget
+#define evsrv_manager_set_wbuf_budget(mgr, budget, shed) do { \
+    (mgr)->wbuf_budget = (budget); \
+    (mgr)->wbuf_shed = (shed); \
+} while (0)
+
+
 #define evsrv_manager_set_on_started(srv, on_started_cb) do { \
     (srv)->on_started = (evsrv_manager_on_started_cb) (on_started_cb); \
 } while (0)
@@ -0,0 +1,48 @@
+#ifndef LIBEVSERVER_EVSRV_POOL_H
+#define LIBEVSERVER_EVSRV_POOL_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+EV_CPP(extern "C" {)
+
+// Fixed-size object pool. Objects are carved out of slabs and recycled
+// through an intrusive free list. Not thread-safe: a pool belongs to one loop.
+
+struct evsrv_pool_slab {
+    struct evsrv_pool_slab* next;
+};
+
+typedef struct evsrv_pool_s {
+    size_t obj_size;
+    size_t objs_per_slab;
+
+    void* free_list;
+    struct evsrv_pool_slab* slabs;
+
+    size_t capacity;    // objects in all the slabs
+    size_t used;        // objects handed out
+} evsrv_pool;
+
+// Buffer pool with power of 2 size classes. Buffers above the largest class are malloc'ed.
+
+typedef struct evsrv_bufpool_s {
+    evsrv_pool classes[EVSRV_BUFPOOL_CLASSES];
+} evsrv_bufpool;
+
+void evsrv_pool_init(evsrv_pool* self, size_t obj_size, size_t objs_per_slab);
+void evsrv_pool_destroy(evsrv_pool* self);
+int evsrv_pool_prewarm(evsrv_pool* self, size_t count);
+void* evsrv_pool_alloc(evsrv_pool* self);
+void evsrv_pool_free(evsrv_pool* self, void* obj);
+
+void evsrv_bufpool_init(evsrv_bufpool* self);
+void evsrv_bufpool_destroy(evsrv_bufpool* self);
+size_t evsrv_bufpool_size(size_t size);
+char* evsrv_bufpool_alloc(evsrv_bufpool* self, size_t size, size_t* allocated);
+void evsrv_bufpool_free(evsrv_bufpool* self, char* buf, size_t size);
+
+EV_CPP(})
+
+#endif //LIBEVSERVER_EVSRV_POOL_H
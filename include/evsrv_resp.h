@@ -0,0 +1,90 @@
+#ifndef LIBEVSERVER_EVSRV_RESP_H
+#define LIBEVSERVER_EVSRV_RESP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <strings.h>
+
+#include "common.h"
+#include "evsrv_conn.h"
+
+EV_CPP(extern "C" {)
+
+// RESP (REdis Serialization Protocol) connections. Commands, multibulk and inline ones, are parsed
+// incrementally out of rbuf and passed to on_command as slices pointing right into rbuf, valid until
+// on_command returns. Replies to a pipeline are corked and written together once the read is handled.
+// The encoder speaks RESP2 until evsrv_resp_set_proto switches the connection to RESP3 (see HELLO).
+// A protocol error is answered with an error reply and the connection ends, as does evsrv_conn_end
+// called from on_command (see QUIT), the commands following are dropped.
+
+typedef struct evsrv_resp_conn_s evsrv_resp_conn;
+
+struct evsrv_resp_arg {
+    const char* ptr;
+    size_t len;
+};
+
+typedef void (* evsrv_resp_on_command_cb)(evsrv_resp_conn*, int argc, struct evsrv_resp_arg* argv);
+
+// offsets of parsed arguments, from the start of the command, survive rbuf being moved between reads
+struct evsrv_resp_span {
+    size_t off;
+    size_t len;
+};
+
+struct evsrv_resp_conn_s {
+    evsrv_conn conn;
+    int proto;                          // 2 or 3
+
+    // command being parsed
+    size_t parsed;                      // bytes of the command already parsed
+    int64_t argc;                       // arguments announced by multibulk header, -1 - not parsed yet
+    int64_t bulk;                       // length of the argument being received, -1 - its header not parsed yet
+    size_t nargs;
+    struct evsrv_resp_span* spans;
+    struct evsrv_resp_arg* argv;
+    size_t args_cap;
+    struct evsrv_resp_span spans_inline[EVSRV_RESP_INLINE_ARGS];
+    struct evsrv_resp_arg argv_inline[EVSRV_RESP_INLINE_ARGS];
+    bool closing;                       // the last reply is written, the connection ends once it is sent
+
+    size_t max_args;                    // longer commands are protocol errors
+    size_t max_bulk;                    // 0 - limited by the largest rbuf the connection may get
+    size_t max_commands;                // commands handled per read before the rest is deferred, 0 - all of them
+    evsrv_resp_on_command_cb on_command;
+};
+
+void evsrv_resp_conn_init(evsrv_resp_conn* self, evsrv* srv, struct evsrv_conn_info* info,
+                          evsrv_resp_on_command_cb on_command);
+void evsrv_resp_conn_destroy(evsrv_resp_conn* self);
+
+void evsrv_resp_write_simple(evsrv_resp_conn* self, const char* str, size_t len);
+void evsrv_resp_write_error(evsrv_resp_conn* self, const char* str, size_t len);
+void evsrv_resp_write_int(evsrv_resp_conn* self, int64_t value);
+void evsrv_resp_write_bulk(evsrv_resp_conn* self, const void* data, size_t len);
+void evsrv_resp_write_null(evsrv_resp_conn* self);
+void evsrv_resp_write_array(evsrv_resp_conn* self, size_t count);
+void evsrv_resp_write_map(evsrv_resp_conn* self, size_t count);
+void evsrv_resp_write_bool(evsrv_resp_conn* self, bool value);
+void evsrv_resp_write_double(evsrv_resp_conn* self, double value);
+
+
+#define evsrv_resp_set_proto(resp, version) do { \
+    (resp)->proto = (version); \
+} while (0)
+
+
+#define evsrv_resp_set_limits(resp, args, bulk, commands) do { \
+    (resp)->max_args = (args); \
+    (resp)->max_bulk = (bulk); \
+    (resp)->max_commands = (commands); \
+} while (0)
+
+
+#define evsrv_resp_arg_is(arg, str) \
+    ((arg)->len == sizeof(str) - 1 && strncasecmp((arg)->ptr, (str), sizeof(str) - 1) == 0)
+
+EV_CPP(})
+
+#endif //LIBEVSERVER_EVSRV_RESP_H
@@ -0,0 +1,23 @@
+#ifndef LIBEVSERVER_EVSRV_SCAN_H
+#define LIBEVSERVER_EVSRV_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+EV_CPP(extern "C" {)
+
+// Delimiter search for line oriented protocols. All the occurrences in a buffer are found in one pass,
+// 16 or 32 bytes at a time with SSE2 or AVX2, picked on the first call by what the CPU supports,
+// a memchr loop elsewhere. Occurrences of self-overlapping delimiters (like "aa") may overlap.
+
+// writes offsets of delimiters starting in buf[from, len) to pos and returns their count. When
+// it is max the search stopped early and may be continued from pos[max - 1] + 1
+size_t evsrv_scan(const char* buf, size_t from, size_t len, const char* delim, size_t delim_len,
+                  uint32_t* pos, size_t max);
+const char* evsrv_scan_isa(void);
+
+EV_CPP(})
+
+#endif //LIBEVSERVER_EVSRV_SCAN_H
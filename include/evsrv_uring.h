@@ -0,0 +1,91 @@
+#ifndef LIBEVSERVER_EVSRV_URING_H
+#define LIBEVSERVER_EVSRV_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ev.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+EV_CPP(extern "C" {)
+
+// io_uring requests are tagged with op, fd and connection generation, so stale completions are recognized
+enum evsrv_uring_op {
+    EVSRV_URING_ACCEPT = 1,
+    EVSRV_URING_RECV,
+    EVSRV_URING_SEND,
+    EVSRV_URING_CANCEL
+};
+
+#define evsrv_uring_data(op, fd, gen) \
+    (((uint64_t) (gen) << 32) | ((uint64_t) (uint32_t) (fd) << 3) | (uint64_t) (op))
+#define evsrv_uring_data_op(data) ((int) ((data) & 7))
+#define evsrv_uring_data_fd(data) ((int) (((data) >> 3) & 0x1fffffff))
+#define evsrv_uring_data_gen(data) ((uint32_t) ((data) >> 32))
+
+#if EVSRV_USE_URING
+
+#include <linux/io_uring.h>
+
+// Minimal io_uring driven by raw syscalls. Submissions are batched and flushed with a single
+// io_uring_enter per loop iteration, completions are reaped when the ring fd becomes readable
+// in the owning ev loop. Not thread-safe: a ring belongs to one loop.
+
+typedef struct evsrv_uring_s evsrv_uring;
+typedef void (* evsrv_uring_on_cqe_cb)(evsrv_uring*, const struct io_uring_cqe*);
+
+struct evsrv_uring_s {
+    struct ev_loop* loop;
+    int fd;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned sq_pending;                // prepared, but not submitted sqes
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_len;
+    void* cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+
+    // provided buffers for multishot receives
+    struct io_uring_buf_ring* br;
+    size_t br_len;
+    char* bufs;
+    unsigned bufs_count;
+    unsigned buf_len;
+    uint16_t bgid;
+
+    ev_io rw;
+    ev_prepare submit_w;
+
+    evsrv_uring_on_cqe_cb on_cqe;
+    void* data;
+};
+
+int evsrv_uring_init(struct ev_loop* loop, evsrv_uring* self, unsigned entries, unsigned bufs_count, unsigned buf_len);
+void evsrv_uring_destroy(evsrv_uring* self);
+struct io_uring_sqe* evsrv_uring_get_sqe(evsrv_uring* self);
+unsigned evsrv_uring_sq_space(evsrv_uring* self);
+int evsrv_uring_submit(evsrv_uring* self);
+char* evsrv_uring_buf(evsrv_uring* self, uint16_t bid);
+void evsrv_uring_buf_recycle(evsrv_uring* self, uint16_t bid);
+
+#define evsrv_uring_set_on_cqe(ring, on_cqe_cb) do { \
+    (ring)->on_cqe = (evsrv_uring_on_cqe_cb) (on_cqe_cb); \
+} while (0)
+
+#endif // EVSRV_USE_URING
+
+EV_CPP(})
+
+#endif //LIBEVSERVER_EVSRV_URING_H
@@ -1,16 +1,54 @@
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE // accept4
+#endif
+
 #include "evsrv.h"
+#include "evsrv_manager.h"
+#include "evsrv_uring.h"
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <assert.h>
 
 static void _evsrv_accept_cb(struct ev_loop* loop, ev_io* w, int revents);
+static void _evsrv_flush_cb(struct ev_loop* loop, ev_prepare* w, int revents);
+static void _evsrv_accept_retry_cb(struct ev_loop* loop, ev_timer* w, int revents);
+static void _evsrv_accept_out_of_fds(evsrv* self);
+static void _evsrv_accepted(evsrv* self, const struct evsrv_conn_info* info);
+static void _evsrv_reject(evsrv* self, const struct evsrv_conn_info* info);
+static void _evsrv_lag_cb(struct ev_loop* loop, ev_timer* w, int revents);
+static bool _evsrv_conns_full(evsrv* self);
+static void _evsrv_conns_grown(evsrv* self);
+static void _evsrv_accept_start(evsrv* self);
+static void _evsrv_accept_stop(evsrv* self);
+static struct evsrv_uring_s* _evsrv_get_uring(evsrv* self);
 
 /*************************** evsrv ***************************/
 
 #define evsrv_is_tcp(self) self->proto == EVSRV_PROTO_TCP
 #define evsrv_is_udp(self) self->proto == EVSRV_PROTO_UDP
+#define evsrv_is_unix(self) (strncasecmp(self->host, "unix/", 5) == 0)
+
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+#  define _evsrv_accept_sock(fd, addr) accept4((fd), (struct sockaddr*) &(addr)->ss, &(addr)->slen, SOCK_NONBLOCK | SOCK_CLOEXEC)
+#else
+#  define _evsrv_accept_sock(fd, addr) accept((fd), (struct sockaddr*) &(addr)->ss, &(addr)->slen)
+#endif
+
+// linux TCP sockets inherit SO_LINGER of the listening socket, unix ones are created from scratch
+static unsigned _evsrv_accept_flags(evsrv* self) {
+    unsigned flags = 0;
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+    flags |= EVSRV_CONN_INFO_NONBLOCK;
+    if (self->sockaddr.ss.ss_family == AF_INET || self->sockaddr.ss.ss_family == AF_INET6) {
+        flags |= EVSRV_CONN_INFO_SOCKOPTS;
+    }
+#endif
+    return flags;
+}
 
 void evsrv_init(struct ev_loop* loop, evsrv* self, const char* host, const char* port) {
     self->loop = loop;
@@ -26,20 +64,72 @@ void evsrv_init(struct ev_loop* loop, evsrv* self, const char* host, const char*
     self->state = EVSRV_IDLE;
     self->read_timeout = 0;
     self->write_timeout = 1.0;
+    evsrv_conn_timeouts_init(self);
+    self->idle_evict = false;
+    self->idle_limit = 0;
+    self->idle_min = 0.0;
+    self->idle_graceful = false;
+    evsrv_iplimit_init(&self->iplimit);
+    self->read_budget = 0;
     self->backlog = SOMAXCONN;
+    self->reuseport = false;
     self->sock = -1;
     self->active_connections = 0;
+    self->max_connections = 0;
+    self->engine = EVSRV_ENGINE_EV;
+    self->uring = NULL;
+    self->uring_gen = 0;
+    self->uring_accept_gen = 0;
+    self->uring_accepting = false;
+    ev_io_init(&self->accept_rw, _evsrv_accept_cb, -1, EV_READ);
+    self->accept_batch = EVSRV_DEFAULT_ACCEPT_BATCH;
+    self->accept_flags = 0;
+    ev_timer_init(&self->accept_retry_w, _evsrv_accept_retry_cb, 0.0, EVSRV_ACCEPT_RETRY_DELAY);
+    self->spare_fd = -1;
+    self->lag_threshold = 0.0;
+    self->lag = 0.0;
+    self->lag_shedding = false;
+    self->lag_due = 0.0;
+    ev_timer_init(&self->lag_w, _evsrv_lag_cb, EVSRV_LAG_INTERVAL, 0.0);
+    ev_prepare_init(&self->flush_w, _evsrv_flush_cb);
+    self->flush_conns = NULL;
+    self->wcork = false;
+    self->wbuf_high = EVSRV_DEFAULT_WBUF_HIGH;
+    self->wbuf_low = EVSRV_DEFAULT_WBUF_LOW;
+    self->zerocopy_min = 0;
+    self->wbuf_budget = 0;
+    self->wbuf_total = 0;
+    self->wbuf_shed = EVSRV_SHED_NONE;
+    self->wbuf_shed_pending = false;
+    self->accept_paused = 0;
 
     self->on_started = NULL;
     self->on_conn_create = NULL;
     self->on_conn_ready = NULL;
     self->on_conn_destroy = NULL;
     self->on_read = NULL;
+    evsrv_framing_init(&self->framing);
+    self->on_drain = NULL;
     self->on_graceful_stop = NULL;
-
-    self->connections_len = (size_t) sysconf(_SC_OPEN_MAX);
-    self->connections = (evsrv_conn**) calloc(self->connections_len, sizeof(evsrv_conn*));
-    memset(self->connections, 0, self->connections_len * sizeof(evsrv_conn*));
+    self->on_dispatch = NULL;
+    self->on_reject = NULL;
+
+    self->conn_pages = NULL;
+    self->conn_pages_len = 0;
+    self->conns = NULL;
+    self->watches = NULL;
+
+    self->conn_size = sizeof(evsrv_conn);
+    evsrv_pool_init(&self->conn_pool, self->conn_size, 0);
+    evsrv_pool_init(&self->info_pool, sizeof(struct evsrv_conn_info), 0);
+    evsrv_pool_init(&self->wblock_pool, EVSRV_WBLOCK_LEN, 16);
+    evsrv_pool_init(&self->wchunk_pool, sizeof(struct evsrv_wchunk), 0);
+
+    self->bufpool = NULL;
+    self->own_bufpool = false;
+    self->rbuf_size = EVSRV_DEFAULT_BUF_LEN;
+    self->rbuf_max = EVSRV_DEFAULT_BUF_MAX;
+    self->rbuf_mode = EVSRV_RBUF_POOLED;
 
     self->data = NULL;
 }
@@ -51,12 +141,37 @@ void evsrv_destroy(evsrv* self) {
     }
     free(self->host);
     free(self->port);
-    free(self->connections);
+    for (size_t i = 0; i < self->conn_pages_len; ++i) {
+        free(self->conn_pages[i]);
+    }
+    free(self->conn_pages);
+    self->conn_pages = NULL;
+    self->conn_pages_len = 0;
+#if EVSRV_USE_URING
+    if (self->uring) {
+        // closing the ring ends sends still in flight, their chunks go with the orphans then
+        evsrv_uring_destroy(self->uring);
+        free(self->uring);
+        self->uring = NULL;
+    }
+#endif
+    evsrv_conn_orphans_destroy(self);
+    evsrv_pool_destroy(&self->conn_pool);
+    evsrv_pool_destroy(&self->info_pool);
+    evsrv_pool_destroy(&self->wblock_pool);
+    evsrv_pool_destroy(&self->wchunk_pool);
+    evsrv_iplimit_destroy(&self->iplimit);
+    if (self->own_bufpool) {
+        evsrv_bufpool_destroy(self->bufpool);
+        free(self->bufpool);
+        self->own_bufpool = false;
+    }
+    self->bufpool = NULL;
     self->manager = NULL;
 }
 
 int evsrv_bind(evsrv* self) {
-    if (strncasecmp(self->host, "unix/", 5) == 0) { // unix domain socket
+    if (evsrv_is_unix(self)) { // unix domain socket
         size_t path_len = strlen(self->port);
         if (path_len > 107) {
             cwarn("Too long unix socket path. Max is 107 chars.");
@@ -100,6 +215,15 @@ int evsrv_bind(evsrv* self) {
         cerror("Error setting socket options: SO_REUSEADDR");
     }
 
+#ifdef SO_REUSEPORT
+    if (self->reuseport && !evsrv_is_unix(self)) {
+        if (setsockopt(self->sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            cerror("Error setting socket options: SO_REUSEPORT");
+            return -1;
+        }
+    }
+#endif
+
     if (evsrv_is_tcp(self)) {
 #if EVSRV_USE_TCP_NO_DELAY != 0
         if (self->sockaddr.ss.ss_family == AF_INET || self->sockaddr.ss.ss_family == AF_INET6) {
@@ -125,6 +249,27 @@ int evsrv_bind(evsrv* self) {
         return -1;
     }
 
+    self->accept_flags = _evsrv_accept_flags(self);
+
+    self->state = EVSRV_BOUND;
+    return 0;
+}
+
+int evsrv_bind_shared(evsrv* self, const evsrv* origin) {
+    if (origin->sock < 0) {
+        cwarn("Cannot share socket of unbound server %s:%s", origin->host, origin->port);
+        return -1;
+    }
+
+    self->sock = dup(origin->sock);
+    if (self->sock < 0) {
+        cerror("Error duplicating socket %d", origin->sock);
+        return -1;
+    }
+    self->sockaddr = origin->sockaddr;
+    self->accept_flags = origin->accept_flags;
+    ev_io_init(&self->accept_rw, _evsrv_accept_cb, self->sock, EV_READ);
+
     self->state = EVSRV_BOUND;
     return 0;
 }
@@ -142,8 +287,17 @@ int evsrv_listen(evsrv* self) {
 }
 
 int evsrv_accept(evsrv* self) {
-    ev_io_start(self->loop, &self->accept_rw);
     self->state = EVSRV_ACCEPTING;
+    if (self->spare_fd < 0) {
+        self->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    if (self->lag_threshold > 0 && !ev_is_active(&self->lag_w)) {
+        self->lag_due = ev_now(self->loop) + EVSRV_LAG_INTERVAL;
+        ev_timer_start(self->loop, &self->lag_w);
+    }
+    if (!self->accept_paused) {
+        _evsrv_accept_start(self);
+    }
     if (self->on_started) {
         self->on_started(self);
     }
@@ -157,13 +311,14 @@ void _evsrv_accept_cb(struct ev_loop* loop, ev_io* w, int revents) {
         return;
     }
 
-    while (1) {
+    // bounded, so a connect storm does not starve established connections; the rest is accepted on the next iteration
+    for (size_t accepted = 0; self->accept_batch == 0 || accepted < self->accept_batch; ++accepted) {
         struct evsrv_sockaddr conn_addr;
         conn_addr.slen = sizeof(conn_addr.ss);
         int conn_sock;
 
         again:
-        conn_sock = accept(w->fd, (struct sockaddr*) &conn_addr.ss, &conn_addr.slen);
+        conn_sock = _evsrv_accept_sock(w->fd, &conn_addr);
 
         if (conn_sock < 0) {
             switch (errno) {
@@ -171,6 +326,10 @@ void _evsrv_accept_cb(struct ev_loop* loop, ev_io* w, int revents) {
                     return;
                 case EINTR:
                     goto again;
+                case EMFILE:
+                case ENFILE:
+                    _evsrv_accept_out_of_fds(self);
+                    break;
                 default:
                     cerror("accept error");
                     break;
@@ -178,59 +337,481 @@ void _evsrv_accept_cb(struct ev_loop* loop, ev_io* w, int revents) {
             return;
         }
 
-        struct evsrv_conn_info* conn_info = (struct evsrv_conn_info*) malloc(sizeof(struct evsrv_conn_info));
-        conn_info->sock = conn_sock;
-        conn_info->addr = conn_addr;
-        ++self->active_connections;
-
-        evsrv_conn* conn = NULL;
-        if (self->on_conn_create) {
-            conn = self->on_conn_create(self, conn_info);
-        } else {
-            conn = (evsrv_conn*) malloc(sizeof(evsrv_conn));
-            evsrv_conn_init(conn, self, conn_info);
-            conn->on_read = self->on_read;
-            conn->rbuf = (char*) malloc(EVSRV_DEFAULT_BUF_LEN * sizeof(char));
-            conn->rlen = EVSRV_DEFAULT_BUF_LEN;
+        struct evsrv_conn_info conn_info;
+        conn_info.sock = conn_sock;
+        conn_info.addr = conn_addr;
+        conn_info.flags = self->accept_flags;
+
+        _evsrv_accepted(self, &conn_info);
+        if (self->accept_paused) {
+            return;
         }
+    }
+}
+
+void _evsrv_accepted(evsrv* self, const struct evsrv_conn_info* info) {
+    if (unlikely(self->lag_shedding && self->on_reject)) {
+        _evsrv_reject(self, info);
+        return;
+    }
+    if (self->on_dispatch) {
+        self->on_dispatch(self, info);
+    } else {
+        evsrv_add_conn(self, info);
+    }
+}
 
-        if (unlikely(self->connections[conn_info->sock] != NULL)) {
-            evsrv_conn_close(self->connections[conn_info->sock], 0);
+void _evsrv_reject(evsrv* self, const struct evsrv_conn_info* info) {
+    if (self->on_reject) {
+        self->on_reject(self, info);
+        struct linger linger = { 0, 0 }; // a zero linger timeout would discard the reply with a reset
+        setsockopt(info->sock, SOL_SOCKET, SO_LINGER, &linger, (socklen_t) sizeof(linger));
+    }
+    close(info->sock);
+}
+
+// without the spare descriptor the pending connection stays in the backlog and the listener stays readable
+void _evsrv_accept_out_of_fds(evsrv* self) {
+    if (self->idle_evict && evsrv_conn_evict_idle(self, 1) > 0) {
+        return; // the listener is still readable, accepting is retried with the freed descriptor
+    }
+    evsrv_manager* mgr = self->manager;
+    for (size_t i = 0; mgr != NULL && i < mgr->srvs_len; ++i) {
+        if (mgr->srvs[i] != self && mgr->srvs[i]->idle_evict && evsrv_conn_evict_idle(mgr->srvs[i], 1) > 0) {
+            return;
         }
-        self->connections[conn_info->sock] = conn;
+    }
 
-        evsrv_conn_start(conn);
+    cwarn("Out of file descriptors with %d connections, pausing accept of %s:%s",
+          self->active_connections, self->host, self->port);
+    if (self->spare_fd > -1) {
+        close(self->spare_fd);
+        int sock = accept(self->sock, NULL, NULL);
+        if (sock > -1) {
+            close(sock);
+        }
+        self->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    evsrv_accept_pause(self, EVSRV_ACCEPT_PAUSE_FDS);
+    ev_timer_again(self->loop, &self->accept_retry_w);
+}
 
-        if (self->on_conn_ready) {
-            self->on_conn_ready(conn);
+void _evsrv_accept_retry_cb(struct ev_loop* loop, ev_timer* w, int revents) {
+    evsrv* self = SELFby(w, evsrv, accept_retry_w);
+    ev_timer_stop(loop, w);
+    evsrv_accept_resume(self, EVSRV_ACCEPT_PAUSE_FDS);
+}
+
+static void _evsrv_conn_pool_sync(evsrv* self) {
+    if (unlikely(self->conn_pool.obj_size < self->conn_size)) {
+        // conn_size was changed after the pool was set up
+        assert("conn_size can not be changed with connections alive" && self->conn_pool.used == 0);
+        evsrv_pool_destroy(&self->conn_pool);
+        evsrv_pool_init(&self->conn_pool, self->conn_size, 0);
+    }
+}
+
+int evsrv_prewarm(evsrv* self, size_t conns_count) {
+    if (evsrv_pool_prewarm(&self->info_pool, conns_count) < 0) {
+        return -1;
+    }
+    _evsrv_conn_pool_sync(self);
+    return evsrv_pool_prewarm(&self->conn_pool, conns_count);
+}
+
+evsrv_bufpool* evsrv_get_bufpool(evsrv* self) {
+    if (unlikely(self->bufpool == NULL)) {
+        self->bufpool = (evsrv_bufpool*) malloc(sizeof(evsrv_bufpool));
+        evsrv_bufpool_init(self->bufpool);
+        self->own_bufpool = true;
+    }
+    return self->bufpool;
+}
+
+evsrv_conn* evsrv_alloc_conn(evsrv* self) {
+    _evsrv_conn_pool_sync(self);
+    return (evsrv_conn*) evsrv_pool_alloc(&self->conn_pool);
+}
+
+void evsrv_free_conn(evsrv* self, evsrv_conn* conn) {
+    evsrv_pool_free(&self->conn_pool, conn);
+}
+
+void evsrv_free_conn_info(evsrv* self, struct evsrv_conn_info* info) {
+    evsrv_pool_free(&self->info_pool, info);
+}
+
+void evsrv_add_conn(evsrv* self, const struct evsrv_conn_info* info) {
+    if (unlikely(self->engine == EVSRV_ENGINE_URING && self->uring == NULL)) {
+        _evsrv_get_uring(self); // dispatched connections arrive without evsrv_accept
+    }
+    if (unlikely(_evsrv_conns_full(self))) {
+        // accepted in the same batch or dispatched before accepting was paused
+        cwarn("Connection limit of %s:%s reached, closing connection %d", self->host, self->port, info->sock);
+        close(info->sock);
+        return;
+    }
+    bool iplimited = evsrv_iplimit_enabled(&self->iplimit);
+    if (iplimited && evsrv_iplimit_admit(&self->iplimit, &info->addr, ev_now(self->loop)) < 0) {
+        _evsrv_reject(self, info);
+        return;
+    }
+    if (self->idle_evict && self->idle_limit > 0 && self->active_connections >= self->idle_limit) {
+        evsrv_conn_evict_idle(self, self->active_connections - self->idle_limit + 1);
+    }
+    struct evsrv_conn_info* conn_info = (struct evsrv_conn_info*) evsrv_pool_alloc(&self->info_pool);
+    if (unlikely(conn_info == NULL)) {
+        cerror("Could not allocate connection info for %d", info->sock);
+        if (iplimited) {
+            evsrv_iplimit_release(&self->iplimit, &info->addr, ev_now(self->loop));
         }
+        close(info->sock);
+        return;
+    }
+    *conn_info = *info;
+    __atomic_add_fetch(&self->active_connections, 1, __ATOMIC_RELAXED); // read by a dispatching acceptor
+    _evsrv_conns_grown(self);
+
+    evsrv_conn* conn = NULL;
+    if (self->on_conn_create) {
+        conn = self->on_conn_create(self, conn_info);
+    } else {
+        conn = evsrv_alloc_conn(self);
+        evsrv_conn_init(conn, self, conn_info);
+        conn->on_read = self->on_read;
+        conn->framing = self->framing;
+        conn->on_drain = self->on_drain;
+        conn->wcork = self->wcork;
+        evsrv_conn_set_rbuf_mode(conn, self->rbuf_mode);
+    }
+    conn->iplimited = iplimited;
+
+    evsrv_conn* stale = evsrv_get_conn(self, conn_info->sock);
+    if (unlikely(stale != NULL)) {
+        evsrv_conn_close(stale, 0);
+    }
+    evsrv_register_conn(self, conn);
+
+    evsrv_conn_start(conn);
+
+    if (self->on_conn_ready) {
+        self->on_conn_ready(conn);
     }
 }
 
+evsrv_conn* evsrv_get_conn(evsrv* self, int sock) {
+    size_t page = (size_t) sock >> EVSRV_CONN_PAGE_BITS;
+    if (sock < 0 || page >= self->conn_pages_len || self->conn_pages[page] == NULL) {
+        return NULL;
+    }
+    return self->conn_pages[page]->conns[sock & ((1 << EVSRV_CONN_PAGE_BITS) - 1)];
+}
+
+void evsrv_register_conn(evsrv* self, evsrv_conn* conn) {
+    int sock = conn->info->sock;
+    size_t page = (size_t) sock >> EVSRV_CONN_PAGE_BITS;
+
+    if (page >= self->conn_pages_len) {
+        size_t pages_len = self->conn_pages_len ? self->conn_pages_len : 1;
+        while (pages_len <= page) {
+            pages_len *= 2;
+        }
+        self->conn_pages = (struct evsrv_conn_page**) realloc(self->conn_pages, pages_len * sizeof(struct evsrv_conn_page*));
+        memset(self->conn_pages + self->conn_pages_len, 0, (pages_len - self->conn_pages_len) * sizeof(struct evsrv_conn_page*));
+        self->conn_pages_len = pages_len;
+    }
+    if (self->conn_pages[page] == NULL) {
+        self->conn_pages[page] = (struct evsrv_conn_page*) calloc(1, sizeof(struct evsrv_conn_page));
+    }
+
+    struct evsrv_conn_page* p = self->conn_pages[page];
+    p->conns[sock & ((1 << EVSRV_CONN_PAGE_BITS) - 1)] = conn;
+    ++p->used;
+
+    conn->prev = NULL;
+    conn->next = self->conns;
+    if (self->conns) {
+        self->conns->prev = conn;
+    }
+    self->conns = conn;
+}
+
+void evsrv_unregister_conn(evsrv* self, evsrv_conn* conn) {
+    int sock = conn->info ? conn->info->sock : -1;
+    if (sock > -1 && evsrv_get_conn(self, sock) == conn) {
+        size_t page = (size_t) sock >> EVSRV_CONN_PAGE_BITS;
+        struct evsrv_conn_page* p = self->conn_pages[page];
+        p->conns[sock & ((1 << EVSRV_CONN_PAGE_BITS) - 1)] = NULL;
+        if (--p->used == 0) {
+            free(p);
+            self->conn_pages[page] = NULL;
+        }
+    }
+
+    if (conn->prev == NULL && self->conns != conn) {
+        return; // not linked
+    }
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        self->conns = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    conn->prev = NULL;
+    conn->next = NULL;
+}
+
+void evsrv_accept_pause(evsrv* self, unsigned reason) {
+    self->accept_paused |= reason;
+    _evsrv_accept_stop(self);
+}
+
+void evsrv_accept_resume(evsrv* self, unsigned reason) {
+    if (!(self->accept_paused & reason)) {
+        return;
+    }
+    self->accept_paused &= ~reason;
+    if (!self->accept_paused && self->state == EVSRV_ACCEPTING && self->accept_rw.fd > -1) {
+        _evsrv_accept_start(self);
+    }
+}
+
+/*************************** connection limit ***************************/
+
+#define _evsrv_conns_over(active, max) ((max) > 0 && (active) >= (max))
+
+bool _evsrv_conns_full(evsrv* self) {
+    evsrv_manager* mgr = self->manager;
+    return _evsrv_conns_over(self->active_connections, self->max_connections) ||
+           (mgr != NULL && _evsrv_conns_over(mgr->active_connections, mgr->max_connections));
+}
+
+// called once a connection is added: stops accepting at the limit
+void _evsrv_conns_grown(evsrv* self) {
+    evsrv_manager* mgr = self->manager;
+    if (mgr != NULL) {
+        __atomic_add_fetch(&mgr->active_connections, 1, __ATOMIC_RELAXED);
+        if (_evsrv_conns_over(mgr->active_connections, mgr->max_connections) && !mgr->conns_refusing) {
+            mgr->conns_refusing = true;
+            for (size_t i = 0; i < mgr->srvs_len; ++i) {
+                evsrv_accept_pause(mgr->srvs[i], EVSRV_ACCEPT_PAUSE_CONNS);
+            }
+        }
+    }
+    if (_evsrv_conns_over(self->active_connections, self->max_connections)) {
+        evsrv_accept_pause(self, EVSRV_ACCEPT_PAUSE_CONNS);
+    }
+}
+
+// called once a connection is closed: resumes accepts paused by the limit or by running out of descriptors
+void evsrv_conns_shrunk(evsrv* self) {
+    evsrv_manager* mgr = self->manager;
+    if (mgr != NULL) {
+        __atomic_sub_fetch(&mgr->active_connections, 1, __ATOMIC_RELAXED);
+        if (mgr->parent != NULL && __atomic_load_n(&mgr->parent->conns_refusing, __ATOMIC_SEQ_CST)) {
+            ev_async_send(mgr->parent->loop, &mgr->parent->notify_w); // dispatching acceptors wait for a free slot
+        }
+        if (mgr->conns_refusing && !_evsrv_conns_over(mgr->active_connections, mgr->max_connections)) {
+            mgr->conns_refusing = false;
+            for (size_t i = 0; i < mgr->srvs_len; ++i) {
+                evsrv* srv = mgr->srvs[i];
+                if (!_evsrv_conns_over(srv->active_connections, srv->max_connections)) {
+                    evsrv_accept_resume(srv, EVSRV_ACCEPT_PAUSE_CONNS);
+                }
+            }
+        }
+    }
+    if (!_evsrv_conns_full(self)) {
+        evsrv_accept_resume(self, EVSRV_ACCEPT_PAUSE_CONNS);
+    }
+    if (unlikely(self->accept_paused & EVSRV_ACCEPT_PAUSE_FDS)) {
+        ev_timer_stop(self->loop, &self->accept_retry_w);
+        evsrv_accept_resume(self, EVSRV_ACCEPT_PAUSE_FDS);
+    }
+}
+
+/*************************** loop lag ***************************/
+
+// the sample is how late the timer fires, i.e. how long the loop was busy with callbacks instead of polling
+void _evsrv_lag_cb(struct ev_loop* loop, ev_timer* w, int revents) {
+    evsrv* self = SELFby(w, evsrv, lag_w);
+    ev_tstamp now = ev_now(loop);
+    self->lag = now > self->lag_due ? now - self->lag_due : 0.0;
+
+    if (!self->lag_shedding && self->lag > self->lag_threshold) {
+        cwarn("Loop lag of %s:%s is %.3fs, %s new connections", self->host, self->port, self->lag,
+              self->on_reject ? "rejecting" : "pausing accept of");
+        self->lag_shedding = true;
+        if (!self->on_reject) {
+            evsrv_accept_pause(self, EVSRV_ACCEPT_PAUSE_LAG);
+        }
+    } else if (self->lag_shedding && self->lag < self->lag_threshold / 2) {
+        self->lag_shedding = false;
+        evsrv_accept_resume(self, EVSRV_ACCEPT_PAUSE_LAG);
+    }
+
+    self->lag_due = now + EVSRV_LAG_INTERVAL;
+    ev_timer_set(w, EVSRV_LAG_INTERVAL, 0.0);
+    ev_timer_start(loop, w);
+}
+
+/*************************** write buffer budget ***************************/
+
+#define _evsrv_wbuf_over(total, budget) ((budget) > 0 && (total) > (budget))
+
+static evsrv_conn* _evsrv_wbuf_victim(evsrv** srvs, size_t srvs_len, enum evsrv_wbuf_shed shed) {
+    evsrv_conn* victim = NULL;
+    for (size_t i = 0; i < srvs_len; ++i) {
+        for (evsrv_conn* conn = srvs[i]->conns; conn != NULL; conn = conn->next) {
+            if (conn->wbytes == 0) {
+                continue;
+            }
+            if (victim == NULL ||
+                (shed == EVSRV_SHED_LARGEST && conn->wbytes > victim->wbytes) ||
+                (shed == EVSRV_SHED_OLDEST && conn->wsince < victim->wsince)) {
+                victim = conn;
+            }
+        }
+    }
+    return victim;
+}
+
+static void _evsrv_wbuf_shed(evsrv** srvs, size_t srvs_len, enum evsrv_wbuf_shed shed,
+                             const size_t* total, size_t budget) {
+    while (_evsrv_wbuf_over(*total, budget)) {
+        evsrv_conn* victim = _evsrv_wbuf_victim(srvs, srvs_len, shed);
+        if (victim == NULL) {
+            return;
+        }
+        cwarn("Write buffer budget %zu exceeded, closing connection %d with %zu bytes queued",
+              budget, victim->info->sock, victim->wbytes);
+        evsrv_conn_shutdown(victim, EVSRV_SHUT_RDWR);
+        evsrv_conn_close(victim, ENOBUFS);
+    }
+}
+
+// called when a connection's write queue grows: refuses accepts at once, sheds at the end of loop iteration
+void evsrv_wbuf_grown(evsrv* self) {
+    evsrv_manager* mgr = self->manager;
+    bool srv_over = _evsrv_wbuf_over(self->wbuf_total, self->wbuf_budget);
+    bool mgr_over = mgr != NULL && _evsrv_wbuf_over(mgr->wbuf_total, mgr->wbuf_budget);
+    if (likely(!srv_over && !mgr_over)) {
+        return;
+    }
+
+    if (srv_over && self->wbuf_shed == EVSRV_SHED_REFUSE) {
+        evsrv_accept_pause(self, EVSRV_ACCEPT_PAUSE_WBUF);
+    }
+    if (mgr_over && mgr->wbuf_shed == EVSRV_SHED_REFUSE && !mgr->wbuf_refusing) {
+        mgr->wbuf_refusing = true;
+        for (size_t i = 0; i < mgr->srvs_len; ++i) {
+            evsrv_accept_pause(mgr->srvs[i], EVSRV_ACCEPT_PAUSE_WBUF);
+        }
+    }
+
+    if ((srv_over && (self->wbuf_shed == EVSRV_SHED_LARGEST || self->wbuf_shed == EVSRV_SHED_OLDEST)) ||
+        (mgr_over && (mgr->wbuf_shed == EVSRV_SHED_LARGEST || mgr->wbuf_shed == EVSRV_SHED_OLDEST))) {
+        // the writer may be one of the victims, so never close connections under its feet
+        self->wbuf_shed_pending = true;
+        if (!ev_is_active(&self->flush_w)) {
+            ev_prepare_start(self->loop, &self->flush_w);
+        }
+    }
+}
+
+// called when a connection's write queue shrinks: resumes accepts refused because of the budget
+void evsrv_wbuf_shrunk(evsrv* self) {
+    evsrv_manager* mgr = self->manager;
+    if (likely(!(self->accept_paused & EVSRV_ACCEPT_PAUSE_WBUF))) {
+        return;
+    }
+
+    if (mgr != NULL && mgr->wbuf_refusing) {
+        if (_evsrv_wbuf_over(mgr->wbuf_total, mgr->wbuf_budget)) {
+            return;
+        }
+        mgr->wbuf_refusing = false;
+        for (size_t i = 0; i < mgr->srvs_len; ++i) {
+            evsrv* srv = mgr->srvs[i];
+            if (srv->wbuf_shed != EVSRV_SHED_REFUSE || !_evsrv_wbuf_over(srv->wbuf_total, srv->wbuf_budget)) {
+                evsrv_accept_resume(srv, EVSRV_ACCEPT_PAUSE_WBUF);
+            }
+        }
+    } else if (!_evsrv_wbuf_over(self->wbuf_total, self->wbuf_budget)) {
+        evsrv_accept_resume(self, EVSRV_ACCEPT_PAUSE_WBUF);
+    }
+}
+
+static void _evsrv_wbuf_shed_pending(evsrv* self) {
+    evsrv_manager* mgr = self->manager;
+    self->wbuf_shed_pending = false;
+
+    if (self->wbuf_shed == EVSRV_SHED_LARGEST || self->wbuf_shed == EVSRV_SHED_OLDEST) {
+        _evsrv_wbuf_shed(&self, 1, self->wbuf_shed, &self->wbuf_total, self->wbuf_budget);
+    }
+    if (mgr != NULL && (mgr->wbuf_shed == EVSRV_SHED_LARGEST || mgr->wbuf_shed == EVSRV_SHED_OLDEST)) {
+        _evsrv_wbuf_shed(mgr->srvs, mgr->srvs_len, mgr->wbuf_shed, &mgr->wbuf_total, mgr->wbuf_budget);
+    }
+}
+
+void _evsrv_flush_cb(struct ev_loop* loop, ev_prepare* w, int revents) {
+    evsrv* self = SELFby(w, evsrv, flush_w);
+    while (self->flush_conns != NULL) {
+        evsrv_conn_flush(self->flush_conns);
+    }
+    if (self->wbuf_shed_pending) {
+        _evsrv_wbuf_shed_pending(self);
+    }
+    ev_prepare_stop(loop, w);
+#if EVSRV_USE_URING
+    if (self->uring) {
+        evsrv_uring_submit(self->uring); // sends queued by the flush above must not wait for the next iteration
+    }
+#endif
+}
+
 void evsrv_stop(evsrv* self) {
-    evsrv_stop_io(self->loop, &self->accept_rw);
+    _evsrv_accept_stop(self);
+    evsrv_stop_timer(self->loop, &self->accept_retry_w);
+    evsrv_stop_timer(self->loop, &self->lag_w);
 
     if (self->sock > 0) {
         close(self->sock);
         self->sock = -1;
     }
+    if (self->spare_fd > -1) {
+        close(self->spare_fd);
+        self->spare_fd = -1;
+    }
 
-    for (size_t i = 0; i < self->connections_len; ++i) {
-        evsrv_conn* conn = self->connections[i];
-        if (conn != NULL) {
-            evsrv_conn_close(conn, 0);
-        }
+    while (self->conns != NULL) {
+        evsrv_conn_close(self->conns, 0);
+    }
+    evsrv_stop_timer(self->loop, &self->rtimeouts.w);
+    evsrv_stop_timer(self->loop, &self->wtimeouts.w);
+    evsrv_stop_timer(self->loop, &self->throttled.w);
+    evsrv_conn_defer_stop(self);
+    if (ev_is_active(&self->flush_w)) {
+        ev_prepare_stop(self->loop, &self->flush_w);
     }
     self->state = EVSRV_STOPPED;
 }
 
 void evsrv_graceful_stop(evsrv* self, evsrv_on_graceful_stop_cb cb) {
-    evsrv_stop_io(self->loop, &self->accept_rw);
+    _evsrv_accept_stop(self);
+    evsrv_stop_timer(self->loop, &self->accept_retry_w);
+    evsrv_stop_timer(self->loop, &self->lag_w);
 
     if (self->sock > 0) {
         close(self->sock);
         self->sock = -1;
     }
+    if (self->spare_fd > -1) {
+        close(self->spare_fd);
+        self->spare_fd = -1;
+    }
 
     self->state = EVSRV_GRACEFULLY_STOPPING;
     if (self->active_connections == 0) {
@@ -238,25 +819,160 @@ void evsrv_graceful_stop(evsrv* self, evsrv_on_graceful_stop_cb cb) {
         cb(self);
     } else {
         self->on_graceful_stop = cb;
-        for (size_t i = 0; i < self->connections_len; ++i) {
-            evsrv_conn* conn = self->connections[i];
-            if (conn != NULL) {
-                bool closed = true;
-                if (conn->on_graceful_close) {
-                    closed = conn->on_graceful_close(conn);
-                    if (!closed) {
-                        conn->state = EVSRV_CONN_PENDING_CLOSE;
-                    }
-                } else {
-                    evsrv_conn_close(conn, 0);
-                }
+        evsrv_conn* next = NULL;
+        for (evsrv_conn* conn = self->conns; conn != NULL; conn = next) {
+            next = conn->next;
+            if (conn->state == EVSRV_CONN_PENDING_CLOSE) {
+                continue; // asked already, before a restart of the walk
+            }
 
-                if (closed && self->active_connections == 0) {
-                    self->state = EVSRV_STOPPED;
-                    self->on_graceful_stop(self);
-                    break;
+            // the walk goes on from the next connection unless closing this one closed it as well
+            struct evsrv_conn_watch watch;
+            if (next != NULL) {
+                evsrv_conn_watch(next, &watch);
+            }
+            bool closed = true;
+            if (conn->on_graceful_close) {
+                closed = conn->on_graceful_close(conn);
+                if (!closed) {
+                    conn->state = EVSRV_CONN_PENDING_CLOSE;
                 }
+            } else {
+                evsrv_conn_close(conn, 0);
+            }
+            if (next != NULL && evsrv_conn_unwatch(self, &watch)) {
+                next = self->conns;
+            }
+
+            if (self->state != EVSRV_GRACEFULLY_STOPPING) {
+                break; // the last pending connection was closed by the callback
+            }
+            if (closed && self->active_connections == 0) {
+                self->state = EVSRV_STOPPED;
+                self->on_graceful_stop(self);
+                break;
             }
         }
     }
 }
+
+/*************************** io_uring engine ***************************/
+
+#if EVSRV_USE_URING
+
+static void _evsrv_uring_accept_arm(evsrv* self) {
+    struct io_uring_sqe* sqe = evsrv_uring_get_sqe(self->uring);
+    if (unlikely(sqe == NULL)) {
+        cerror("Could not queue accept of %s:%s", self->host, self->port);
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = self->sock;
+    if (self->max_connections == 0 && (self->manager == NULL || self->manager->max_connections == 0)) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT; // otherwise the kernel accepts past the limit before the cancel lands
+    }
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = evsrv_uring_data(EVSRV_URING_ACCEPT, self->sock, ++self->uring_accept_gen);
+    self->uring_accepting = true;
+}
+
+static void _evsrv_uring_accept_complete(evsrv* self, const struct io_uring_cqe* cqe) {
+    bool current = evsrv_uring_data_gen(cqe->user_data) == self->uring_accept_gen;
+    if (current && !(cqe->flags & IORING_CQE_F_MORE)) {
+        self->uring_accepting = false;
+    }
+
+    if (cqe->res >= 0) {
+        struct evsrv_conn_info conn_info;
+        conn_info.sock = cqe->res;
+        conn_info.flags = self->accept_flags;
+        conn_info.addr.slen = sizeof(conn_info.addr.ss);
+        if (getpeername(conn_info.sock, (struct sockaddr*) &conn_info.addr.ss, &conn_info.addr.slen) < 0) {
+            conn_info.addr.slen = 0;
+        }
+
+        _evsrv_accepted(self, &conn_info);
+    } else if (cqe->res == -EMFILE || cqe->res == -ENFILE) {
+        _evsrv_accept_out_of_fds(self);
+    } else if (cqe->res != -ECANCELED) {
+        errno = -cqe->res;
+        cerror("accept error");
+    }
+
+    if (current && !self->uring_accepting && self->state == EVSRV_ACCEPTING && !self->accept_paused && self->sock > -1) {
+        _evsrv_uring_accept_arm(self);
+    }
+}
+
+static void _evsrv_uring_cqe_cb(evsrv_uring* ring, const struct io_uring_cqe* cqe) {
+    evsrv* self = (evsrv*) ring->data;
+    switch (evsrv_uring_data_op(cqe->user_data)) {
+        case EVSRV_URING_ACCEPT:
+            _evsrv_uring_accept_complete(self, cqe);
+            break;
+        case EVSRV_URING_RECV:
+        case EVSRV_URING_SEND:
+            evsrv_conn_uring_complete(self, cqe);
+            break;
+        default:
+            break;
+    }
+}
+
+struct evsrv_uring_s* _evsrv_get_uring(evsrv* self) {
+    if (self->uring != NULL) {
+        return self->uring;
+    }
+    evsrv_uring* ring = (evsrv_uring*) malloc(sizeof(evsrv_uring));
+    if (ring == NULL || evsrv_uring_init(self->loop, ring, EVSRV_URING_ENTRIES, EVSRV_URING_BUFS, EVSRV_URING_BUF_LEN) < 0) {
+        cwarn("io_uring is not available, falling back to ev engine for %s:%s", self->host, self->port);
+        free(ring);
+        self->engine = EVSRV_ENGINE_EV;
+        return NULL;
+    }
+    ring->data = self;
+    evsrv_uring_set_on_cqe(ring, _evsrv_uring_cqe_cb);
+    self->uring = ring;
+    return ring;
+}
+
+void _evsrv_accept_start(evsrv* self) {
+    if (self->engine == EVSRV_ENGINE_URING && _evsrv_get_uring(self) != NULL) {
+        if (!self->uring_accepting) {
+            _evsrv_uring_accept_arm(self);
+        }
+        return;
+    }
+    ev_io_start(self->loop, &self->accept_rw);
+}
+
+void _evsrv_accept_stop(evsrv* self) {
+    evsrv_stop_io(self->loop, &self->accept_rw);
+    if (self->uring != NULL && self->uring_accepting) {
+        struct io_uring_sqe* sqe = evsrv_uring_get_sqe(self->uring);
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = evsrv_uring_data(EVSRV_URING_ACCEPT, self->sock, self->uring_accept_gen);
+            sqe->user_data = evsrv_uring_data(EVSRV_URING_CANCEL, self->sock, 0);
+            evsrv_uring_submit(self->uring); // listening socket may be closed right after
+        }
+        self->uring_accepting = false;
+    }
+}
+
+#else
+
+struct evsrv_uring_s* _evsrv_get_uring(evsrv* self) {
+    self->engine = EVSRV_ENGINE_EV;
+    return NULL;
+}
+
+void _evsrv_accept_start(evsrv* self) {
+    ev_io_start(self->loop, &self->accept_rw);
+}
+
+void _evsrv_accept_stop(evsrv* self) {
+    evsrv_stop_io(self->loop, &self->accept_rw);
+}
+
+#endif // EVSRV_USE_URING
@@ -1,76 +1,453 @@
 #include "evsrv_conn.h"
 #include "evsrv.h"
+#include "evsrv_manager.h"
+#include "evsrv_uring.h"
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#if EVSRV_USE_ZEROCOPY
+#  include <linux/errqueue.h>
+#endif
 
 static void _evsrv_conn_read_cb(struct ev_loop* loop, ev_io* w, int revents);
 static void _evsrv_conn_read_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents);
 
 static void _evsrv_conn_write_cb(struct ev_loop* loop, ev_io* w, int revents);
 static void _evsrv_conn_write_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents);
+static void _evsrv_conn_write_timer_again(evsrv_conn* self);
+static void _evsrv_conn_write_timer_stop(evsrv_conn* self);
+
+static void _evsrv_conn_throttle_cb(struct ev_loop* loop, ev_timer* w, int revents);
+static void _evsrv_conn_defer_cb(struct ev_loop* loop, ev_check* w, int revents);
+static void _evsrv_conn_defer_idle_cb(struct ev_loop* loop, ev_idle* w, int revents);
+static int _evsrv_conn_rbuf_settle(evsrv_conn* self);
+static int _evsrv_conn_deliver(evsrv_conn* self, ssize_t nread);
+static int _evsrv_conn_eof(evsrv_conn* self);
+
+static void _evsrv_tlist_append(struct evsrv_tlist* list, struct evsrv_tnode* node, ev_tstamp deadline);
+static void _evsrv_tlist_touch(struct ev_loop* loop, struct evsrv_tlist* list, struct evsrv_tnode* node, ev_tstamp timeout);
+static void _evsrv_tlist_remove(struct evsrv_tlist* list, struct evsrv_tnode* node);
+static struct evsrv_tnode* _evsrv_tlist_expired(struct ev_loop* loop, struct evsrv_tlist* list);
+
+static int _evsrv_conn_rbuf_attach(evsrv_conn* self, size_t size);
+static void _evsrv_conn_rbuf_detach(evsrv_conn* self);
+static int _evsrv_conn_rbuf_resize(evsrv_conn* self, size_t size);
+static size_t _evsrv_conn_rbuf_want(evsrv_conn* self);
+
+static int _evsrv_conn_wqueue_append(evsrv_conn* self, const char* buf, size_t len);
+static void _evsrv_conn_wqueue_consume(evsrv_conn* self, size_t len);
+static void _evsrv_conn_wqueue_clear(evsrv_conn* self);
+static int _evsrv_conn_wqueue_flush(evsrv_conn* self);
+static void _evsrv_conn_unschedule_flush(evsrv_conn* self);
+static void _evsrv_conn_wqueue_grown(evsrv_conn* self);
+static void _evsrv_conn_wqueue_shrunk(evsrv_conn* self);
+static void _evsrv_conn_ended(evsrv_conn* self);
+static void _evsrv_conn_zc_complete(evsrv_conn* self);
+static void _evsrv_conn_orphan(evsrv_conn* self);
+static void _evsrv_conn_orphans_cb(struct ev_loop* loop, ev_timer* w, int revents);
+static void _evsrv_conn_read_pause(evsrv_conn* self);
+static void _evsrv_conn_read_resume(evsrv_conn* self);
+static int _evsrv_conn_on_data(evsrv_conn* self, ssize_t nread);
+static void _evsrv_conn_uring_recv(evsrv_conn* self);
+static void _evsrv_conn_uring_cancel(evsrv_conn* self, int op);
+static void _evsrv_conn_uring_send(evsrv_conn* self);
+static void _evsrv_conn_uring_orphan(evsrv_conn* self);
+
+// the engine writes in batches on its own, writing right away would only cost syscalls
+#define _evsrv_conn_write_direct(conn) ((conn)->wnow && !(conn)->wcork && (conn)->srv->uring == NULL)
+
+/*************************** timeouts ***************************/
+
+void evsrv_conn_timeouts_init(evsrv* srv) {
+    srv->rtimeouts.head = NULL;
+    srv->rtimeouts.tail = NULL;
+    ev_timer_init(&srv->rtimeouts.w, _evsrv_conn_read_timeout_cb, 0.0, 0.0);
+    srv->wtimeouts.head = NULL;
+    srv->wtimeouts.tail = NULL;
+    ev_timer_init(&srv->wtimeouts.w, _evsrv_conn_write_timeout_cb, 0.0, 0.0);
+    srv->idle.head = NULL;
+    srv->idle.tail = NULL;
+    ev_timer_init(&srv->idle.w, NULL, 0.0, 0.0);
+    srv->throttled.head = NULL;
+    srv->throttled.tail = NULL;
+    ev_timer_init(&srv->throttled.w, _evsrv_conn_throttle_cb, 0.0, 0.0);
+    srv->deferred.head = NULL;
+    srv->deferred.tail = NULL;
+    ev_timer_init(&srv->deferred.w, NULL, 0.0, 0.0);
+    ev_check_init(&srv->defer_w, _evsrv_conn_defer_cb);
+    ev_idle_init(&srv->defer_idle_w, _evsrv_conn_defer_idle_cb);
+    srv->orphans = NULL;
+    srv->uring_orphans = NULL;
+    ev_timer_init(&srv->orphans_w, _evsrv_conn_orphans_cb, 0.0, EVSRV_ZEROCOPY_POLL);
+}
+
+void _evsrv_tlist_append(struct evsrv_tlist* list, struct evsrv_tnode* node, ev_tstamp deadline) {
+    _evsrv_tlist_remove(list, node);
+    node->deadline = deadline;
+    node->prev = list->tail;
+    if (list->tail) {
+        list->tail->next = node;
+    } else {
+        list->head = node;
+    }
+    list->tail = node;
+}
+
+// O(1): the node goes to the tail, the timer is only armed when the list has none
+void _evsrv_tlist_touch(struct ev_loop* loop, struct evsrv_tlist* list, struct evsrv_tnode* node, ev_tstamp timeout) {
+    _evsrv_tlist_append(list, node, ev_now(loop) + timeout);
+
+    if (!ev_is_active(&list->w)) {
+        ev_timer_set(&list->w, timeout, 0.0);
+        ev_timer_start(loop, &list->w);
+    }
+}
+
+// the timer is left running, firing with an empty or not yet expired head only rearms it
+void _evsrv_tlist_remove(struct evsrv_tlist* list, struct evsrv_tnode* node) {
+    if (node->deadline == 0) {
+        return;
+    }
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        list->head = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        list->tail = node->prev;
+    }
+    node->prev = NULL;
+    node->next = NULL;
+    node->deadline = 0;
+}
+
+// pops the head once its deadline has passed, otherwise rearms the timer for it and returns NULL
+struct evsrv_tnode* _evsrv_tlist_expired(struct ev_loop* loop, struct evsrv_tlist* list) {
+    struct evsrv_tnode* head = list->head;
+    if (head == NULL) {
+        return NULL;
+    }
+    ev_tstamp left = head->deadline - ev_now(loop);
+    if (left > 0) {
+        ev_timer_stop(loop, &list->w); // may be armed for a later node by a touch from a closing connection
+        ev_timer_set(&list->w, left, 0.0);
+        ev_timer_start(loop, &list->w);
+        return NULL;
+    }
+    _evsrv_tlist_remove(list, head);
+    return head;
+}
+
+/*************************** idle eviction ***************************/
+
+#define _evsrv_conn_idle_touch(self) do { \
+    if ((self)->srv->idle_evict) { \
+        _evsrv_tlist_append(&(self)->srv->idle, &(self)->ito, ev_now((self)->srv->loop)); \
+    } \
+} while (0)
+
+// connections in the middle of a response are never picked, neither are the ones waiting for their graceful close
+static bool _evsrv_conn_evictable(evsrv_conn* self) {
+    return self->state == EVSRV_CONN_ACTIVE && self->whead == NULL && !self->rpaused && self->usends == 0;
+}
+
+int evsrv_conn_evict_idle(evsrv* srv, int count) {
+    ev_tstamp before = ev_now(srv->loop) - srv->idle_min;
+    int evicted = 0;
+    struct evsrv_tnode* next = NULL;
+    for (struct evsrv_tnode* node = srv->idle.head; node != NULL && evicted < count; node = next) {
+        if (node->deadline > before) {
+            break; // the rest were active even more recently
+        }
+        next = node->next;
+        evsrv_conn* conn = SELFby(node, evsrv_conn, ito);
+        if (!_evsrv_conn_evictable(conn)) {
+            continue;
+        }
+
+        // the scan goes on from the next connection unless closing this one closed or untracked it as well
+        struct evsrv_conn_watch watch;
+        if (next != NULL) {
+            evsrv_conn_watch(SELFby(next, evsrv_conn, ito), &watch);
+        }
+        _evsrv_tlist_remove(&srv->idle, node);
+        if (srv->idle_graceful && conn->on_graceful_close) {
+            if (conn->on_graceful_close(conn)) {
+                ++evicted;
+            } else {
+                conn->state = EVSRV_CONN_PENDING_CLOSE;
+            }
+        } else {
+            evsrv_conn_shutdown(conn, EVSRV_SHUT_RDWR);
+            evsrv_conn_close(conn, 0);
+            ++evicted;
+        }
+        if (next != NULL && (evsrv_conn_unwatch(srv, &watch) || next->deadline == 0)) {
+            next = srv->idle.head;
+        }
+    }
+    if (evicted > 0) {
+        cwarn("Evicted %d idle connections of %s:%s", evicted, srv->host, srv->port);
+    }
+    return evicted;
+}
+
+/*************************** read rate ***************************/
+
+// pauses reading once the peer's address runs out of read tokens, the data already read is still handled
+static void _evsrv_conn_read_charge(evsrv_conn* self, size_t nread) {
+    evsrv* srv = self->srv;
+    if (evsrv_iplimit_read(&srv->iplimit, &self->info->addr, nread, ev_now(srv->loop), &self->iphint) >= 0 ||
+        (self->rpaused & EVSRV_CONN_RPAUSE_RATE)) {
+        return;
+    }
+    self->rpaused |= EVSRV_CONN_RPAUSE_RATE;
+    _evsrv_conn_read_pause(self);
+    evsrv_conn_read_timer_stop(self);
+    _evsrv_tlist_touch(srv->loop, &srv->throttled, &self->tto, EVSRV_IP_THROTTLE_DELAY);
+}
+
+void _evsrv_conn_throttle_cb(struct ev_loop* loop, ev_timer* w, int revents) {
+    if (EV_ERROR & revents) {
+        cerror("error occured");
+        return;
+    }
+    evsrv* srv = SELFby(w, evsrv, throttled.w);
+
+    struct evsrv_tnode* node;
+    while ((node = _evsrv_tlist_expired(loop, &srv->throttled)) != NULL) {
+        evsrv_conn* self = SELFby(node, evsrv_conn, tto);
+        if (evsrv_iplimit_read(&srv->iplimit, &self->info->addr, 0, ev_now(loop), &self->iphint) < 0) {
+            _evsrv_tlist_touch(loop, &srv->throttled, &self->tto, EVSRV_IP_THROTTLE_DELAY);
+            continue;
+        }
+        self->rpaused &= ~EVSRV_CONN_RPAUSE_RATE;
+        if (!self->rpaused) {
+            _evsrv_conn_read_resume(self);
+            evsrv_conn_read_timer_again(self);
+        }
+    }
+}
+
+/*************************** deferred reads ***************************/
+
+// on_read leaves the rest of rbuf for later: reading stops and on_read is called again with
+// EVSRV_READ_RESUMED once every connection deferred before it had its turn
+void evsrv_conn_defer(evsrv_conn* self) {
+    evsrv* srv = self->srv;
+    if (self->state != EVSRV_CONN_ACTIVE || self->dto.deadline != 0) {
+        return;
+    }
+    if (!(self->rpaused & EVSRV_CONN_RPAUSE_DEFER)) {
+        self->rpaused |= EVSRV_CONN_RPAUSE_DEFER;
+        _evsrv_conn_read_pause(self);
+        evsrv_conn_read_timer_stop(self);
+    }
+    _evsrv_tlist_append(&srv->deferred, &self->dto, ev_now(srv->loop));
+    if (!ev_is_active(&srv->defer_w)) {
+        ev_check_start(srv->loop, &srv->defer_w);
+        ev_idle_start(srv->loop, &srv->defer_idle_w);
+    }
+}
+
+void evsrv_conn_defer_stop(evsrv* srv) {
+    if (ev_is_active(&srv->defer_w)) {
+        ev_check_stop(srv->loop, &srv->defer_w);
+    }
+    if (ev_is_active(&srv->defer_idle_w)) {
+        ev_idle_stop(srv->loop, &srv->defer_idle_w);
+    }
+}
+
+// one round per loop iteration, so sockets are polled between the turns of a connection
+void _evsrv_conn_defer_cb(struct ev_loop* loop, ev_check* w, int revents) {
+    if (EV_ERROR & revents) {
+        cerror("error occured");
+        return;
+    }
+    evsrv* srv = SELFby(w, evsrv, defer_w);
+
+    size_t turns = 0;
+    for (struct evsrv_tnode* node = srv->deferred.head; node != NULL; node = node->next) {
+        ++turns;
+    }
+
+    struct evsrv_tnode* node;
+    while (turns-- > 0 && (node = srv->deferred.head) != NULL) {
+        _evsrv_tlist_remove(&srv->deferred, node);
+        evsrv_conn* self = SELFby(node, evsrv_conn, dto);
+        if (_evsrv_conn_deliver(self, EVSRV_READ_RESUMED) < 0) {
+            continue;
+        }
+        if (self->state != EVSRV_CONN_ACTIVE || self->dto.deadline != 0) {
+            continue; // shut down or deferred once more
+        }
+        if (_evsrv_conn_rbuf_settle(self) < 0) {
+            continue;
+        }
+        self->rpaused &= ~EVSRV_CONN_RPAUSE_DEFER;
+        if (!self->rpaused) {
+            _evsrv_conn_read_resume(self);
+            evsrv_conn_read_timer_again(self);
+        }
+    }
+
+    if (srv->deferred.head == NULL) {
+        evsrv_conn_defer_stop(srv);
+    }
+}
+
+void _evsrv_conn_defer_idle_cb(struct ev_loop* loop, ev_idle* w, int revents) {
+}
 
 /*************************** evsrv_conn ***************************/
 
 void evsrv_conn_init(evsrv_conn* self, evsrv* srv, struct evsrv_conn_info* info) {
     self->srv = srv;
     self->info = info;
+    self->prev = NULL;
+    self->next = NULL;
+    memset(&self->rto, 0, sizeof(self->rto));
+    memset(&self->wto, 0, sizeof(self->wto));
+    memset(&self->ito, 0, sizeof(self->ito));
+    memset(&self->tto, 0, sizeof(self->tto));
+    memset(&self->dto, 0, sizeof(self->dto));
+    self->iplimited = false;
+    self->iphint = UINT32_MAX;
     self->rbuf = NULL;
     self->ruse = 0;
     self->rlen = 0;
+    self->rmode = EVSRV_RBUF_USER;
+    self->ravg = 0;
     self->wnow = 1;
     self->state = EVSRV_CONN_CREATED;
 
-    self->wuse = 0;
-    self->wlen = 0;
-    self->wbuf = NULL;
+    self->whead = NULL;
+    self->wtail = NULL;
+    self->wbytes = 0;
+    self->wsince = 0;
+    self->wcork = false;
+    self->wend = false;
+    self->rpaused = 0;
+    self->zcopy = false;
+    self->zseq = 0;
+    self->zhead = NULL;
+    self->ztail = NULL;
+    self->ugen = 0;
+    self->urecv = false;
+    self->uheld = false;
+    self->usends = 0;
+    self->flush_pending = false;
+    self->flush_prev = NULL;
+    self->flush_next = NULL;
 
     self->on_read = NULL;
+    evsrv_framing_init(&self->framing);
     self->on_graceful_close = NULL;
+    self->on_drain = NULL;
 
     self->data = NULL;
 
-    if (evsrv_socket_set_nonblock(self->info->sock) < 0) {
-        cerror("Error setting socket %d to nonblock", self->info->sock);
+    if (!(self->info->flags & EVSRV_CONN_INFO_NONBLOCK)) {
+        if (evsrv_socket_set_nonblock(self->info->sock) < 0) {
+            cerror("Error setting socket %d to nonblock", self->info->sock);
+        }
+    }
+
+    if (!(self->info->flags & EVSRV_CONN_INFO_SOCKOPTS)) {
+        struct linger linger = { 1, 0 };
+        if (setsockopt(self->info->sock, SOL_SOCKET, SO_LINGER, &linger, (socklen_t) sizeof(linger)) < 0) {
+            cerror("Error setting socket options");
+        }
     }
 
-    struct linger linger = { 1, 0 };
-    if (setsockopt(self->info->sock, SOL_SOCKET, SO_LINGER, &linger, (socklen_t) sizeof(linger)) < 0) {
-        cerror("Error setting socket options");
+#if EVSRV_USE_ZEROCOPY
+    if (srv->zerocopy_min > 0) {
+        int one = 1;
+        self->zcopy = setsockopt(self->info->sock, SOL_SOCKET, SO_ZEROCOPY, &one, (socklen_t) sizeof(one)) == 0;
     }
+#endif
 }
 
 void evsrv_conn_start(evsrv_conn* self) {
     ev_io_init(&self->rw, _evsrv_conn_read_cb, self->info->sock, EV_READ);
-    ev_io_start(self->srv->loop, &self->rw);
-
-    ev_timer_init(&self->trw, _evsrv_conn_read_timeout_cb, self->srv->read_timeout, 0);
-    if (self->srv->read_timeout > 0) {
-        ev_timer_start(self->srv->loop, &self->trw);
+    if (self->srv->uring) {
+        self->ugen = ++self->srv->uring_gen;
+    } else {
+        ev_io_start(self->srv->loop, &self->rw);
     }
 
+    evsrv_conn_read_timer_again(self);
+    _evsrv_conn_idle_touch(self);
+
     ev_io_init(&self->ww, _evsrv_conn_write_cb, self->info->sock, EV_WRITE);
-    ev_timer_init(&self->tww, _evsrv_conn_write_timeout_cb, self->srv->write_timeout, 0);
     self->state = EVSRV_CONN_ACTIVE;
+
+    if (self->srv->uring) {
+        _evsrv_conn_uring_recv(self);
+    }
 }
 
 void evsrv_conn_stop(evsrv_conn* self) {
     evsrv_stop_io(self->srv->loop, &self->rw);
-    evsrv_stop_timer(self->srv->loop, &self->trw);
+    evsrv_conn_read_timer_stop(self);
     evsrv_stop_io(self->srv->loop, &self->ww);
-    evsrv_stop_timer(self->srv->loop, &self->tww);
+    _evsrv_conn_write_timer_stop(self);
+    _evsrv_tlist_remove(&self->srv->idle, &self->ito);
+    _evsrv_tlist_remove(&self->srv->throttled, &self->tto);
+    _evsrv_tlist_remove(&self->srv->deferred, &self->dto);
+    _evsrv_conn_unschedule_flush(self);
+    if (self->urecv) {
+        _evsrv_conn_uring_cancel(self, EVSRV_URING_RECV);
+    }
 
+    self->rpaused = 0;
     self->state = EVSRV_CONN_STOPPED;
 }
 
 void evsrv_conn_read_timer_again(evsrv_conn* self) {
     if (self->srv->read_timeout > 0) {
-        ev_timer_again(self->srv->loop, &self->trw);
+        _evsrv_tlist_touch(self->srv->loop, &self->srv->rtimeouts, &self->rto, self->srv->read_timeout);
     }
 }
 
 void evsrv_conn_read_timer_stop(evsrv_conn* self) {
-    evsrv_stop_timer(self->srv->loop, &self->trw);
+    _evsrv_tlist_remove(&self->srv->rtimeouts, &self->rto);
+}
+
+// pauses reading on behalf of the user, e.g. while a request is answered asynchronously
+void evsrv_conn_read_pause(evsrv_conn* self) {
+    if (self->rpaused & EVSRV_CONN_RPAUSE_USER) {
+        return;
+    }
+    self->rpaused |= EVSRV_CONN_RPAUSE_USER;
+    _evsrv_conn_read_pause(self);
+    evsrv_conn_read_timer_stop(self);
+}
+
+void evsrv_conn_read_resume(evsrv_conn* self) {
+    if (!(self->rpaused & EVSRV_CONN_RPAUSE_USER)) {
+        return;
+    }
+    self->rpaused &= ~EVSRV_CONN_RPAUSE_USER;
+    if (!self->rpaused) {
+        _evsrv_conn_read_resume(self);
+        evsrv_conn_read_timer_again(self);
+    }
+}
+
+void _evsrv_conn_write_timer_again(evsrv_conn* self) {
+    if (unlikely(self->srv->write_timeout > 0)) {
+        _evsrv_tlist_touch(self->srv->loop, &self->srv->wtimeouts, &self->wto, self->srv->write_timeout);
+    }
+}
+
+void _evsrv_conn_write_timer_stop(evsrv_conn* self) {
+    _evsrv_tlist_remove(&self->srv->wtimeouts, &self->wto);
 }
 
 void evsrv_conn_destroy(evsrv_conn* self) {
@@ -79,20 +456,17 @@ void evsrv_conn_destroy(evsrv_conn* self) {
         self->info->sock = -1;
     }
 
-    free(self->info);
+    evsrv_free_conn_info(self->srv, self->info);
     self->info = NULL;
 
-    // cleanup of rbuf should be performed by the allocator (who allocated)
+    // cleanup of user's rbuf should be performed by the allocator (who allocated)
+    if (self->rmode != EVSRV_RBUF_USER && self->rbuf != NULL) {
+        _evsrv_conn_rbuf_detach(self);
+    }
     self->ruse = 0;
     self->rlen = 0;
 
-    for (size_t i = 0; i < self->wuse; ++i) {
-        free(self->wbuf[i].iov_base);
-    }
-    free(self->wbuf);
-    self->wbuf = NULL;
-    self->wuse = 0;
-    self->wlen = 0;
+    _evsrv_conn_wqueue_clear(self);
 
     self->srv = NULL;
 }
@@ -105,27 +479,44 @@ void evsrv_conn_shutdown(evsrv_conn* self, int how) {
 }
 
 void evsrv_conn_close(evsrv_conn* self, int err) {
-    int sock = self->info->sock;
     evsrv* srv = self->srv;
     enum evsrv_conn_state prev_state = self->state;
 
+    for (struct evsrv_conn_watch* watch = srv->watches; watch != NULL; watch = watch->next) {
+        if (watch->conn == self) {
+            watch->closed = true;
+        }
+    }
+
     self->state = EVSRV_CONN_CLOSING;
     evsrv_conn_stop(self);
+    evsrv_unregister_conn(srv, self);
+
+    if (self->usends > 0) {
+        _evsrv_conn_uring_orphan(self);
+    }
+
+    // nothing is going to be written anymore, release queued data and its share of the budget.
+    // Chunks the kernel still reads zero-copy wait for completion along with the socket
+    _evsrv_conn_orphan(self);
+    _evsrv_conn_wqueue_clear(self);
+    evsrv_wbuf_shrunk(srv);
+    if (self->iplimited) {
+        evsrv_iplimit_release(&srv->iplimit, &self->info->addr, ev_now(srv->loop));
+        self->iplimited = false;
+    }
+
     if (self->srv->on_conn_destroy) {
         self->srv->on_conn_destroy(self, err);
     } else {
         if (!srv->on_conn_create) { // Then we created conn by ourselves, need to cleanup
             evsrv_conn_destroy(self);
-            free(self->rbuf);
-            self->rbuf = NULL;
-            free(self);
+            evsrv_free_conn(srv, self);
         }
     }
 
-    if (sock > 0) {
-        srv->connections[sock] = NULL;
-    }
-    --srv->active_connections;
+    __atomic_sub_fetch(&srv->active_connections, 1, __ATOMIC_RELAXED);
+    evsrv_conns_shrunk(srv);
 
     if (prev_state == EVSRV_CONN_PENDING_CLOSE &&
         srv->active_connections == 0 &&
@@ -136,221 +527,939 @@ void evsrv_conn_close(evsrv_conn* self, int err) {
     }
 }
 
-void evsrv_conn_write(evsrv_conn* conn, const void* buffer, size_t len) {
-    const char* buf = (const char*) buffer;
-    if (len == 0) len = strlen(buf);
+void evsrv_conn_watch(evsrv_conn* self, struct evsrv_conn_watch* watch) {
+    evsrv* srv = self->srv;
+    watch->conn = self;
+    watch->closed = false;
+    watch->next = srv->watches;
+    srv->watches = watch;
+}
 
-    if (conn->wuse) {
-        if (conn->wuse == conn->wlen) {
-            conn->wlen += 2;
-            conn->wbuf = realloc(conn->wbuf, sizeof(struct iovec) * ( conn->wlen ));
+// returns true when the connection was closed while watched
+bool evsrv_conn_unwatch(evsrv* srv, struct evsrv_conn_watch* watch) {
+    for (struct evsrv_conn_watch** w = &srv->watches; *w != NULL; w = &(*w)->next) {
+        if (*w == watch) {
+            *w = watch->next;
+            break;
         }
-        conn->wbuf[conn->wuse].iov_base = memdup(buf, len);
-        conn->wbuf[conn->wuse].iov_len  = len;
-        //cwarn("iov[%d] stored %zu: %p",conn->wuse,len, conn->wbuf[conn->wuse].iov_base);
-        conn->wuse++;
-        return;
     }
+    return watch->closed;
+}
 
-    ssize_t wr = 0;
+int _evsrv_conn_rbuf_attach(evsrv_conn* self, size_t size) {
+    self->rbuf = evsrv_bufpool_alloc(evsrv_get_bufpool(self->srv), size, &self->rlen);
+    self->ruse = 0;
+    return self->rbuf != NULL ? 0 : -1;
+}
 
-    if (conn->wnow) {
-        again:
-        wr = write(conn->ww.fd, buf, len);
-        // cwarn("writing %d",len);
-        if ( wr == len ) {
-            // success
-            // cwarn("written now %zu %u",wr, *((uint32_t *)(buf + 8)) );
-            return;
-        }
-        else
-        if (wr > -1) {
-            // cwarn("written part %zu %u",wr, *((uint32_t *)(buf + 8)) );
-            //partial write, passthru
-        }
-        else
-        {
-            switch(errno) {
-                case EINTR:
-                    goto again;
-                case EAGAIN:
-                    wr = 0;
-                    break;
-                default:
-                    cerror("connection failed while write [now]");
-                    evsrv_conn_close(conn, errno);
-                    return;
-            }
-        }
-    }
+void _evsrv_conn_rbuf_detach(evsrv_conn* self) {
+    evsrv_bufpool_free(evsrv_get_bufpool(self->srv), self->rbuf, self->rlen);
+    self->rbuf = NULL;
+    self->rlen = 0;
+    self->ruse = 0;
+}
 
-    if (unlikely(conn->wlen == 0)) {
-        conn->wlen = 2;
-        conn->wbuf = calloc(conn->wlen, sizeof(struct iovec));
+int _evsrv_conn_rbuf_resize(evsrv_conn* self, size_t size) {
+    size_t rlen;
+    char* rbuf = evsrv_bufpool_alloc(evsrv_get_bufpool(self->srv), size, &rlen);
+    if (rbuf == NULL) {
+        return -1;
     }
-    conn->wbuf[0].iov_base = memdup(buf + wr, len - wr);
-    conn->wbuf[0].iov_len = len - wr;
-    conn->wuse = 1;
-
-    ev_io_start(conn->srv->loop, &conn->ww);
-    if (unlikely(conn->srv->write_timeout > 0)) {
-        ev_timer_again(conn->srv->loop, &conn->tww);
+    size_t ruse = self->ruse;
+    if (ruse > 0) {
+        memcpy(rbuf, self->rbuf, ruse);
     }
+    _evsrv_conn_rbuf_detach(self);
+    self->rbuf = rbuf;
+    self->rlen = rlen;
+    self->ruse = ruse;
+    return 0;
 }
 
-
-void _evsrv_conn_read_cb(struct ev_loop* loop, ev_io* w, int revents) {
-    if (EV_ERROR & revents) {
-        cerror("error occured");
-        return;
+size_t _evsrv_conn_rbuf_want(evsrv_conn* self) {
+    size_t size = self->srv->rbuf_size;
+    size_t want = self->ravg * 2;
+    if (self->srv->rbuf_max > size && want > size) {
+        size = want < self->srv->rbuf_max ? want : self->srv->rbuf_max;
     }
+    return evsrv_bufpool_size(size);
+}
 
-    evsrv_conn* self = SELFby(w, evsrv_conn, rw);
+void evsrv_conn_set_rbuf_mode(evsrv_conn* self, enum evsrv_conn_rbuf_mode mode) {
+    if (self->rmode != EVSRV_RBUF_USER && self->rbuf != NULL && self->ruse == 0) {
+        _evsrv_conn_rbuf_detach(self);
+    }
+    self->rmode = mode;
+    if (mode == EVSRV_RBUF_POOLED && self->rbuf == NULL) {
+        if (_evsrv_conn_rbuf_attach(self, _evsrv_conn_rbuf_want(self)) < 0) {
+            cerror("Could not allocate read buffer");
+        }
+    }
+}
 
-    evsrv_stop_timer(loop, &self->trw);
+// keeps server's and manager's totals of queued bytes in sync with the connection's queue
+static inline void _evsrv_conn_wbytes_add(evsrv_conn* self, size_t n) {
+    if (self->wbytes == 0) {
+        self->wsince = ev_now(self->srv->loop);
+    }
+    self->wbytes += n;
+    self->srv->wbuf_total += n;
+    if (self->srv->manager) {
+        self->srv->manager->wbuf_total += n;
+    }
+}
 
-    ssize_t nread;
-    again:
-    nread = read(w->fd, self->rbuf + self->ruse, self->rlen - self->ruse);
-    if (nread > 0) {
-        self->ruse += nread;
+static inline void _evsrv_conn_wbytes_sub(evsrv_conn* self, size_t n) {
+    self->wbytes -= n;
+    self->srv->wbuf_total -= n;
+    if (self->srv->manager) {
+        self->srv->manager->wbuf_total -= n;
+    }
+}
 
-        if (self->on_read) {
-            self->on_read(self, nread);
-        }
-        if (self->ruse != 0 &&  self->ruse == self->rlen) {
-            evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
-            evsrv_conn_close(self, ENOBUFS);
-        }
+static struct evsrv_wchunk* _evsrv_conn_wqueue_push_block(evsrv_conn* self) {
+    struct evsrv_wchunk* chunk = (struct evsrv_wchunk*) evsrv_pool_alloc(&self->srv->wblock_pool);
+    if (unlikely(chunk == NULL)) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->type = EVSRV_WCHUNK_BLOCK;
+    chunk->data = (char*) (chunk + 1);
+    chunk->head = 0;
+    chunk->len = 0;
+    chunk->cap = self->srv->wblock_pool.obj_size - sizeof(struct evsrv_wchunk);
+    chunk->release = NULL;
+    chunk->ctx = NULL;
+    chunk->fd = -1;
+    chunk->offset = 0;
+    chunk->zerocopy = false;
+    chunk->zpending = false;
+    chunk->zseq = 0;
 
-    } else if (nread < 0) {
-        switch (errno) {
-            case EAGAIN:
-                return;
-            case EINTR:
-                goto again;
-            default:
-                cerror("read error");
-                evsrv_conn_close(self, errno);
-                return;
-        }
+    if (self->wtail) {
+        self->wtail->next = chunk;
     } else {
-        // cerror("read EOF");
-        if (self->on_read) {
-            self->on_read(self, 0);
-        }
-        evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
-        evsrv_conn_close(self, errno);
+        self->whead = chunk;
     }
+    self->wtail = chunk;
+    return chunk;
 }
 
-void _evsrv_conn_read_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents) {
-    if (EV_ERROR & revents) {
-        cerror("error occured");
-        return;
+static int _evsrv_conn_wqueue_push_ref(evsrv_conn* self, const char* buf, size_t head, size_t len,
+                                       evsrv_wchunk_release_cb release, void* ctx) {
+    struct evsrv_wchunk* chunk = (struct evsrv_wchunk*) evsrv_pool_alloc(&self->srv->wchunk_pool);
+    if (unlikely(chunk == NULL)) {
+        return -1;
     }
-    evsrv_conn* self = SELFby(w, evsrv_conn, trw);
+    chunk->next = NULL;
+    chunk->type = EVSRV_WCHUNK_REF;
+    chunk->data = (char*) buf;
+    chunk->head = head;
+    chunk->len = len;
+    chunk->cap = len;
+    chunk->release = release;
+    chunk->ctx = ctx;
+    chunk->fd = -1;
+    chunk->offset = 0;
+    chunk->zerocopy = false;
+    chunk->zpending = false;
+    chunk->zseq = 0;
 
-    ev_timer_stop(loop, &self->trw);
-    cwarn("read timer triggered");
-    evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
-    evsrv_conn_close(self, errno);
+    if (self->wtail) {
+        self->wtail->next = chunk;
+    } else {
+        self->whead = chunk;
+    }
+    self->wtail = chunk;
+    _evsrv_conn_wbytes_add(self, len - head);
+    return 0;
 }
 
-void _evsrv_conn_write_cb(struct ev_loop* loop, ev_io* w, int revents) {
-    if (EV_ERROR & revents) {
-        cerror("error occured");
-        return;
+static int _evsrv_conn_wqueue_push_file(evsrv_conn* self, int fd, off_t offset, size_t len) {
+    struct evsrv_wchunk* chunk = (struct evsrv_wchunk*) evsrv_pool_alloc(&self->srv->wchunk_pool);
+    if (unlikely(chunk == NULL)) {
+        return -1;
     }
-    evsrv_conn* self = SELFby(w, evsrv_conn, ww);
-
-    evsrv_stop_timer(loop, &self->tww);
+    chunk->next = NULL;
+    chunk->type = EVSRV_WCHUNK_FILE;
+    chunk->data = NULL;
+    chunk->head = 0;
+    chunk->len = len;
+    chunk->cap = len;
+    chunk->release = NULL;
+    chunk->ctx = NULL;
+    chunk->fd = fd;
+    chunk->offset = offset;
+    chunk->zerocopy = false;
+    chunk->zpending = false;
+    chunk->zseq = 0;
 
-    ssize_t wr;
-    int iovcur, iov_total = 0;
-    struct iovec *iov;
+    if (self->wtail) {
+        self->wtail->next = chunk;
+    } else {
+        self->whead = chunk;
+    }
+    self->wtail = chunk;
+    return 0;
+}
 
-    //cwarn("on ww io %p -> %p (fd: %d) [ wbufs: %d of %d ]", w, self, w->fd, self->wuse, self->wlen);
+static void _evsrv_conn_wchunk_release(evsrv* srv, struct evsrv_wchunk* chunk) {
+    switch (chunk->type) {
+        case EVSRV_WCHUNK_BLOCK:
+            evsrv_pool_free(&srv->wblock_pool, chunk);
+            break;
+        case EVSRV_WCHUNK_REF:
+            if (chunk->release) {
+                chunk->release(chunk->data, chunk->ctx);
+            }
+            evsrv_pool_free(&srv->wchunk_pool, chunk);
+            break;
+        case EVSRV_WCHUNK_FILE:
+            close(chunk->fd);
+            evsrv_pool_free(&srv->wchunk_pool, chunk);
+            break;
+    }
+}
 
-    struct iovec *head_ptr = self->wbuf;
+int _evsrv_conn_wqueue_append(evsrv_conn* self, const char* buf, size_t len) {
+    struct evsrv_wchunk* tail = self->wtail;
+    while (len > 0) {
+        if (tail == NULL || tail->type != EVSRV_WCHUNK_BLOCK || tail->len == tail->cap) {
+            tail = _evsrv_conn_wqueue_push_block(self);
+            if (unlikely(tail == NULL)) {
+                return -1;
+            }
+        }
+        size_t n = tail->cap - tail->len < len ? tail->cap - tail->len : len;
+        memcpy(tail->data + tail->len, buf, n);
+        tail->len += n;
+        _evsrv_conn_wbytes_add(self, n);
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
 
-    again: {
+void _evsrv_conn_wqueue_consume(evsrv_conn* self, size_t len) {
+    while (len > 0) {
+        struct evsrv_wchunk* chunk = self->whead;
+        size_t left = chunk->len - chunk->head;
+        if (chunk->type != EVSRV_WCHUNK_FILE) {
+            _evsrv_conn_wbytes_sub(self, len < left ? len : left);
+        }
+        if (len < left) {
+            chunk->head += len;
+            return;
+        }
+        len -= left;
+        self->whead = chunk->next;
+        if (self->whead == NULL) {
+            self->wtail = NULL;
+        }
+        if (chunk->zpending) {
+            // the kernel still reads from the chunk, hold it until completion is reported
+            chunk->next = NULL;
+            if (self->ztail) {
+                self->ztail->next = chunk;
+            } else {
+                self->zhead = chunk;
+            }
+            self->ztail = chunk;
+        } else {
+            _evsrv_conn_wchunk_release(self->srv, chunk);
+        }
+    }
+}
 
-        size_t iovs_to_write = self->wuse >= IOV_MAX ? IOV_MAX : self->wuse;
+void _evsrv_conn_wqueue_clear(evsrv_conn* self) {
+    while (self->whead != NULL) {
+        struct evsrv_wchunk* chunk = self->whead;
+        self->whead = chunk->next;
+        _evsrv_conn_wchunk_release(self->srv, chunk);
+    }
+    self->wtail = NULL;
+    _evsrv_conn_wbytes_sub(self, self->wbytes);
 
-        // cwarn("wr = %d from iov = %p", iovs_to_write, head_ptr);
+    while (self->zhead != NULL) {
+        struct evsrv_wchunk* chunk = self->zhead;
+        self->zhead = chunk->next;
+        _evsrv_conn_wchunk_release(self->srv, chunk);
+    }
+    self->ztail = NULL;
+}
 
-        // DEBUG1
-        // wr = writev(w->fd, head_ptr, iovs_to_write > 1 ? iovs_to_write -1 : 1);
+#if EVSRV_USE_ZEROCOPY
+// releases chunks of the list whose zero-copy sends are reported done on the socket's error queue,
+// returns true when the kernel copied the data instead
+static bool _evsrv_zc_reap(evsrv* srv, int sock, struct evsrv_wchunk** head, struct evsrv_wchunk** tail) {
+    bool copied = false;
+    char control[128];
+    while (*head != NULL) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
 
-        // DEBUG2
-        // if (head_ptr[iovs_to_write-1].iov_len > 1) {
-        // 	head_ptr[iovs_to_write-1].iov_len--;
-        // 	wr = writev(w->fd, head_ptr, iovs_to_write);
-        // 	head_ptr[iovs_to_write-1].iov_len++;
-        // } else {
-        // 	wr = writev(w->fd, head_ptr, iovs_to_write);
-        // }
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break; // EAGAIN: nothing more is completed yet
+        }
 
-        wr = writev(w->fd, head_ptr, (int) iovs_to_write);
-        if (wr > -1) {
-            for (iovcur = 0; iovcur < iovs_to_write; iovcur++) {
-                iov = &(head_ptr[iovcur]);
-                if (wr < iov->iov_len) {
-                    memmove(iov->iov_base, iov->iov_base + wr, iov->iov_len - wr);
-                    iov->iov_len -= wr;
-                    break;
-                } else {
-                    free(iov->iov_base);
-                    wr -= iov->iov_len;
-                }
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
             }
-            // cwarn("wr = %d, iovcur = %d/%d of %d",wr, iovcur, iovs_to_write, self->wuse);
-            if (iovcur == iovs_to_write && wr == 0) {
-                if (iovs_to_write == self->wuse) {
-                    // cwarn("all done");
-                    self->wuse -= iovs_to_write;
-                    ev_io_stop(loop, w);
-                    return;
-                } else {
-                    // cwarn("again");
-                    self->wuse -= iovcur;
-                    head_ptr   += iovcur;
-                    iov_total  += iovcur;
-                    goto again;
-                }
-            } else {
-                // written partially, finish
-                self->wuse -= iov_total + iovcur;
-                // cwarn("partially %p -> %p / %d", self->wbuf + iov_total + iovcur, self->wbuf, iov_total + iovcur);
-                memmove(self->wbuf, self->wbuf + iov_total + iovcur, self->wuse * sizeof(struct iovec));
-                if (unlikely(self->srv->write_timeout > 0)) {
-                    ev_timer_again(loop, &self->tww); // written not all, so restart timer
-                }
-                return;
+            struct sock_extended_err* serr = (struct sock_extended_err*) CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+                continue;
+            }
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                copied = true;
             }
 
-        }
-        else {
-            switch(errno) {
-                case EINTR:
-                    goto again;
-                case EAGAIN:
-                    if (unlikely(self->srv->write_timeout > 0)) {
-                        ev_timer_again(loop, &self->tww);
-                    }
-                    return;
-                case EINVAL:
-                    // einval may be a result only of corruption. dump a core is better than hangover
-                    abort();
-                default:
-                    cerror("connection failed while write [io]");
-                    evsrv_conn_close(self, errno);
-                    return;
+            uint32_t hi = serr->ee_data;
+            while (*head != NULL && (int32_t) ((*head)->zseq - hi) <= 0) {
+                struct evsrv_wchunk* chunk = *head;
+                *head = chunk->next;
+                if (*head == NULL) {
+                    *tail = NULL;
+                }
+                _evsrv_conn_wchunk_release(srv, chunk);
             }
         }
     }
-
+    return copied;
+}
+#endif
+
+void _evsrv_conn_zc_complete(evsrv_conn* self) {
+#if EVSRV_USE_ZEROCOPY
+    if (_evsrv_zc_reap(self->srv, self->info->sock, &self->zhead, &self->ztail)) {
+        self->zcopy = false; // e.g. loopback or no NIC support, copying ourselves is cheaper
+    }
+#endif
+}
+
+/*************************** orphans ***************************/
+
+// a closed connection hands the chunks the kernel may still read over to an orphan together with the socket.
+// They are released once completions arrive, or EVSRV_ZEROCOPY_LINGER later after the socket is closed
+void _evsrv_conn_orphan(evsrv_conn* self) {
+    if (self->info->sock < 0) {
+        return;
+    }
+    struct evsrv_wchunk* head = self->zhead;
+    struct evsrv_wchunk* tail = self->ztail;
+    if (self->whead != NULL && self->whead->zpending) {
+        // partially sent, completion of its later bytes comes after zhead's
+        struct evsrv_wchunk* chunk = self->whead;
+        self->whead = chunk->next;
+        if (self->whead == NULL) {
+            self->wtail = NULL;
+        }
+        chunk->next = NULL;
+        if (tail) {
+            tail->next = chunk;
+        } else {
+            head = chunk;
+        }
+        tail = chunk;
+    }
+    if (head == NULL) {
+        return;
+    }
+    self->zhead = NULL;
+    self->ztail = NULL;
+
+    evsrv* srv = self->srv;
+    struct evsrv_orphan* orphan = (struct evsrv_orphan*) malloc(sizeof(*orphan));
+    if (unlikely(orphan == NULL)) {
+        cerror("Failed to allocate an orphan, leaking zero-copy chunks of socket %d", self->info->sock);
+        return;
+    }
+    orphan->sock = self->info->sock;
+    self->info->sock = -1;
+    orphan->deadline = ev_now(srv->loop) + EVSRV_ZEROCOPY_LINGER;
+    orphan->ugen = 0;
+    orphan->usends = 0;
+    orphan->head = head;
+    orphan->tail = tail;
+
+    orphan->next = srv->orphans;
+    srv->orphans = orphan;
+    if (!ev_is_active(&srv->orphans_w)) {
+        ev_timer_again(srv->loop, &srv->orphans_w);
+    }
+}
+
+static void _evsrv_conn_orphan_free(evsrv* srv, struct evsrv_orphan* orphan) {
+    if (orphan->sock > -1) {
+        close(orphan->sock);
+    }
+    while (orphan->head != NULL) {
+        struct evsrv_wchunk* chunk = orphan->head;
+        orphan->head = chunk->next;
+        _evsrv_conn_wchunk_release(srv, chunk);
+    }
+    free(orphan);
+}
+
+void _evsrv_conn_orphans_cb(struct ev_loop* loop, ev_timer* w, int revents) {
+    evsrv* srv = SELFby(w, evsrv, orphans_w);
+    ev_tstamp now = ev_now(loop);
+    struct evsrv_orphan** o = &srv->orphans;
+    while (*o != NULL) {
+        struct evsrv_orphan* orphan = *o;
+#if EVSRV_USE_ZEROCOPY
+        if (orphan->sock > -1) {
+            _evsrv_zc_reap(srv, orphan->sock, &orphan->head, &orphan->tail);
+        }
+#endif
+        if (orphan->head == NULL || orphan->sock < 0) {
+            *o = orphan->next;
+            _evsrv_conn_orphan_free(srv, orphan);
+            continue;
+        }
+        if (now >= orphan->deadline) {
+            // the reset purges the send queue and unpins the pages, drivers get a poll interval to let go of them
+            close(orphan->sock);
+            orphan->sock = -1;
+        }
+        o = &orphan->next;
+    }
+    if (srv->orphans == NULL) {
+        ev_timer_stop(loop, w);
+    }
+}
+
+// closes sockets of the orphans and releases their chunks, the loop isn't going to run for them anymore
+void evsrv_conn_orphans_destroy(evsrv* srv) {
+    ev_timer_stop(srv->loop, &srv->orphans_w);
+    while (srv->orphans != NULL) {
+        struct evsrv_orphan* orphan = srv->orphans;
+        srv->orphans = orphan->next;
+        _evsrv_conn_orphan_free(srv, orphan);
+    }
+    while (srv->uring_orphans != NULL) {
+        struct evsrv_orphan* orphan = srv->uring_orphans;
+        srv->uring_orphans = orphan->next;
+        _evsrv_conn_orphan_free(srv, orphan);
+    }
+}
+
+// pauses reading once the write queue is above the high watermark
+void _evsrv_conn_wqueue_grown(evsrv_conn* self) {
+    evsrv_wbuf_grown(self->srv);
+    if ((self->rpaused & EVSRV_CONN_RPAUSE_WBUF) || !evsrv_conn_wbuf_full(self)) {
+        return;
+    }
+    self->rpaused |= EVSRV_CONN_RPAUSE_WBUF;
+    _evsrv_conn_read_pause(self);
+    evsrv_conn_read_timer_stop(self);
+}
+
+// sends FIN once everything queued is written. Closing right away would reset the connection because
+// of the zero linger timeout and discard unsent data, so the connection is closed on the peer's EOF
+// (or by the read timeout) and reads until then
+void evsrv_conn_end(evsrv_conn* self) {
+    self->wend = true;
+    if (self->whead == NULL && self->usends == 0) {
+        _evsrv_conn_ended(self);
+    }
+}
+
+void _evsrv_conn_ended(evsrv_conn* self) {
+    self->wend = false;
+    if (self->info->sock > -1) {
+        shutdown(self->info->sock, SHUT_WR);
+    }
+    evsrv_conn_read_timer_again(self);
+}
+
+// resumes reading and notifies the producer once the write queue is down to the low watermark
+void _evsrv_conn_wqueue_shrunk(evsrv_conn* self) {
+    evsrv_wbuf_shrunk(self->srv);
+    if (unlikely(self->wend) && self->whead == NULL && self->usends == 0) {
+        _evsrv_conn_ended(self);
+    }
+    if (!(self->rpaused & EVSRV_CONN_RPAUSE_WBUF) || self->wbytes > self->srv->wbuf_low) {
+        return;
+    }
+    self->rpaused &= ~EVSRV_CONN_RPAUSE_WBUF;
+    if (!self->rpaused) {
+        _evsrv_conn_read_resume(self);
+        evsrv_conn_read_timer_again(self);
+    }
+
+    if (self->on_drain) {
+        self->on_drain(self);
+    }
+}
+
+static void _evsrv_conn_free_owned(void* buf, void* ctx) {
+    free(buf);
+}
+
+static ssize_t _evsrv_conn_write_now(evsrv_conn* conn, const char* buf, size_t len) {
+    ssize_t wr;
+    again:
+    wr = write(conn->ww.fd, buf, len);
+    if (wr > -1) {
+        return wr;
+    }
+    switch(errno) {
+        case EINTR:
+            goto again;
+        case EAGAIN:
+            return 0;
+        default:
+            cerror("connection failed while write [now]");
+            evsrv_conn_close(conn, errno);
+            return -1;
+    }
+}
+
+static void _evsrv_conn_schedule_flush(evsrv_conn* self) {
+    if (self->flush_pending) {
+        return;
+    }
+    evsrv* srv = self->srv;
+    self->flush_pending = true;
+    self->flush_prev = NULL;
+    self->flush_next = srv->flush_conns;
+    if (srv->flush_conns) {
+        srv->flush_conns->flush_prev = self;
+    }
+    srv->flush_conns = self;
+
+    if (!ev_is_active(&srv->flush_w)) {
+        ev_prepare_start(srv->loop, &srv->flush_w);
+    }
+}
+
+void _evsrv_conn_unschedule_flush(evsrv_conn* self) {
+    if (!self->flush_pending) {
+        return;
+    }
+    if (self->flush_prev) {
+        self->flush_prev->flush_next = self->flush_next;
+    } else {
+        self->srv->flush_conns = self->flush_next;
+    }
+    if (self->flush_next) {
+        self->flush_next->flush_prev = self->flush_prev;
+    }
+    self->flush_prev = NULL;
+    self->flush_next = NULL;
+    self->flush_pending = false;
+}
+
+static void _evsrv_conn_write_start(evsrv_conn* conn) {
+    if (conn->wcork || conn->srv->uring) {
+        _evsrv_conn_schedule_flush(conn);
+        return;
+    }
+    ev_io_start(conn->srv->loop, &conn->ww);
+    _evsrv_conn_write_timer_again(conn);
+}
+
+void evsrv_conn_write_ref(evsrv_conn* conn, const void* buffer, size_t len, evsrv_wchunk_release_cb release, void* ctx) {
+    const char* buf = (const char*) buffer;
+    bool start = conn->whead == NULL;
+
+    if (unlikely(len == 0)) {
+        if (release) {
+            release((void*) buf, ctx);
+        }
+        return;
+    }
+
+    ssize_t wr = 0;
+    bool zerocopy = conn->zcopy && len >= conn->srv->zerocopy_min;
+    if (start && _evsrv_conn_write_direct(conn) && !zerocopy) {
+        wr = _evsrv_conn_write_now(conn, buf, len);
+        if (wr < 0) {
+            if (release) {
+                release((void*) buf, ctx);
+            }
+            return;
+        }
+        if ((size_t) wr == len) {
+            if (release) {
+                release((void*) buf, ctx);
+            }
+            return;
+        }
+    }
+
+    if (unlikely(_evsrv_conn_wqueue_push_ref(conn, buf, (size_t) wr, len, release, ctx) < 0)) {
+        cerror("could not queue write");
+        if (release) {
+            release((void*) buf, ctx);
+        }
+        evsrv_conn_close(conn, ENOMEM);
+        return;
+    }
+    conn->wtail->zerocopy = zerocopy;
+    _evsrv_conn_wqueue_grown(conn);
+    if (start) {
+        if (zerocopy && _evsrv_conn_write_direct(conn)) {
+            evsrv_conn_flush(conn);
+        } else {
+            _evsrv_conn_write_start(conn);
+        }
+    }
+}
+
+void evsrv_conn_write_owned(evsrv_conn* conn, void* buffer, size_t len, evsrv_wchunk_release_cb release, void* ctx) {
+    evsrv_conn_write_ref(conn, buffer, len, release ? release : _evsrv_conn_free_owned, ctx);
+}
+
+// the range is sent in order with other writes, fd may be closed by the caller right away
+int evsrv_conn_sendfile(evsrv_conn* conn, int fd, off_t offset, size_t len) {
+    if (unlikely(len == 0)) {
+        return 0;
+    }
+
+    int own_fd = dup(fd);
+    if (own_fd < 0) {
+        cerror("Could not duplicate file descriptor %d", fd);
+        return -1;
+    }
+
+    bool start = conn->whead == NULL;
+    if (unlikely(_evsrv_conn_wqueue_push_file(conn, own_fd, offset, len) < 0)) {
+        cerror("could not queue sendfile");
+        close(own_fd);
+        evsrv_conn_close(conn, ENOMEM);
+        return -1;
+    }
+    if (start) {
+        if (_evsrv_conn_write_direct(conn)) {
+            evsrv_conn_flush(conn);
+        } else {
+            _evsrv_conn_write_start(conn);
+        }
+    }
+    return 0;
+}
+
+void evsrv_conn_write(evsrv_conn* conn, const void* buffer, size_t len) {
+    const char* buf = (const char*) buffer;
+    if (len == 0) len = strlen(buf);
+
+    if (conn->whead) {
+        if (unlikely(_evsrv_conn_wqueue_append(conn, buf, len) < 0)) {
+            cerror("could not queue write");
+            evsrv_conn_close(conn, ENOMEM);
+            return;
+        }
+        _evsrv_conn_wqueue_grown(conn);
+        return;
+    }
+
+    ssize_t wr = 0;
+
+    if (_evsrv_conn_write_direct(conn)) {
+        wr = _evsrv_conn_write_now(conn, buf, len);
+        if (wr < 0 || (size_t) wr == len) {
+            return;
+        }
+    }
+
+    if (unlikely(_evsrv_conn_wqueue_append(conn, buf + wr, len - wr) < 0)) {
+        cerror("could not queue write");
+        evsrv_conn_close(conn, ENOMEM);
+        return;
+    }
+    _evsrv_conn_write_start(conn);
+    _evsrv_conn_wqueue_grown(conn);
+}
+
+
+// attaches pooled rbuf on demand, returns -1 when connection is closed
+static int _evsrv_conn_rbuf_ensure(evsrv_conn* self) {
+    if (unlikely(self->rbuf == NULL) && self->rmode != EVSRV_RBUF_USER) {
+        if (_evsrv_conn_rbuf_attach(self, _evsrv_conn_rbuf_want(self)) < 0) {
+            cerror("Could not allocate read buffer");
+            evsrv_conn_close(self, ENOMEM);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// handles nread bytes just placed at rbuf + ruse, returns -1 when connection is closed
+int _evsrv_conn_on_data(evsrv_conn* self, ssize_t nread) {
+    _evsrv_conn_idle_touch(self);
+    if (unlikely(self->iplimited && self->srv->iplimit.read_rate > 0)) {
+        _evsrv_conn_read_charge(self, (size_t) nread);
+    }
+    self->ruse += nread;
+    self->ravg += ((ssize_t) self->ruse - (ssize_t) self->ravg) / 8;
+
+    if (_evsrv_conn_deliver(self, nread) < 0) {
+        return -1;
+    }
+    return _evsrv_conn_rbuf_settle(self);
+}
+
+// passes data to framing or on_read, returns -1 when the connection was closed meanwhile
+int _evsrv_conn_deliver(evsrv_conn* self, ssize_t nread) {
+    evsrv* srv = self->srv;
+    self->uheld = false;
+    struct evsrv_conn_watch watch;
+    evsrv_conn_watch(self, &watch);
+    if (self->framing.on_frame) {
+        evsrv_frame_process(self);
+    } else if (self->on_read) {
+        self->on_read(self, nread);
+    }
+    return evsrv_conn_unwatch(srv, &watch) ? -1 : 0;
+}
+
+// the peer is done sending: on_read learns it with nread of 0, then the connection is closed unless
+// on_read did it already
+int _evsrv_conn_eof(evsrv_conn* self) {
+    if (self->on_read) {
+        evsrv* srv = self->srv;
+        struct evsrv_conn_watch watch;
+        evsrv_conn_watch(self, &watch);
+        self->on_read(self, 0);
+        if (evsrv_conn_unwatch(srv, &watch)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// grows a full rbuf or releases an empty one after on_read, returns -1 when connection is closed
+int _evsrv_conn_rbuf_settle(evsrv_conn* self) {
+    if (self->ruse != 0 &&  self->ruse == self->rlen) {
+        size_t rmax = self->srv->rbuf_max;
+        if (self->rmode == EVSRV_RBUF_USER || self->rlen >= rmax ||
+            _evsrv_conn_rbuf_resize(self, self->rlen * 2 < rmax ? self->rlen * 2 : rmax) < 0) {
+            evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
+            evsrv_conn_close(self, ENOBUFS);
+            return -1;
+        }
+    } else if (self->ruse == 0 && self->rmode != EVSRV_RBUF_USER) {
+        if (self->rmode == EVSRV_RBUF_LAZY) {
+            _evsrv_conn_rbuf_detach(self);
+        } else if (self->rlen > _evsrv_conn_rbuf_want(self)) {
+            _evsrv_conn_rbuf_resize(self, _evsrv_conn_rbuf_want(self)); // shrink back
+        }
+    }
+    return 0;
+}
+
+void _evsrv_conn_read_cb(struct ev_loop* loop, ev_io* w, int revents) {
+    if (EV_ERROR & revents) {
+        cerror("error occured");
+        return;
+    }
+
+    evsrv_conn* self = SELFby(w, evsrv_conn, rw);
+
+    if (unlikely(self->zhead != NULL)) {
+        _evsrv_conn_zc_complete(self); // completions wake the socket up as errors
+    }
+
+    evsrv_conn_read_timer_stop(self);
+
+    if (unlikely(_evsrv_conn_rbuf_ensure(self) < 0)) {
+        return;
+    }
+
+    size_t total = 0;
+    size_t room;
+    ssize_t nread;
+    again:
+    room = self->rlen - self->ruse;
+    nread = read(w->fd, self->rbuf + self->ruse, room);
+    if (nread > 0) {
+        if (_evsrv_conn_on_data(self, nread) < 0) {
+            return;
+        }
+        // a read that filled the buffer likely left more in the socket, draining it saves a poll per read
+        total += nread;
+        if ((size_t) nread == room && total < self->srv->read_budget &&
+            self->state == EVSRV_CONN_ACTIVE && !self->rpaused) {
+            if (unlikely(_evsrv_conn_rbuf_ensure(self) < 0)) {
+                return;
+            }
+            goto again;
+        }
+    } else if (nread < 0) {
+        switch (errno) {
+            case EAGAIN:
+                if (self->rmode == EVSRV_RBUF_LAZY && self->ruse == 0) {
+                    _evsrv_conn_rbuf_detach(self);
+                }
+                return;
+            case EINTR:
+                goto again;
+            default:
+                cerror("read error");
+                evsrv_conn_close(self, errno);
+                return;
+        }
+    } else {
+        // cerror("read EOF");
+        if (_evsrv_conn_eof(self) < 0) {
+            return;
+        }
+        evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
+        evsrv_conn_close(self, errno);
+    }
+}
+
+void _evsrv_conn_read_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents) {
+    if (EV_ERROR & revents) {
+        cerror("error occured");
+        return;
+    }
+    evsrv* srv = SELFby(w, evsrv, rtimeouts.w);
+
+    struct evsrv_tnode* node;
+    while ((node = _evsrv_tlist_expired(loop, &srv->rtimeouts)) != NULL) {
+        evsrv_conn* self = SELFby(node, evsrv_conn, rto);
+        cwarn("read timer triggered");
+        evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
+        evsrv_conn_close(self, errno);
+    }
+}
+
+// returns 0 when the queue is drained, 1 when data is left and -1 when connection is closed
+int _evsrv_conn_wqueue_flush(evsrv_conn* self) {
+    struct iovec iov[IOV_MAX];
+
+    again: {
+        size_t total = 0;
+        ssize_t wr;
+        struct evsrv_wchunk* head = self->whead;
+        if (head->type == EVSRV_WCHUNK_FILE) {
+            off_t offset = head->offset + (off_t) head->head;
+            total = head->len - head->head;
+            wr = sendfile(self->ww.fd, head->fd, &offset, total);
+            if (unlikely(wr == 0)) {
+                cerror("file %d ended before the range queued for sending", head->fd);
+                evsrv_conn_close(self, EIO);
+                return -1;
+            }
+            if (unlikely(wr < 0 && errno == EINVAL)) {
+                cerror("file %d can not be sent with sendfile", head->fd);
+                evsrv_conn_close(self, EINVAL);
+                return -1;
+            }
+#if EVSRV_USE_ZEROCOPY
+        } else if (head->zerocopy && self->zcopy) {
+            iov[0].iov_base = head->data + head->head;
+            iov[0].iov_len = total = head->len - head->head;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = 1;
+            wr = sendmsg(self->ww.fd, &msg, MSG_ZEROCOPY);
+            if (wr > -1) {
+                head->zpending = true;
+                head->zseq = self->zseq++;
+            } else if (errno == ENOBUFS) {
+                wr = sendmsg(self->ww.fd, &msg, 0); // out of optmem for pinning pages, copy this time
+            }
+#endif
+        } else {
+            // buffered chunks up to the next file or zero-copy chunk go with a single writev
+            int iovcnt = 0;
+            for (struct evsrv_wchunk* chunk = head; chunk != NULL && chunk->type != EVSRV_WCHUNK_FILE &&
+                                                    !(chunk->zerocopy && self->zcopy) &&
+                                                    iovcnt < IOV_MAX; chunk = chunk->next) {
+                iov[iovcnt].iov_base = chunk->data + chunk->head;
+                iov[iovcnt].iov_len = chunk->len - chunk->head;
+                total += iov[iovcnt].iov_len;
+                ++iovcnt;
+            }
+            wr = writev(self->ww.fd, iov, iovcnt);
+        }
+
+        if (wr > -1) {
+            _evsrv_conn_wqueue_consume(self, (size_t) wr);
+            if (self->whead == NULL) {
+                return 0;
+            }
+            if ((size_t) wr == total) {
+                goto again; // more than IOV_MAX chunks or a file chunk follows
+            }
+            return 1; // written partially
+        }
+        else {
+            switch(errno) {
+                case EINTR:
+                    goto again;
+                case EAGAIN:
+                    return 1;
+                case EINVAL:
+                    // einval may be a result only of corruption. dump a core is better than hangover
+                    abort();
+                default:
+                    cerror("connection failed while write [io]");
+                    evsrv_conn_close(self, errno);
+                    return -1;
+            }
+        }
+    }
+}
+
+void evsrv_conn_flush(evsrv_conn* self) {
+    _evsrv_conn_unschedule_flush(self);
+    if (self->srv->uring) {
+        _evsrv_conn_uring_send(self);
+        return;
+    }
+    if (self->whead == NULL || ev_is_active(&self->ww)) {
+        return; // nothing to write or waiting for the socket to become writable
+    }
+    switch (_evsrv_conn_wqueue_flush(self)) {
+        case 1:
+            ev_io_start(self->srv->loop, &self->ww);
+            _evsrv_conn_write_timer_again(self);
+            // fallthrough
+        case 0:
+            _evsrv_conn_wqueue_shrunk(self);
+            break;
+        default:
+            break;
+    }
+}
+
+void _evsrv_conn_write_cb(struct ev_loop* loop, ev_io* w, int revents) {
+    if (EV_ERROR & revents) {
+        cerror("error occured");
+        return;
+    }
+    evsrv_conn* self = SELFby(w, evsrv_conn, ww);
+
+    if (unlikely(self->zhead != NULL)) {
+        _evsrv_conn_zc_complete(self);
+    }
+
+    _evsrv_conn_write_timer_stop(self);
+
+    switch (_evsrv_conn_wqueue_flush(self)) {
+        case 0:
+            ev_io_stop(loop, w);
+            _evsrv_conn_wqueue_shrunk(self);
+            break;
+        case 1:
+            _evsrv_conn_write_timer_again(self);
+            _evsrv_conn_wqueue_shrunk(self);
+            break;
+        default:
+            break;
+    }
 }
 
 void _evsrv_conn_write_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents) {
@@ -358,10 +1467,285 @@ void _evsrv_conn_write_timeout_cb(struct ev_loop* loop, ev_timer* w, int revents
         cerror("error occured");
         return;
     }
-    evsrv_conn* self = SELFby(w, evsrv_conn, tww);
+    evsrv* srv = SELFby(w, evsrv, wtimeouts.w);
+
+    struct evsrv_tnode* node;
+    while ((node = _evsrv_tlist_expired(loop, &srv->wtimeouts)) != NULL) {
+        evsrv_conn* self = SELFby(node, evsrv_conn, wto);
+        cwarn("write timer triggered");
+        evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
+        evsrv_conn_close(self, errno);
+    }
+}
+
+void _evsrv_conn_read_pause(evsrv_conn* self) {
+    if (self->srv->uring) {
+        if (self->urecv) {
+            _evsrv_conn_uring_cancel(self, EVSRV_URING_RECV);
+        }
+        return;
+    }
+    evsrv_stop_io(self->srv->loop, &self->rw);
+}
+
+void _evsrv_conn_read_resume(evsrv_conn* self) {
+    if (self->srv->uring) {
+        if (self->uheld) {
+            evsrv_conn_defer(self); // the held data goes first, receiving resumes after it
+        } else if (!self->urecv) {
+            _evsrv_conn_uring_recv(self);
+        }
+        return;
+    }
+    ev_io_start(self->srv->loop, &self->rw);
+}
+
+/*************************** io_uring engine ***************************/
+
+#if EVSRV_USE_URING
+
+void _evsrv_conn_uring_recv(evsrv_conn* self) {
+    evsrv_uring* ring = self->srv->uring;
+    struct io_uring_sqe* sqe = evsrv_uring_get_sqe(ring);
+    if (unlikely(sqe == NULL)) {
+        cerror("Could not queue receive of %d", self->info->sock);
+        evsrv_conn_close(self, ENOMEM);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = self->info->sock;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = ring->bgid;
+    sqe->user_data = evsrv_uring_data(EVSRV_URING_RECV, self->info->sock, self->ugen);
+    self->urecv = true;
+}
+
+void _evsrv_conn_uring_cancel(evsrv_conn* self, int op) {
+    struct io_uring_sqe* sqe = evsrv_uring_get_sqe(self->srv->uring);
+    if (unlikely(sqe == NULL)) {
+        cerror("Could not queue cancel of %d", self->info->sock);
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = evsrv_uring_data(op, self->info->sock, self->ugen);
+    sqe->user_data = evsrv_uring_data(EVSRV_URING_CANCEL, self->info->sock, self->ugen);
+}
+
+// sends the queue with a chain of linked sends, the next chain goes once this one completes
+void _evsrv_conn_uring_send(evsrv_conn* self) {
+    if (self->usends > 0 || self->whead == NULL || ev_is_active(&self->ww)) {
+        return;
+    }
+    if (self->whead->type == EVSRV_WCHUNK_FILE) {
+        // there is no sendfile in io_uring, file chunks are left to the readiness path
+        ev_io_start(self->srv->loop, &self->ww);
+        _evsrv_conn_write_timer_again(self);
+        return;
+    }
+
+    evsrv_uring* ring = self->srv->uring;
+    struct io_uring_sqe* prev = NULL;
+    for (struct evsrv_wchunk* chunk = self->whead; chunk != NULL && chunk->type != EVSRV_WCHUNK_FILE &&
+                                                   self->usends < EVSRV_URING_SEND_LINK; chunk = chunk->next) {
+        if (prev != NULL && evsrv_uring_sq_space(ring) == 0) {
+            break; // a chain must not be split between submissions
+        }
+        struct io_uring_sqe* sqe = evsrv_uring_get_sqe(ring);
+        if (unlikely(sqe == NULL)) {
+            break;
+        }
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = self->info->sock;
+        sqe->addr = (uint64_t) (uintptr_t) (chunk->data + chunk->head);
+        sqe->len = (uint32_t) (chunk->len - chunk->head);
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL; // partial sends are retried by the kernel
+        sqe->user_data = evsrv_uring_data(EVSRV_URING_SEND, self->info->sock, self->ugen);
+        if (prev != NULL) {
+            prev->flags |= IOSQE_IO_LINK;
+        }
+        prev = sqe;
+        ++self->usends;
+    }
+
+    if (self->usends > 0) {
+        _evsrv_conn_write_timer_again(self);
+    }
+}
+
+static void _evsrv_conn_uring_recv_complete(evsrv_conn* self, const struct io_uring_cqe* cqe) {
+    evsrv_uring* ring = self->srv->uring;
+    bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        self->urecv = false;
+    }
+
+    if (cqe->res > 0) {
+        uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        const char* data = evsrv_uring_buf(ring, bid);
+        size_t left = (size_t) cqe->res;
+
+        evsrv_conn_read_timer_stop(self);
+        int rc = 0;
+        while (left > 0 && rc == 0) {
+            rc = _evsrv_conn_rbuf_ensure(self);
+            if (rc == 0) {
+                size_t n = self->rlen - self->ruse < left ? self->rlen - self->ruse : left;
+                memcpy(self->rbuf + self->ruse, data, n);
+                data += n;
+                left -= n;
+                if (unlikely(self->rpaused)) {
+                    // received before the cancel took effect, held until reading resumes
+                    self->ruse += n;
+                    self->uheld = true;
+                    rc = _evsrv_conn_rbuf_settle(self);
+                } else {
+                    rc = _evsrv_conn_on_data(self, (ssize_t) n);
+                }
+            }
+        }
+        evsrv_uring_buf_recycle(ring, bid);
+        if (rc < 0) {
+            return;
+        }
+        if (!more && !self->rpaused && self->state == EVSRV_CONN_ACTIVE) {
+            _evsrv_conn_uring_recv(self);
+        }
+        return;
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        evsrv_uring_buf_recycle(ring, (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+
+    if (cqe->res == 0) {
+        if (_evsrv_conn_eof(self) < 0) {
+            return;
+        }
+        evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
+        evsrv_conn_close(self, 0);
+        return;
+    }
+
+    switch (-cqe->res) {
+        case ENOBUFS:   // all the provided buffers are taken, they are back by now
+        case ECANCELED: // paused because of write queue
+        case EINTR:
+            if (!more && !self->rpaused && self->state == EVSRV_CONN_ACTIVE) {
+                _evsrv_conn_uring_recv(self);
+            }
+            break;
+        default:
+            errno = -cqe->res;
+            cerror("read error");
+            evsrv_conn_close(self, errno);
+            break;
+    }
+}
+
+static void _evsrv_conn_uring_send_complete(evsrv_conn* self, const struct io_uring_cqe* cqe) {
+    --self->usends;
+    if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        errno = -cqe->res;
+        cerror("connection failed while write [uring]");
+        evsrv_conn_close(self, errno);
+        return;
+    }
+
+    // a short send breaks the chain, the rest of it comes back cancelled and is sent again by the next one
+    if (cqe->res > 0) {
+        _evsrv_conn_wqueue_consume(self, (size_t) cqe->res);
+    }
+    if (self->usends > 0) {
+        return;
+    }
+    _evsrv_conn_write_timer_stop(self);
+    _evsrv_conn_uring_send(self);
+    _evsrv_conn_wqueue_shrunk(self);
+}
+
+// a closed connection's chunks of the sends in flight are kept until their completions, the sends are
+// cancelled and the socket is shut down so nothing of them reaches the peer after all
+void _evsrv_conn_uring_orphan(evsrv_conn* self) {
+    evsrv* srv = self->srv;
+    if (self->info->sock > -1) {
+        _evsrv_conn_uring_cancel(self, EVSRV_URING_SEND);
+        shutdown(self->info->sock, SHUT_RDWR);
+    }
+    struct evsrv_orphan* orphan = (struct evsrv_orphan*) malloc(sizeof(*orphan));
+    if (unlikely(orphan == NULL)) {
+        cerror("Failed to allocate an orphan, leaking chunks of the sends of socket %d", self->info->sock);
+        for (unsigned i = 0; i < self->usends && self->whead != NULL; ++i) {
+            self->whead = self->whead->next;
+        }
+        if (self->whead == NULL) {
+            self->wtail = NULL;
+        }
+        self->usends = 0;
+        return;
+    }
+    orphan->sock = -1; // the ring holds its own reference to the socket
+    orphan->deadline = 0;
+    orphan->ugen = self->ugen;
+    orphan->usends = self->usends;
+    orphan->head = self->whead;
+    orphan->tail = NULL;
+    for (unsigned i = 0; i < self->usends && self->whead != NULL; ++i) {
+        orphan->tail = self->whead;
+        self->whead = self->whead->next;
+    }
+    orphan->tail->next = NULL;
+    if (self->whead == NULL) {
+        self->wtail = NULL;
+    }
+    self->usends = 0;
+
+    orphan->next = srv->uring_orphans;
+    srv->uring_orphans = orphan;
+}
+
+// releases the chunks of an orphan once the last of its sends completes
+static void _evsrv_conn_uring_orphan_complete(evsrv* srv, uint32_t gen) {
+    for (struct evsrv_orphan** o = &srv->uring_orphans; *o != NULL; o = &(*o)->next) {
+        struct evsrv_orphan* orphan = *o;
+        if (orphan->ugen != gen) {
+            continue;
+        }
+        if (--orphan->usends == 0) {
+            *o = orphan->next;
+            _evsrv_conn_orphan_free(srv, orphan);
+        }
+        return;
+    }
+}
+
+void evsrv_conn_uring_complete(evsrv* srv, const struct io_uring_cqe* cqe) {
+    int op = evsrv_uring_data_op(cqe->user_data);
+    evsrv_conn* self = evsrv_get_conn(srv, evsrv_uring_data_fd(cqe->user_data));
+
+    if (self == NULL || self->ugen != evsrv_uring_data_gen(cqe->user_data)) {
+        // completion of a connection closed meanwhile
+        if (op == EVSRV_URING_RECV && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            evsrv_uring_buf_recycle(srv->uring, (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+        } else if (op == EVSRV_URING_SEND) {
+            _evsrv_conn_uring_orphan_complete(srv, evsrv_uring_data_gen(cqe->user_data));
+        }
+        return;
+    }
+
+    if (op == EVSRV_URING_RECV) {
+        _evsrv_conn_uring_recv_complete(self, cqe);
+    } else {
+        _evsrv_conn_uring_send_complete(self, cqe);
+    }
+}
+
+#else
+
+void _evsrv_conn_uring_recv(evsrv_conn* self) {}
+void _evsrv_conn_uring_cancel(evsrv_conn* self, int op) {}
+void _evsrv_conn_uring_send(evsrv_conn* self) {}
+void _evsrv_conn_uring_orphan(evsrv_conn* self) {}
+void evsrv_conn_uring_complete(evsrv* srv, const struct io_uring_cqe* cqe) {}
 
-    ev_timer_stop(loop, &self->tww);
-    cwarn("write timer triggered");
-    evsrv_conn_shutdown(self, EVSRV_SHUT_RDWR);
-    evsrv_conn_close(self, errno);
-}
\ No newline at end of file
+#endif // EVSRV_USE_URING
@@ -0,0 +1,189 @@
+#include "evsrv_frame.h"
+#include "evsrv_conn.h"
+#include "evsrv.h"
+#include "evsrv_scan.h"
+
+#define EVSRV_FRAME_SCAN_BATCH 64 // delimiters found per scan
+
+static void _evsrv_frame_too_long(evsrv_conn* conn, size_t len);
+
+/*************************** evsrv_framing ***************************/
+
+void evsrv_framing_init(struct evsrv_framing* self) {
+    self->mode = EVSRV_FRAME_NONE;
+    self->size = 0;
+    self->big_endian = true;
+    self->delim_len = 0;
+    self->max_len = 0;
+    self->max_frames = 0;
+    self->scanned = 0;
+    self->on_frame = NULL;
+}
+
+int evsrv_framing_set_fixed(struct evsrv_framing* self, size_t size, evsrv_on_frame_cb on_frame) {
+    if (size == 0) {
+        errno = EINVAL;
+        cerror("Frame size must not be 0");
+        return -1;
+    }
+    self->mode = EVSRV_FRAME_FIXED;
+    self->size = size;
+    self->on_frame = on_frame;
+    return 0;
+}
+
+int evsrv_framing_set_prefix(struct evsrv_framing* self, size_t size, bool big_endian, evsrv_on_frame_cb on_frame) {
+    if (size != 1 && size != 2 && size != 4 && size != 8) {
+        errno = EINVAL;
+        cerror("Length prefix of %zu bytes is not supported", size);
+        return -1;
+    }
+    self->mode = EVSRV_FRAME_PREFIX;
+    self->size = size;
+    self->big_endian = big_endian;
+    self->on_frame = on_frame;
+    return 0;
+}
+
+int evsrv_framing_set_delim(struct evsrv_framing* self, const char* delim, size_t delim_len, evsrv_on_frame_cb on_frame) {
+    if (delim_len == 0 || delim_len > EVSRV_FRAME_DELIM_MAX) {
+        errno = EINVAL;
+        cerror("Delimiter of %zu bytes is not supported", delim_len);
+        return -1;
+    }
+    self->mode = EVSRV_FRAME_DELIM;
+    memcpy(self->delim, delim, delim_len);
+    self->delim_len = delim_len;
+    self->scanned = 0;
+    self->on_frame = on_frame;
+    return 0;
+}
+
+static inline uint64_t _evsrv_frame_prefix(const unsigned char* p, size_t size, bool big_endian) {
+    uint64_t len = 0;
+    if (big_endian) {
+        for (size_t i = 0; i < size; ++i) {
+            len = (len << 8) | p[i];
+        }
+    } else {
+        for (size_t i = size; i > 0; --i) {
+            len = (len << 8) | p[i - 1];
+        }
+    }
+    return len;
+}
+
+// without an explicit limit a frame has to fit the largest buffer the connection may get
+static inline size_t _evsrv_frame_limit(evsrv_conn* conn) {
+    if (conn->framing.max_len > 0) {
+        return conn->framing.max_len;
+    }
+    return conn->rmode != EVSRV_RBUF_USER && conn->srv->rbuf_max > conn->rlen ? conn->srv->rbuf_max : conn->rlen;
+}
+
+void _evsrv_frame_too_long(evsrv_conn* conn, size_t len) {
+    cwarn("Frame of %zu bytes exceeds the limit of %zu, closing connection %d",
+          len, _evsrv_frame_limit(conn), conn->info->sock);
+    evsrv_conn_shutdown(conn, EVSRV_SHUT_RDWR);
+    evsrv_conn_close(conn, EMSGSIZE);
+}
+
+// hands every complete frame of rbuf to on_frame, then moves the incomplete rest to the buffer start
+void evsrv_frame_process(evsrv_conn* conn) {
+    evsrv* srv = conn->srv;
+    struct evsrv_framing* self = &conn->framing;
+    char* buf = conn->rbuf;
+    size_t end = conn->ruse;
+    size_t off = 0;
+    size_t frames = 0;
+
+    // DELIM: delimiters are found for many frames in one pass, those before scan_to are all in pos
+    uint32_t pos[EVSRV_FRAME_SCAN_BATCH];
+    size_t npos = 0;
+    size_t ipos = 0;
+    size_t scan_to = 0;
+
+    while (conn->dto.deadline == 0) {
+        size_t avail = end - off;
+        size_t head = 0;                // bytes before the frame
+        size_t len;
+        size_t tail = 0;                // bytes after the frame
+
+        switch (self->mode) {
+            case EVSRV_FRAME_FIXED:
+                len = self->size;
+                break;
+            case EVSRV_FRAME_PREFIX: {
+                if (avail < self->size) {
+                    goto incomplete;
+                }
+                uint64_t plen = _evsrv_frame_prefix((const unsigned char*) buf + off, self->size, self->big_endian);
+                size_t limit = _evsrv_frame_limit(conn);
+                if (unlikely(limit < self->size || plen > limit - self->size)) { // the prefix has to fit too
+                    _evsrv_frame_too_long(conn, self->size + (size_t) plen);
+                    return;
+                }
+                head = self->size;
+                len = (size_t) plen;
+                break;
+            }
+            case EVSRV_FRAME_DELIM: {
+                while (ipos < npos && pos[ipos] < off) {
+                    ++ipos; // overlaps the delimiter of the previous frame
+                }
+                if (ipos == npos) {
+                    size_t from = off + self->scanned > scan_to ? off + self->scanned : scan_to;
+                    npos = evsrv_scan(buf, from, end, self->delim, self->delim_len, pos, EVSRV_FRAME_SCAN_BATCH);
+                    ipos = 0;
+                    scan_to = npos == EVSRV_FRAME_SCAN_BATCH ? pos[npos - 1] + 1 : end;
+                }
+                if (ipos == npos) {
+                    // the delimiter may start in the last delim_len - 1 bytes, they are searched again
+                    self->scanned = avail >= self->delim_len ? avail - self->delim_len + 1 : 0;
+                    if (unlikely(self->scanned > _evsrv_frame_limit(conn))) {
+                        _evsrv_frame_too_long(conn, avail);
+                        return;
+                    }
+                    goto incomplete;
+                }
+                self->scanned = 0;
+                len = pos[ipos++] - off;
+                tail = self->delim_len;
+                if (unlikely(len > _evsrv_frame_limit(conn))) {
+                    _evsrv_frame_too_long(conn, len);
+                    return;
+                }
+                break;
+            }
+            default:
+                return;
+        }
+        if (avail < head + len + tail) {
+            goto incomplete;
+        }
+
+        if (self->max_frames > 0 && frames == self->max_frames) {
+            evsrv_conn_defer(conn); // the complete frames left wait for the other connections
+            break;
+        }
+        char* frame = buf + off + head;
+        off += head + len + tail;
+        ++frames;
+
+        struct evsrv_conn_watch watch;
+        evsrv_conn_watch(conn, &watch);
+        self->on_frame(conn, frame, len);
+        if (evsrv_conn_unwatch(srv, &watch)) {
+            return; // closed by on_frame, the connection may be gone
+        }
+    }
+    incomplete:
+
+    if (off > 0) {
+        size_t left = conn->ruse - off;
+        if (left > 0) {
+            memmove(buf, buf + off, left);
+        }
+        conn->ruse = left;
+    }
+}
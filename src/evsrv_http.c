@@ -0,0 +1,619 @@
+#include "evsrv_http.h"
+#include "evsrv_scan.h"
+#include "evsrv.h"
+
+#include <string.h>
+
+static void _evsrv_http_on_read(evsrv_conn* conn, ssize_t nread);
+
+#define _EVSRV_HTTP_SCAN_BATCH 32
+#define _EVSRV_HTTP_MAX_CHUNK_LINE 1024 // chunk size with extensions
+
+/*************************** evsrv_http_conn ***************************/
+
+// minor stays until the next request line, a suspended request is still answered with it
+static inline void _evsrv_http_reset(evsrv_http_conn* self) {
+    self->state = EVSRV_HTTP_HEAD;
+    self->scanned = 0;
+    self->head_len = 0;
+    self->body_len = 0;
+    self->raw = 0;
+    self->chunk_left = 0;
+    self->since = 0;
+    self->sized = false;
+    self->chunked = false;
+    self->keep_alive = false;
+    self->expect = false;
+    self->method.len = 0;
+    self->nheaders = 0;
+}
+
+void evsrv_http_conn_init(evsrv_http_conn* self, evsrv* srv, struct evsrv_conn_info* info,
+                          evsrv_http_on_request_cb on_request) {
+    evsrv_conn_init(&self->conn, srv, info);
+    self->conn.on_read = _evsrv_http_on_read;
+    self->conn.on_drain = srv->on_drain;
+    self->conn.wcork = srv->wcork;
+    evsrv_conn_set_rbuf_mode(&self->conn, srv->rbuf_mode);
+
+    _evsrv_http_reset(self);
+    self->minor = 1;
+    self->head_only = false;
+    self->closing = false;
+    self->suspended = false;
+
+    self->max_head = EVSRV_HTTP_MAX_HEAD;
+    self->max_body = 0;
+    self->max_requests = 0;
+    self->on_request = on_request;
+}
+
+void evsrv_http_conn_destroy(evsrv_http_conn* self) {
+    evsrv_conn_destroy(&self->conn);
+}
+
+const struct evsrv_http_str* evsrv_http_header(const struct evsrv_http_request* req, const char* name) {
+    size_t len = strlen(name);
+    for (size_t i = 0; i < req->nheaders; ++i) {
+        const struct evsrv_http_str* h = &req->headers[i].name;
+        if (h->len == len && strncasecmp(h->ptr, name, len) == 0) {
+            return &req->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+// without an explicit limit a body has to fit the largest buffer the connection may get
+static inline size_t _evsrv_http_body_limit(evsrv_http_conn* self) {
+    if (self->max_body > 0) {
+        return self->max_body;
+    }
+    evsrv_conn* conn = &self->conn;
+    return conn->rmode != EVSRV_RBUF_USER && conn->srv->rbuf_max > conn->rlen ? conn->srv->rbuf_max : conn->rlen;
+}
+
+// answers the request being parsed with an error, the connection ends after it
+static int _evsrv_http_fail(evsrv_http_conn* self, int status) {
+    self->head_only = false;
+    self->closing = true;
+    evsrv_http_respond(self, status, NULL, NULL, 0);
+    return -1;
+}
+
+// connections ending after the last response keep reading until the peer's EOF
+static void _evsrv_http_finish(evsrv_http_conn* self) {
+    if (self->closing) {
+        self->conn.ruse = 0;
+        evsrv_conn_end(&self->conn);
+    }
+}
+
+/*************************** parser ***************************/
+
+static inline bool _evsrv_http_token_is(const char* p, size_t len, const char* lit, size_t lit_len) {
+    return len == lit_len && strncasecmp(p, lit, lit_len) == 0;
+}
+
+// "<method> <target> HTTP/1.<minor>"
+static int _evsrv_http_request_line(evsrv_http_conn* self, const char* req, size_t from, size_t end) {
+    const char* line = req + from;
+    size_t len = end - from;
+    const char* sp1 = (const char*) memchr(line, ' ', len);
+    if (sp1 == NULL || sp1 == line) {
+        return _evsrv_http_fail(self, 400);
+    }
+    const char* rest = sp1 + 1;
+    const char* sp2 = (const char*) memchr(rest, ' ', (size_t) (line + len - rest));
+    if (sp2 == NULL || sp2 == rest) {
+        return _evsrv_http_fail(self, 400);
+    }
+    const char* version = sp2 + 1;
+    size_t version_len = (size_t) (line + len - version);
+    if (version_len != 8 || memcmp(version, "HTTP/", 5) != 0 || version[6] != '.' ||
+        version[5] < '0' || version[5] > '9' || version[7] < '0' || version[7] > '9') {
+        return _evsrv_http_fail(self, 400);
+    }
+    if (version[5] != '1') {
+        return _evsrv_http_fail(self, 505);
+    }
+
+    self->method.off = (uint32_t) from;
+    self->method.len = (uint32_t) (sp1 - line);
+    self->target.off = (uint32_t) (rest - req);
+    self->target.len = (uint32_t) (sp2 - rest);
+    self->minor = version[7] == '0' ? 0 : 1;
+    self->keep_alive = self->minor > 0;
+    return 0;
+}
+
+// "<name>:<OWS><value><OWS>", the headers the parser itself relies on are interpreted right away
+static int _evsrv_http_header_line(evsrv_http_conn* self, const char* req, size_t from, size_t end) {
+    if (req[from] == ' ' || req[from] == '\t') {
+        return _evsrv_http_fail(self, 400); // obsolete line folding
+    }
+    const char* colon = (const char*) memchr(req + from, ':', end - from);
+    if (colon == NULL || colon == req + from || colon[-1] == ' ' || colon[-1] == '\t') {
+        return _evsrv_http_fail(self, 400);
+    }
+    if (self->nheaders == EVSRV_HTTP_MAX_HEADERS) {
+        return _evsrv_http_fail(self, 431);
+    }
+    size_t name_len = (size_t) (colon - req) - from;
+    size_t v = (size_t) (colon - req) + 1;
+    size_t v_end = end;
+    while (v < v_end && (req[v] == ' ' || req[v] == '\t')) {
+        ++v;
+    }
+    while (v_end > v && (req[v_end - 1] == ' ' || req[v_end - 1] == '\t')) {
+        --v_end;
+    }
+    self->names[self->nheaders].off = (uint32_t) from;
+    self->names[self->nheaders].len = (uint32_t) name_len;
+    self->values[self->nheaders].off = (uint32_t) v;
+    self->values[self->nheaders].len = (uint32_t) (v_end - v);
+    ++self->nheaders;
+
+    const char* name = req + from;
+    const char* value = req + v;
+    size_t value_len = v_end - v;
+    if (_evsrv_http_token_is(name, name_len, "Content-Length", 14)) {
+        if (value_len == 0 || value_len > 18) {
+            return _evsrv_http_fail(self, 400);
+        }
+        size_t length = 0;
+        for (size_t i = 0; i < value_len; ++i) {
+            if (value[i] < '0' || value[i] > '9') {
+                return _evsrv_http_fail(self, 400);
+            }
+            length = length * 10 + (size_t) (value[i] - '0');
+        }
+        if (self->sized && self->body_len != length) {
+            return _evsrv_http_fail(self, 400);
+        }
+        self->sized = true;
+        self->body_len = length;
+    } else if (_evsrv_http_token_is(name, name_len, "Transfer-Encoding", 17)) {
+        if (self->chunked || !_evsrv_http_token_is(value, value_len, "chunked", 7)) {
+            return _evsrv_http_fail(self, 501); // chunked is the only coding understood
+        }
+        self->chunked = true;
+    } else if (_evsrv_http_token_is(name, name_len, "Connection", 10)) {
+        for (size_t i = 0; i < value_len;) {
+            while (i < value_len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) {
+                ++i;
+            }
+            size_t token = i;
+            while (i < value_len && value[i] != ',' && value[i] != ' ' && value[i] != '\t') {
+                ++i;
+            }
+            if (_evsrv_http_token_is(value + token, i - token, "close", 5)) {
+                self->keep_alive = false;
+            } else if (_evsrv_http_token_is(value + token, i - token, "keep-alive", 10) && self->minor == 0) {
+                self->keep_alive = true;
+            }
+        }
+    } else if (_evsrv_http_token_is(name, name_len, "Expect", 6)) {
+        if (!_evsrv_http_token_is(value, value_len, "100-continue", 12)) {
+            return _evsrv_http_fail(self, 417);
+        }
+        self->expect = self->minor > 0;
+    }
+    return 0;
+}
+
+// the head is parsed line by line as soon as line ends are found, a line is searched again only
+// when it arrives in parts
+static int _evsrv_http_parse_head(evsrv_http_conn* self, const char* req, size_t avail) {
+    uint32_t ends[_EVSRV_HTTP_SCAN_BATCH];
+    size_t found;
+    do {
+        found = evsrv_scan(req, self->scanned, avail, "\n", 1, ends, _EVSRV_HTTP_SCAN_BATCH);
+        for (size_t i = 0; i < found; ++i) {
+            size_t from = self->scanned;
+            size_t end = ends[i];
+            self->scanned = end + 1;
+            if (self->scanned > self->max_head) {
+                return _evsrv_http_fail(self, self->method.len == 0 ? 414 : 431);
+            }
+            if (end > from && req[end - 1] == '\r') {
+                --end;
+            }
+
+            int rc;
+            if (self->method.len == 0) {
+                rc = _evsrv_http_request_line(self, req, from, end);
+            } else if (end == from) {
+                self->head_len = self->scanned;
+                return 1;
+            } else {
+                rc = _evsrv_http_header_line(self, req, from, end);
+            }
+            if (rc < 0) {
+                return rc;
+            }
+        }
+    } while (found == _EVSRV_HTTP_SCAN_BATCH);
+
+    if (avail > self->max_head) {
+        return _evsrv_http_fail(self, self->method.len == 0 ? 414 : 431);
+    }
+    return 0;
+}
+
+static inline int _evsrv_http_hex(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char) (c | 0x20);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// decodes chunks in place right after the head, raw runs ahead of the decoded body
+static int _evsrv_http_parse_chunked(evsrv_http_conn* self, char* req, size_t avail) {
+    for (;;) {
+        switch (self->state) {
+            case EVSRV_HTTP_CHUNK_SIZE: {
+                const char* nl = (const char*) memchr(req + self->raw, '\n', avail - self->raw);
+                if (nl == NULL) {
+                    return avail - self->raw > _EVSRV_HTTP_MAX_CHUNK_LINE ? _evsrv_http_fail(self, 400) : 0;
+                }
+                const char* p = req + self->raw;
+                uint64_t size = 0;
+                int digit;
+                size_t digits = 0;
+                for (; p < nl && (digit = _evsrv_http_hex(*p)) >= 0; ++p) {
+                    if (++digits > 15) {
+                        return _evsrv_http_fail(self, 413);
+                    }
+                    size = size * 16 + (uint64_t) digit;
+                }
+                if (digits == 0 || (p < nl && *p != ';' && *p != '\r' && *p != ' ' && *p != '\t')) {
+                    return _evsrv_http_fail(self, 400);
+                }
+                self->raw = (size_t) (nl - req) + 1;
+                if (size == 0) {
+                    self->state = EVSRV_HTTP_TRAILERS;
+                    break;
+                }
+                if (self->body_len + size > _evsrv_http_body_limit(self)) {
+                    return _evsrv_http_fail(self, 413);
+                }
+                self->chunk_left = size;
+                self->state = EVSRV_HTTP_CHUNK_DATA;
+                break;
+            }
+            case EVSRV_HTTP_CHUNK_DATA: {
+                size_t n = avail - self->raw;
+                if (n > self->chunk_left) {
+                    n = (size_t) self->chunk_left;
+                }
+                size_t to = self->head_len + self->body_len;
+                if (to != self->raw) {
+                    memmove(req + to, req + self->raw, n);
+                }
+                self->body_len += n;
+                self->raw += n;
+                self->chunk_left -= n;
+                if (self->chunk_left > 0) {
+                    return 0;
+                }
+                self->state = EVSRV_HTTP_CHUNK_END;
+                break;
+            }
+            case EVSRV_HTTP_CHUNK_END:
+                if (self->raw == avail || (req[self->raw] == '\r' && self->raw + 1 == avail)) {
+                    return 0;
+                }
+                if (req[self->raw] == '\r') {
+                    ++self->raw;
+                }
+                if (req[self->raw] != '\n') {
+                    return _evsrv_http_fail(self, 400);
+                }
+                ++self->raw;
+                self->state = EVSRV_HTTP_CHUNK_SIZE;
+                break;
+            case EVSRV_HTTP_TRAILERS: {
+                // trailer fields are skipped
+                const char* nl = (const char*) memchr(req + self->raw, '\n', avail - self->raw);
+                if (nl == NULL) {
+                    return avail - self->raw > self->max_head ? _evsrv_http_fail(self, 431) : 0;
+                }
+                size_t end = (size_t) (nl - req);
+                bool last = end == self->raw || (end == self->raw + 1 && req[self->raw] == '\r');
+                self->raw = end + 1;
+                if (last) {
+                    return 1;
+                }
+                break;
+            }
+            default:
+                return 1;
+        }
+    }
+}
+
+// returns 1 once the request is complete, 0 when more data is needed and -1 once answered with an error
+static int _evsrv_http_parse(evsrv_http_conn* self, char* req, size_t avail) {
+    if (self->state == EVSRV_HTTP_HEAD) {
+        int rc = _evsrv_http_parse_head(self, req, avail);
+        if (rc <= 0) {
+            return rc;
+        }
+        if (self->chunked) {
+            if (self->sized) {
+                return _evsrv_http_fail(self, 400);
+            }
+            self->state = EVSRV_HTTP_CHUNK_SIZE;
+            self->raw = self->head_len;
+            self->body_len = 0;
+        } else {
+            if (self->body_len > _evsrv_http_body_limit(self)) {
+                return _evsrv_http_fail(self, 413);
+            }
+            self->state = EVSRV_HTTP_BODY;
+        }
+        if (self->expect && (self->chunked || self->body_len > 0) && avail == self->head_len) {
+            evsrv_conn_write(&self->conn, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+        }
+    }
+
+    if (self->state == EVSRV_HTTP_BODY) {
+        return avail - self->head_len >= self->body_len ? 1 : 0;
+    }
+    return _evsrv_http_parse_chunked(self, req, avail);
+}
+
+static inline size_t _evsrv_http_consumed(evsrv_http_conn* self) {
+    return self->chunked ? self->raw : self->head_len + self->body_len;
+}
+
+// views of the parsed request into rbuf
+static void _evsrv_http_view(evsrv_http_conn* self, const char* req) {
+    struct evsrv_http_request* r = &self->req;
+    r->method.ptr = req + self->method.off;
+    r->method.len = self->method.len;
+    r->target.ptr = req + self->target.off;
+    r->target.len = self->target.len;
+    r->minor = self->minor;
+    for (size_t i = 0; i < self->nheaders; ++i) {
+        self->headers[i].name.ptr = req + self->names[i].off;
+        self->headers[i].name.len = self->names[i].len;
+        self->headers[i].value.ptr = req + self->values[i].off;
+        self->headers[i].value.len = self->values[i].len;
+    }
+    r->headers = self->headers;
+    r->nheaders = self->nheaders;
+    r->body.ptr = req + self->head_len;
+    r->body.len = self->body_len;
+    r->keep_alive = self->keep_alive;
+
+    self->head_only = _evsrv_http_token_is(r->method.ptr, r->method.len, "HEAD", 4);
+    self->closing = !self->keep_alive;
+}
+
+// a request arriving for longer than read_timeout is answered with 408, a silent client is left to the read timer
+static inline bool _evsrv_http_late(evsrv_http_conn* self) {
+    ev_tstamp timeout = self->conn.srv->read_timeout;
+    return timeout > 0 && self->since > 0 && ev_now(self->conn.srv->loop) - self->since > timeout;
+}
+
+// handles all the complete requests of rbuf, responses are corked until the last of them is answered
+void _evsrv_http_on_read(evsrv_conn* conn, ssize_t nread) {
+    if (nread == 0) {
+        return;
+    }
+    evsrv_http_conn* self = (evsrv_http_conn*) conn;
+    if (self->suspended) {
+        return; // pipelined requests wait for the answer
+    }
+    if (self->closing) {
+        conn->ruse = 0; // the connection is ending
+        return;
+    }
+    evsrv* srv = conn->srv;
+    char* buf = conn->rbuf;
+    size_t start = 0;
+    size_t handled = 0;
+    bool wcork = conn->wcork;
+    conn->wcork = true;
+
+    while (conn->dto.deadline == 0) {
+        if (self->state == EVSRV_HTTP_HEAD && self->scanned == 0) {
+            while (start < conn->ruse && (buf[start] == '\r' || buf[start] == '\n')) {
+                ++start; // empty lines between requests
+            }
+            if (start == conn->ruse) {
+                break;
+            }
+            if (self->max_requests > 0 && handled == self->max_requests) {
+                evsrv_conn_defer(conn);
+                break;
+            }
+        }
+        if (self->since == 0) {
+            self->since = ev_now(srv->loop);
+        }
+
+        int rc = _evsrv_http_parse(self, buf + start, conn->ruse - start);
+        if (rc == 0 && _evsrv_http_late(self)) {
+            rc = _evsrv_http_fail(self, 408);
+        }
+        if (rc == 0) {
+            break;
+        }
+        if (rc < 0) {
+            _evsrv_http_finish(self);
+            break;
+        }
+
+        _evsrv_http_view(self, buf + start);
+        start += _evsrv_http_consumed(self);
+        _evsrv_http_reset(self);
+        ++handled;
+        struct evsrv_conn_watch watch;
+        evsrv_conn_watch(conn, &watch);
+        self->on_request(self, &self->req);
+        if (evsrv_conn_unwatch(srv, &watch)) {
+            return; // closed by on_request, the connection may be gone
+        }
+        if (self->suspended) {
+            break;
+        }
+        if (self->closing) {
+            _evsrv_http_finish(self);
+            break;
+        }
+    }
+
+    conn->wcork = wcork;
+    if (self->closing && !self->suspended) {
+        conn->ruse = 0;
+    } else if (start > 0) {
+        size_t left = conn->ruse - start;
+        if (left > 0) {
+            memmove(buf, buf + start, left);
+        }
+        conn->ruse = left;
+    }
+    if (!conn->rpaused) {
+        evsrv_conn_read_timer_again(conn); // keep-alive
+    }
+    if (!wcork && conn->whead != NULL) {
+        evsrv_conn_flush(conn); // may close the connection
+    }
+}
+
+// stops handling pipelined requests until the current one is answered with evsrv_http_resume
+void evsrv_http_suspend(evsrv_http_conn* self) {
+    self->suspended = true;
+    evsrv_conn_read_pause(&self->conn);
+}
+
+void evsrv_http_resume(evsrv_http_conn* self) {
+    if (!self->suspended) {
+        return;
+    }
+    self->suspended = false;
+    evsrv_conn* conn = &self->conn;
+    evsrv_conn_read_resume(conn);
+    if (self->closing) {
+        _evsrv_http_finish(self);
+    } else if (conn->ruse > 0) {
+        evsrv_conn_defer(conn);
+    }
+}
+
+/*************************** encoder ***************************/
+
+static const char* _evsrv_http_reason(int status) {
+    switch (status) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 411: return "Length Required";
+        case 413: return "Content Too Large";
+        case 414: return "URI Too Long";
+        case 417: return "Expectation Failed";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
+        default: return "Unknown";
+    }
+}
+
+// gathers a response into one write, parts that don't fit are written on their own
+struct _evsrv_http_out {
+    evsrv_conn* conn;
+    size_t len;
+    char buf[EVSRV_HTTP_SMALL_RESPONSE];
+};
+
+static void _evsrv_http_put(struct _evsrv_http_out* out, const void* data, size_t len) {
+    if (out->len + len > sizeof(out->buf)) {
+        if (out->len > 0) {
+            evsrv_conn_write(out->conn, out->buf, out->len);
+            out->len = 0;
+        }
+        if (len >= sizeof(out->buf)) {
+            evsrv_conn_write(out->conn, data, len);
+            return;
+        }
+    }
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+}
+
+static void _evsrv_http_put_u64(struct _evsrv_http_out* out, uint64_t v) {
+    char tmp[20];
+    size_t n = sizeof(tmp);
+    do {
+        tmp[--n] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+    _evsrv_http_put(out, tmp + n, sizeof(tmp) - n);
+}
+
+static void _evsrv_http_write(evsrv_http_conn* self, int status, const char* content_type, const char* headers,
+                              size_t content_length, const void* body, size_t len) {
+    struct _evsrv_http_out out;
+    out.conn = &self->conn;
+    out.len = 0;
+
+    const char* reason = _evsrv_http_reason(status);
+    _evsrv_http_put(&out, "HTTP/1.1 ", 9);
+    _evsrv_http_put_u64(&out, (uint64_t) status);
+    _evsrv_http_put(&out, " ", 1);
+    _evsrv_http_put(&out, reason, strlen(reason));
+    _evsrv_http_put(&out, "\r\n", 2);
+    if (content_type) {
+        _evsrv_http_put(&out, "Content-Type: ", 14);
+        _evsrv_http_put(&out, content_type, strlen(content_type));
+        _evsrv_http_put(&out, "\r\n", 2);
+    }
+    if (headers) {
+        _evsrv_http_put(&out, headers, strlen(headers));
+    }
+    if (status != 204 && status != 304) {
+        _evsrv_http_put(&out, "Content-Length: ", 16);
+        _evsrv_http_put_u64(&out, content_length);
+        _evsrv_http_put(&out, "\r\n", 2);
+    }
+    if (self->closing) {
+        _evsrv_http_put(&out, "Connection: close\r\n", 19);
+    } else if (self->minor == 0) {
+        _evsrv_http_put(&out, "Connection: keep-alive\r\n", 24);
+    }
+    _evsrv_http_put(&out, "\r\n", 2);
+    if (len > 0 && !self->head_only) {
+        _evsrv_http_put(&out, body, len);
+    }
+    if (out.len > 0) {
+        evsrv_conn_write(out.conn, out.buf, out.len);
+    }
+}
+
+// writes the status line and headers of a response, content_length bytes of body are to be written
+// with evsrv_conn_write (and are not for HEAD requests). headers are extra "Name: value\r\n" lines or NULL
+void evsrv_http_write_head(evsrv_http_conn* self, int status, const char* headers, size_t content_length) {
+    _evsrv_http_write(self, status, NULL, headers, content_length, NULL, 0);
+}
+
+void evsrv_http_respond(evsrv_http_conn* self, int status, const char* content_type, const void* body, size_t len) {
+    _evsrv_http_write(self, status, content_type, NULL, len, body, len);
+}
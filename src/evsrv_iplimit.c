@@ -0,0 +1,246 @@
+#include "evsrv_iplimit.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <netinet/in.h>
+
+#define EVSRV_IPLIMIT_MIN_SLOTS 64
+
+static int _evsrv_iplimit_rehash(evsrv_iplimit* self, uint32_t slots_count, ev_tstamp now);
+
+/*************************** evsrv_iplimit ***************************/
+
+void evsrv_iplimit_init(evsrv_iplimit* self) {
+    self->slots = NULL;
+    self->mask = 0;
+    self->used = 0;
+    self->seed = (uint64_t) (uintptr_t) self ^ (uint64_t) (ev_time() * 1e6); // keeps probe sequences unpredictable
+    self->max_conns = 0;
+    self->conn_rate = 0;
+    self->conn_burst = 0;
+    self->read_rate = 0;
+    self->read_burst = 0;
+}
+
+void evsrv_iplimit_destroy(evsrv_iplimit* self) {
+    free(self->slots);
+    self->slots = NULL;
+    self->mask = 0;
+    self->used = 0;
+}
+
+static bool _evsrv_iplimit_key(const struct evsrv_sockaddr* addr, uint64_t key[2]) {
+    uint8_t bytes[16];
+    if (addr->ss.ss_family == AF_INET) {
+        const struct sockaddr_in* in = (const struct sockaddr_in*) &addr->ss;
+        memset(bytes, 0, 10);
+        bytes[10] = 0xff;
+        bytes[11] = 0xff;
+        memcpy(bytes + 12, &in->sin_addr, 4);
+    } else if (addr->ss.ss_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*) &addr->ss;
+        memcpy(bytes, &in6->sin6_addr, 16);
+    } else {
+        return false;
+    }
+    memcpy(key, bytes, 16);
+    return true;
+}
+
+static inline uint32_t _evsrv_iplimit_hash(const evsrv_iplimit* self, const uint64_t key[2]) {
+    uint64_t h = (key[0] ^ self->seed) * 0x9e3779b97f4a7c15ULL;
+    h ^= (key[1] + self->seed) * 0xc2b2ae3d27d4eb4fULL;
+    h ^= h >> 31;
+    h *= 0x94d049bb133111ebULL;
+    return (uint32_t) (h >> 32) | 0x80000000u; // never 0, that marks free slots
+}
+
+static inline void _evsrv_iplimit_refill(const evsrv_iplimit* self, struct evsrv_ipentry* e, ev_tstamp now) {
+    ev_tstamp dt = now - e->stamp;
+    if (dt <= 0) {
+        return;
+    }
+    if (self->conn_rate > 0) {
+        e->conn_tokens += dt * self->conn_rate;
+        if (e->conn_tokens > self->conn_burst) {
+            e->conn_tokens = self->conn_burst;
+        }
+    }
+    if (self->read_rate > 0) {
+        e->read_tokens += dt * self->read_rate;
+        if (e->read_tokens > self->read_burst) {
+            e->read_tokens = self->read_burst;
+        }
+    }
+    e->stamp = now;
+}
+
+// an entry may be dropped once it holds nothing its address could benefit from later
+static inline bool _evsrv_iplimit_idle(const evsrv_iplimit* self, struct evsrv_ipentry* e, ev_tstamp now) {
+    _evsrv_iplimit_refill(self, e, now);
+    return e->conns == 0 &&
+           (self->conn_rate <= 0 || e->conn_tokens >= self->conn_burst) &&
+           (self->read_rate <= 0 || e->read_tokens >= self->read_burst);
+}
+
+static struct evsrv_ipentry* _evsrv_iplimit_find(evsrv_iplimit* self, const uint64_t key[2], uint32_t hash) {
+    if (self->slots == NULL) {
+        return NULL;
+    }
+    for (uint32_t i = hash & self->mask;; i = (i + 1) & self->mask) {
+        struct evsrv_ipentry* e = &self->slots[i];
+        if (e->hash == 0) {
+            return NULL;
+        }
+        if (e->hash == hash && e->key[0] == key[0] && e->key[1] == key[1]) {
+            return e;
+        }
+    }
+}
+
+static struct evsrv_ipentry* _evsrv_iplimit_insert(evsrv_iplimit* self, const uint64_t key[2], uint32_t hash, ev_tstamp now) {
+    if (self->slots == NULL) {
+        if (_evsrv_iplimit_rehash(self, EVSRV_IPLIMIT_MIN_SLOTS, now) < 0) {
+            return NULL;
+        }
+    } else if ((self->used + 1) * 4 > (self->mask + 1) * 3) {
+        // dropping idle entries first, the table grows only if they were not enough to get under half
+        if (_evsrv_iplimit_rehash(self, self->mask + 1, now) < 0) {
+            return NULL;
+        }
+        if (self->used * 2 > self->mask + 1 && _evsrv_iplimit_rehash(self, (self->mask + 1) * 2, now) < 0) {
+            return NULL;
+        }
+    }
+
+    uint32_t i = hash & self->mask;
+    while (self->slots[i].hash != 0) {
+        i = (i + 1) & self->mask;
+    }
+    struct evsrv_ipentry* e = &self->slots[i];
+    e->key[0] = key[0];
+    e->key[1] = key[1];
+    e->hash = hash;
+    e->conns = 0;
+    e->conn_tokens = self->conn_burst;
+    e->read_tokens = self->read_burst;
+    e->stamp = now;
+    ++self->used;
+    return e;
+}
+
+// backward shift deletion keeps probe sequences intact without tombstones
+static void _evsrv_iplimit_remove(evsrv_iplimit* self, struct evsrv_ipentry* e) {
+    uint32_t i = (uint32_t) (e - self->slots);
+    for (uint32_t j = (i + 1) & self->mask; self->slots[j].hash != 0; j = (j + 1) & self->mask) {
+        uint32_t ideal = self->slots[j].hash & self->mask;
+        if (((j - ideal) & self->mask) >= ((j - i) & self->mask)) {
+            self->slots[i] = self->slots[j];
+            i = j;
+        }
+    }
+    self->slots[i].hash = 0;
+    --self->used;
+}
+
+// rebuilds the table with slots_count slots, leaving idle entries behind
+int _evsrv_iplimit_rehash(evsrv_iplimit* self, uint32_t slots_count, ev_tstamp now) {
+    struct evsrv_ipentry* slots = (struct evsrv_ipentry*) calloc(slots_count, sizeof(struct evsrv_ipentry));
+    if (slots == NULL) {
+        cerror("Could not allocate %u slots of address table", slots_count);
+        return -1;
+    }
+
+    struct evsrv_ipentry* old = self->slots;
+    uint32_t old_count = old != NULL ? self->mask + 1 : 0;
+    self->slots = slots;
+    self->mask = slots_count - 1;
+    self->used = 0;
+    for (uint32_t k = 0; k < old_count; ++k) {
+        struct evsrv_ipentry* e = &old[k];
+        if (e->hash == 0 || _evsrv_iplimit_idle(self, e, now)) {
+            continue;
+        }
+        uint32_t i = e->hash & self->mask;
+        while (slots[i].hash != 0) {
+            i = (i + 1) & self->mask;
+        }
+        slots[i] = *e;
+        ++self->used;
+    }
+    free(old);
+    return 0;
+}
+
+// takes a connection slot and a connection token of the peer's address, returns -1 when there are none left
+int evsrv_iplimit_admit(evsrv_iplimit* self, const struct evsrv_sockaddr* addr, ev_tstamp now) {
+    uint64_t key[2];
+    if (!_evsrv_iplimit_key(addr, key)) {
+        return 0;
+    }
+    uint32_t hash = _evsrv_iplimit_hash(self, key);
+    struct evsrv_ipentry* e = _evsrv_iplimit_find(self, key, hash);
+    if (e == NULL) {
+        e = _evsrv_iplimit_insert(self, key, hash, now);
+        if (unlikely(e == NULL)) {
+            return 0; // out of memory, better to let the connection in than to refuse everybody
+        }
+    } else {
+        _evsrv_iplimit_refill(self, e, now);
+    }
+
+    if (self->max_conns > 0 && e->conns >= self->max_conns) {
+        return -1;
+    }
+    if (self->conn_rate > 0) {
+        if (e->conn_tokens < 1.0) {
+            return -1;
+        }
+        e->conn_tokens -= 1.0;
+    }
+    ++e->conns;
+    return 0;
+}
+
+void evsrv_iplimit_release(evsrv_iplimit* self, const struct evsrv_sockaddr* addr, ev_tstamp now) {
+    uint64_t key[2];
+    if (!_evsrv_iplimit_key(addr, key)) {
+        return;
+    }
+    struct evsrv_ipentry* e = _evsrv_iplimit_find(self, key, _evsrv_iplimit_hash(self, key));
+    if (e == NULL) {
+        return;
+    }
+    if (e->conns > 0) {
+        --e->conns;
+    }
+    if (_evsrv_iplimit_idle(self, e, now)) {
+        _evsrv_iplimit_remove(self, e);
+    }
+}
+
+// charges bytes read by the peer's address, returns read tokens left (negative once over the rate).
+// hint caches the slot of the address between calls, UINT32_MAX when unknown
+double evsrv_iplimit_read(evsrv_iplimit* self, const struct evsrv_sockaddr* addr, size_t bytes, ev_tstamp now,
+                          uint32_t* hint) {
+    uint64_t key[2];
+    if (self->read_rate <= 0 || !_evsrv_iplimit_key(addr, key)) {
+        return 1.0;
+    }
+
+    struct evsrv_ipentry* e = NULL;
+    if (*hint <= self->mask && self->slots[*hint].hash != 0 &&
+        self->slots[*hint].key[0] == key[0] && self->slots[*hint].key[1] == key[1]) {
+        e = &self->slots[*hint];
+    } else {
+        e = _evsrv_iplimit_find(self, key, _evsrv_iplimit_hash(self, key));
+        if (e == NULL) {
+            return 1.0;
+        }
+        *hint = (uint32_t) (e - self->slots);
+    }
+
+    _evsrv_iplimit_refill(self, e, now);
+    e->read_tokens -= (double) bytes;
+    return e->read_tokens;
+}
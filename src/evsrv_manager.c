@@ -4,14 +4,58 @@
 #include <stdlib.h>
 #include <sys/un.h>
 #include <assert.h>
+#include <unistd.h>
 
 static void _evsrv_manager_graceful_stop_cb(evsrv* stopped_srv);
+static void _evsrv_manager_notify_cb(struct ev_loop* loop, ev_async* w, int revents);
+static void _evsrv_manager_dispatch_cb(evsrv* acceptor, const struct evsrv_conn_info* info);
+static void _evsrv_manager_acceptors_resume(evsrv_manager* self);
+
+static void* _evsrv_worker_run(void* arg);
+static void _evsrv_worker_cmd_cb(struct ev_loop* loop, ev_async* w, int revents);
+static void _evsrv_worker_graceful_stop_cb(evsrv_manager* mgr);
+static void _evsrv_worker_dispatch_cb(struct ev_loop* loop, ev_async* w, int revents);
+static void _evsrv_worker_drain_queue(evsrv_worker* self, bool adopt);
+
+#define evsrv_manager_is_mt(self) ((self)->workers_len > 0)
+#define evsrv_manager_is_dispatching(self) ((self)->mode == EVSRV_MANAGER_MODE_DISPATCH)
+#define evsrv_manager_acceptors_len(self) ((self)->workers[0].mgr.srvs_len)
 
 
 /*************************** evsrv_manager ***************************/
 
-void evsrv_manager_init(struct ev_loop* loop, evsrv_manager* self, evsrv_info* servers, size_t servers_count) {
+static void _evsrv_manager_init(struct ev_loop* loop, evsrv_manager* self) {
     self->loop = loop;
+    self->srvs = NULL;
+    self->srvs_len = 0;
+    self->active_srvs = 0;
+    self->stopped_srvs = 0;
+    self->on_started = NULL;
+    self->on_graceful_stop = NULL;
+    self->state = EVSRV_MANAGER_IDLE;
+    self->active_connections = 0;
+    self->max_connections = 0;
+    self->conns_refusing = false;
+    self->wbuf_budget = 0;
+    self->wbuf_total = 0;
+    self->wbuf_shed = EVSRV_SHED_NONE;
+    self->wbuf_refusing = false;
+    evsrv_bufpool_init(&self->bufpool);
+
+    self->mode = EVSRV_MANAGER_MODE_SINGLE;
+    self->dispatch_policy = EVSRV_DISPATCH_ROUND_ROBIN;
+    self->acceptors = NULL;
+    self->next_worker = 0;
+
+    self->parent = NULL;
+    self->worker = NULL;
+    self->workers = NULL;
+    self->workers_len = 0;
+    self->started_workers = 0;
+    self->stopped_workers = 0;
+}
+
+static void _evsrv_manager_create_srvs(evsrv_manager* self, evsrv_info* servers, size_t servers_count) {
     self->srvs_len = servers_count;
     self->srvs = (evsrv**) calloc(self->srvs_len, sizeof(evsrv*));
     for (size_t i = 0; i < self->srvs_len; ++i) {
@@ -20,12 +64,82 @@ void evsrv_manager_init(struct ev_loop* loop, evsrv_manager* self, evsrv_info* s
         self->srvs[i]->id = id;
         self->srvs[i]->manager = self;
         self->srvs[i]->on_destroy = servers[i].on_destroy;
+        if (self->srvs[i]->bufpool == NULL) {
+            self->srvs[i]->bufpool = &self->bufpool;
+        }
+    }
+}
+
+void evsrv_manager_init(struct ev_loop* loop, evsrv_manager* self, evsrv_info* servers, size_t servers_count) {
+    evsrv_manager_init_workers(loop, self, servers, servers_count, 0);
+}
+
+void evsrv_manager_init_workers(struct ev_loop* loop, evsrv_manager* self, evsrv_info* servers, size_t servers_count,
+                                size_t workers_count) {
+    _evsrv_manager_init(loop, self);
+    if (workers_count == 0) {
+        _evsrv_manager_create_srvs(self, servers, servers_count);
+        return;
+    }
+
+    ev_async_init(&self->notify_w, _evsrv_manager_notify_cb);
+
+    self->mode = EVSRV_MANAGER_MODE_REUSEPORT;
+    self->workers_len = workers_count;
+    self->workers = (evsrv_worker*) calloc(self->workers_len, sizeof(evsrv_worker));
+    for (size_t i = 0; i < self->workers_len; ++i) {
+        evsrv_worker* w = &self->workers[i];
+        w->parent = self;
+        w->id = i + 1;
+        w->loop = ev_loop_new(EVFLAG_AUTO);
+        w->running = false;
+        w->cmd = EVSRV_WORKER_CMD_NONE;
+        ev_async_init(&w->cmd_w, _evsrv_worker_cmd_cb);
+
+        w->queue.items = (struct evsrv_dispatch_item*) calloc(EVSRV_DISPATCH_QUEUE_LEN, sizeof(struct evsrv_dispatch_item));
+        w->queue.mask = EVSRV_DISPATCH_QUEUE_LEN - 1;
+        w->queue.head = 0;
+        w->queue.tail = 0;
+        ev_async_init(&w->dispatch_w, _evsrv_worker_dispatch_cb);
+
+        _evsrv_manager_init(w->loop, &w->mgr);
+        w->mgr.parent = self;
+        w->mgr.worker = w;
+        _evsrv_manager_create_srvs(&w->mgr, servers, servers_count);
+        for (size_t j = 0; j < w->mgr.srvs_len; ++j) {
+            w->mgr.srvs[j]->reuseport = true;
+        }
+    }
+}
+
+void evsrv_manager_set_dispatch(evsrv_manager* self, enum evsrv_dispatch_policy policy) {
+    if (!evsrv_manager_is_mt(self)) {
+        cwarn("Dispatching is only available for manager with workers");
+        return;
+    }
+    if (self->state != EVSRV_MANAGER_IDLE) {
+        cwarn("Dispatching has to be set up before bind");
+        return;
+    }
+
+    self->dispatch_policy = policy;
+    if (evsrv_manager_is_dispatching(self)) {
+        return;
+    }
+    self->mode = EVSRV_MANAGER_MODE_DISPATCH;
+
+    // acceptors mirror the first worker's servers, but live on the manager's loop
+    size_t acceptors_len = evsrv_manager_acceptors_len(self);
+    self->acceptors = (evsrv*) calloc(acceptors_len, sizeof(evsrv));
+    for (size_t i = 0; i < acceptors_len; ++i) {
+        evsrv* origin = self->workers[0].mgr.srvs[i];
+        evsrv* acceptor = &self->acceptors[i];
+        evsrv_init(self->loop, acceptor, origin->host, origin->port);
+        acceptor->id = origin->id;
+        acceptor->manager = self;
+        acceptor->backlog = origin->backlog;
+        acceptor->on_dispatch = _evsrv_manager_dispatch_cb;
     }
-    self->active_srvs = 0;
-    self->stopped_srvs = 0;
-    self->on_started = NULL;
-    self->on_graceful_stop = NULL;
-    self->state = EVSRV_MANAGER_IDLE;
 }
 
 void evsrv_manager_destroy(evsrv_manager* self) {
@@ -37,9 +151,74 @@ void evsrv_manager_destroy(evsrv_manager* self) {
     self->srvs = NULL;
     self->srvs_len = 0;
     self->active_srvs = 0;
+
+    if (evsrv_manager_is_mt(self)) {
+        if (ev_is_active(&self->notify_w)) {
+            ev_async_stop(self->loop, &self->notify_w);
+        }
+        if (self->acceptors) {
+            for (size_t i = 0; i < evsrv_manager_acceptors_len(self); ++i) {
+                evsrv_destroy(&self->acceptors[i]);
+            }
+            free(self->acceptors);
+            self->acceptors = NULL;
+        }
+        for (size_t i = 0; i < self->workers_len; ++i) {
+            evsrv_worker* w = &self->workers[i];
+            _evsrv_worker_drain_queue(w, false);
+            free(w->queue.items);
+            w->queue.items = NULL;
+            evsrv_manager_destroy(&w->mgr);
+            ev_loop_destroy(w->loop);
+            w->loop = NULL;
+        }
+        free(self->workers);
+        self->workers = NULL;
+        self->workers_len = 0;
+    }
+
+    // the servers are gone along with the buffers they borrowed
+    evsrv_bufpool_destroy(&self->bufpool);
 }
 
 void evsrv_manager_bind(evsrv_manager* self) {
+    if (evsrv_manager_is_dispatching(self)) {
+        for (size_t i = 0; i < evsrv_manager_acceptors_len(self); ++i) {
+            evsrv* acceptor = &self->acceptors[i];
+            if (evsrv_bind(acceptor) == -1) {
+                cerror("Bind of server [#%lu] %s:%s failed", acceptor->id, acceptor->host, acceptor->port);
+            }
+        }
+        for (size_t i = 0; i < self->workers_len; ++i) {
+            self->workers[i].mgr.state = EVSRV_MANAGER_BOUND;
+        }
+        self->state = EVSRV_MANAGER_BOUND;
+        return;
+    }
+
+    if (evsrv_manager_is_mt(self)) {
+        for (size_t i = 0; i < self->workers_len; ++i) {
+            evsrv_manager* mgr = &self->workers[i].mgr;
+            if (i == 0) {
+                evsrv_manager_bind(mgr);
+                continue;
+            }
+
+            // unix sockets cannot be reuseport'ed, so all the workers accept on the first worker's socket
+            for (size_t j = 0; j < mgr->srvs_len; ++j) {
+                evsrv* srv = mgr->srvs[j];
+                evsrv* origin = self->workers[0].mgr.srvs[j];
+                int rc = (origin->sockaddr.ss.ss_family == AF_UNIX) ? evsrv_bind_shared(srv, origin) : evsrv_bind(srv);
+                if (rc == -1) {
+                    cerror("Bind of server [#%lu] %s:%s in worker #%lu failed", srv->id, srv->host, srv->port, i + 1);
+                }
+            }
+            mgr->state = EVSRV_MANAGER_BOUND;
+        }
+        self->state = EVSRV_MANAGER_BOUND;
+        return;
+    }
+
     for (size_t i = 0; i < self->srvs_len; ++i) {
         evsrv* srv = self->srvs[i];
         if (evsrv_bind(srv) == -1) {
@@ -50,6 +229,19 @@ void evsrv_manager_bind(evsrv_manager* self) {
 }
 
 void evsrv_manager_listen(evsrv_manager* self) {
+    for (size_t i = 0; i < self->workers_len; ++i) {
+        evsrv_manager_listen(&self->workers[i].mgr);
+    }
+
+    if (evsrv_manager_is_dispatching(self)) {
+        for (size_t i = 0; i < evsrv_manager_acceptors_len(self); ++i) {
+            evsrv* acceptor = &self->acceptors[i];
+            if (acceptor->state == EVSRV_BOUND && evsrv_listen(acceptor) == -1) {
+                cerror("Listen of server [#%lu] %s:%s failed", acceptor->id, acceptor->host, acceptor->port);
+            }
+        }
+    }
+
     for (size_t i = 0; i < self->srvs_len; ++i) {
         evsrv* srv = self->srvs[i];
         if (srv->state == EVSRV_BOUND) {
@@ -62,6 +254,35 @@ void evsrv_manager_listen(evsrv_manager* self) {
 }
 
 void evsrv_manager_accept(evsrv_manager* self) {
+    if (evsrv_manager_is_mt(self)) {
+        ev_async_start(self->loop, &self->notify_w);
+        for (size_t i = 0; i < self->workers_len; ++i) {
+            evsrv_worker* w = &self->workers[i];
+            ev_async_start(w->loop, &w->cmd_w);
+            if (evsrv_manager_is_dispatching(self)) {
+                ev_async_start(w->loop, &w->dispatch_w);
+            }
+            if (pthread_create(&w->thread, NULL, _evsrv_worker_run, w) != 0) {
+                cerror("Failed to start worker #%lu", w->id);
+                ev_async_stop(w->loop, &w->cmd_w);
+                evsrv_manager_stop(&w->mgr);
+                __atomic_add_fetch(&self->started_workers, 1, __ATOMIC_SEQ_CST);
+                __atomic_add_fetch(&self->stopped_workers, 1, __ATOMIC_SEQ_CST);
+                continue;
+            }
+            w->running = true;
+        }
+        if (evsrv_manager_is_dispatching(self)) {
+            for (size_t i = 0; i < evsrv_manager_acceptors_len(self); ++i) {
+                if (self->acceptors[i].state == EVSRV_LISTENING) {
+                    evsrv_accept(&self->acceptors[i]);
+                }
+            }
+        }
+        ev_async_send(self->loop, &self->notify_w);
+        return;
+    }
+
     for (size_t i = 0; i < self->srvs_len; ++i) {
         if (self->srvs[i]->state == EVSRV_LISTENING) {
             evsrv_accept(self->srvs[i]);
@@ -77,6 +298,31 @@ void evsrv_manager_accept(evsrv_manager* self) {
 }
 
 void evsrv_manager_stop(evsrv_manager* self) {
+    if (evsrv_manager_is_dispatching(self)) {
+        for (size_t i = 0; i < evsrv_manager_acceptors_len(self); ++i) {
+            evsrv_stop(&self->acceptors[i]);
+        }
+    }
+
+    for (size_t i = 0; i < self->workers_len; ++i) {
+        evsrv_worker* w = &self->workers[i];
+        if (w->running) {
+            __atomic_store_n(&w->cmd, EVSRV_WORKER_CMD_STOP, __ATOMIC_SEQ_CST);
+            ev_async_send(w->loop, &w->cmd_w);
+            pthread_join(w->thread, NULL);
+            w->running = false;
+        } else {
+            evsrv_manager_stop(&w->mgr);
+        }
+    }
+    if (evsrv_manager_is_mt(self)) {
+        self->active_srvs = 0;
+        self->state = EVSRV_MANAGER_STOPPED;
+        if (ev_is_active(&self->notify_w)) {
+            ev_async_stop(self->loop, &self->notify_w);
+        }
+    }
+
     for (size_t i = 0; i < self->srvs_len; ++i) {
         evsrv* srv = self->srvs[i];
         evsrv_stop(srv);
@@ -85,11 +331,37 @@ void evsrv_manager_stop(evsrv_manager* self) {
         }
         ++self->stopped_srvs;
     }
+    self->state = EVSRV_MANAGER_STOPPED;
 }
 
 void evsrv_manager_graceful_stop(evsrv_manager* self, evsrv_manager_on_graceful_stop_cb cb) {
     self->state = EVSRV_MANAGER_GRACEFULLY_STOPPING;
     self->on_graceful_stop = cb;
+
+    if (evsrv_manager_is_mt(self)) {
+        if (evsrv_manager_is_dispatching(self)) {
+            for (size_t i = 0; i < evsrv_manager_acceptors_len(self); ++i) {
+                evsrv_stop(&self->acceptors[i]);
+            }
+        }
+        for (size_t i = 0; i < self->workers_len; ++i) {
+            evsrv_worker* w = &self->workers[i];
+            if (w->running) {
+                __atomic_store_n(&w->cmd, EVSRV_WORKER_CMD_GRACEFUL_STOP, __ATOMIC_SEQ_CST);
+                ev_async_send(w->loop, &w->cmd_w);
+            } else if (w->mgr.state != EVSRV_MANAGER_STOPPED) {
+                evsrv_manager_stop(&w->mgr);
+                __atomic_add_fetch(&self->stopped_workers, 1, __ATOMIC_SEQ_CST);
+            }
+        }
+        if (!ev_is_active(&self->notify_w)) {
+            ev_async_start(self->loop, &self->notify_w);
+        }
+        // completion is reported by the workers through notify_w
+        ev_async_send(self->loop, &self->notify_w);
+        return;
+    }
+
     for (size_t i = 0; i < self->srvs_len; ++i) {
         evsrv* srv = self->srvs[i];
         if (srv->state == EVSRV_ACCEPTING) {
@@ -114,3 +386,228 @@ void _evsrv_manager_graceful_stop_cb(evsrv* stopped_srv) {
         server->on_graceful_stop(server);
     }
 }
+
+void _evsrv_manager_notify_cb(struct ev_loop* loop, ev_async* w, int revents) {
+    evsrv_manager* self = SELFby(w, evsrv_manager, notify_w);
+
+    if (evsrv_manager_is_dispatching(self) && self->state == EVSRV_MANAGER_ACCEPTING) {
+        _evsrv_manager_acceptors_resume(self);
+    }
+
+    size_t started = __atomic_load_n(&self->started_workers, __ATOMIC_SEQ_CST);
+    size_t stopped = __atomic_load_n(&self->stopped_workers, __ATOMIC_SEQ_CST);
+
+    if (self->state == EVSRV_MANAGER_LISTENING && started == self->workers_len) {
+        self->active_srvs = 0;
+        for (size_t i = 0; i < self->workers_len; ++i) {
+            self->active_srvs += __atomic_load_n(&self->workers[i].mgr.active_srvs, __ATOMIC_SEQ_CST);
+        }
+        if (self->active_srvs > 0) {
+            self->state = EVSRV_MANAGER_ACCEPTING;
+            if (self->on_started) {
+                self->on_started(self);
+            }
+        }
+    }
+
+    if (self->state == EVSRV_MANAGER_GRACEFULLY_STOPPING && stopped == self->workers_len) {
+        for (size_t i = 0; i < self->workers_len; ++i) {
+            evsrv_worker* worker = &self->workers[i];
+            if (worker->running) {
+                pthread_join(worker->thread, NULL);
+                worker->running = false;
+            }
+        }
+        ev_async_stop(loop, w);
+        self->active_srvs = 0;
+        self->state = EVSRV_MANAGER_STOPPED;
+        self->on_graceful_stop(self);
+    }
+}
+
+static bool _evsrv_dispatch_queue_push(struct evsrv_dispatch_queue* q, const struct evsrv_conn_info* info, size_t srv_idx) {
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (tail - head > q->mask) {
+        return false;
+    }
+    q->items[tail & q->mask].info = *info;
+    q->items[tail & q->mask].srv_idx = srv_idx;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static size_t _evsrv_worker_load(evsrv_worker* w, size_t srv_idx) {
+    size_t queued = __atomic_load_n(&w->queue.tail, __ATOMIC_RELAXED) - __atomic_load_n(&w->queue.head, __ATOMIC_RELAXED);
+    int32_t active = __atomic_load_n(&w->mgr.srvs[srv_idx]->active_connections, __ATOMIC_RELAXED);
+    return queued + (active > 0 ? (size_t) active : 0);
+}
+
+static size_t _evsrv_manager_pick_worker(evsrv_manager* self, size_t srv_idx) {
+    size_t start = self->next_worker++ % self->workers_len;
+    if (self->dispatch_policy == EVSRV_DISPATCH_ROUND_ROBIN) {
+        return start;
+    }
+
+    // least connections, ties are broken in round-robin order
+    size_t best = start;
+    size_t best_load = _evsrv_worker_load(&self->workers[start], srv_idx);
+    for (size_t i = 1; i < self->workers_len && best_load > 0; ++i) {
+        size_t idx = (start + i) % self->workers_len;
+        size_t load = _evsrv_worker_load(&self->workers[idx], srv_idx);
+        if (load < best_load) {
+            best = idx;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// connections of all the workers, including the ones still queued to them
+static int32_t _evsrv_manager_dispatched(evsrv_manager* self) {
+    int32_t total = 0;
+    for (size_t i = 0; i < self->workers_len; ++i) {
+        evsrv_worker* w = &self->workers[i];
+        total += __atomic_load_n(&w->mgr.active_connections, __ATOMIC_RELAXED);
+        total += (int32_t) (__atomic_load_n(&w->queue.tail, __ATOMIC_RELAXED) - __atomic_load_n(&w->queue.head, __ATOMIC_RELAXED));
+    }
+    return total;
+}
+
+#define _evsrv_manager_dispatch_full(self) ((self)->max_connections > 0 && _evsrv_manager_dispatched(self) >= (self)->max_connections)
+
+static void _evsrv_manager_acceptors_pause(evsrv_manager* self) {
+    __atomic_store_n(&self->conns_refusing, true, __ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < evsrv_manager_acceptors_len(self); ++i) {
+        evsrv_accept_pause(&self->acceptors[i], EVSRV_ACCEPT_PAUSE_CONNS);
+    }
+}
+
+// workers notify the manager on close while it refuses, checking once more covers a close that came before the flag
+static void _evsrv_manager_acceptors_resume(evsrv_manager* self) {
+    if (!__atomic_load_n(&self->conns_refusing, __ATOMIC_SEQ_CST) || _evsrv_manager_dispatch_full(self)) {
+        return;
+    }
+    __atomic_store_n(&self->conns_refusing, false, __ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < evsrv_manager_acceptors_len(self); ++i) {
+        evsrv_accept_resume(&self->acceptors[i], EVSRV_ACCEPT_PAUSE_CONNS);
+    }
+}
+
+void _evsrv_manager_dispatch_cb(evsrv* acceptor, const struct evsrv_conn_info* info) {
+    evsrv_manager* self = acceptor->manager;
+    size_t srv_idx = acceptor->id - 1;
+
+    size_t idx = _evsrv_manager_pick_worker(self, srv_idx);
+    for (size_t attempt = 0; attempt < self->workers_len; ++attempt) {
+        evsrv_worker* w = &self->workers[(idx + attempt) % self->workers_len];
+        if (w->running && _evsrv_dispatch_queue_push(&w->queue, info, srv_idx)) {
+            ev_async_send(w->loop, &w->dispatch_w);
+            if (unlikely(_evsrv_manager_dispatch_full(self))) {
+                _evsrv_manager_acceptors_pause(self);
+                _evsrv_manager_acceptors_resume(self);
+            }
+            return;
+        }
+    }
+
+    cwarn("Dispatch queues of all workers are full, dropping connection %d", info->sock);
+    close(info->sock);
+}
+
+
+/*************************** evsrv_worker ***************************/
+
+void* _evsrv_worker_run(void* arg) {
+    evsrv_worker* self = (evsrv_worker*) arg;
+    evsrv_manager* parent = self->parent;
+
+    if (parent->max_connections > 0 && !evsrv_manager_is_dispatching(parent)) {
+        self->mgr.max_connections = (int32_t) ((parent->max_connections + parent->workers_len - 1) / parent->workers_len);
+    }
+    if (parent->wbuf_budget > 0) {
+        self->mgr.wbuf_budget = parent->wbuf_budget / parent->workers_len + 1;
+        self->mgr.wbuf_shed = parent->wbuf_shed;
+    }
+
+    if (evsrv_manager_is_dispatching(parent)) {
+        // servers get their connections from the acceptor, there is nothing to listen on
+        for (size_t i = 0; i < self->mgr.srvs_len; ++i) {
+            evsrv* srv = self->mgr.srvs[i];
+            srv->state = EVSRV_ACCEPTING;
+            if (srv->on_started) {
+                srv->on_started(srv);
+            }
+            ++self->mgr.active_srvs;
+        }
+        self->mgr.state = EVSRV_MANAGER_ACCEPTING;
+    } else {
+        evsrv_manager_accept(&self->mgr);
+    }
+    __atomic_add_fetch(&parent->started_workers, 1, __ATOMIC_SEQ_CST);
+    ev_async_send(parent->loop, &parent->notify_w);
+
+    ev_run(self->loop, 0);
+    return NULL;
+}
+
+void _evsrv_worker_cmd_cb(struct ev_loop* loop, ev_async* w, int revents) {
+    evsrv_worker* self = SELFby(w, evsrv_worker, cmd_w);
+
+    int cmd = __atomic_exchange_n(&self->cmd, EVSRV_WORKER_CMD_NONE, __ATOMIC_SEQ_CST);
+    switch (cmd) {
+        case EVSRV_WORKER_CMD_STOP:
+            _evsrv_worker_drain_queue(self, false);
+            evsrv_manager_stop(&self->mgr);
+            ev_async_stop(loop, w);
+            if (ev_is_active(&self->dispatch_w)) {
+                ev_async_stop(loop, &self->dispatch_w);
+            }
+            ev_break(loop, EVBREAK_ALL);
+            break;
+        case EVSRV_WORKER_CMD_GRACEFUL_STOP:
+            if (self->mgr.state != EVSRV_MANAGER_GRACEFULLY_STOPPING) {
+                _evsrv_worker_drain_queue(self, true);
+                evsrv_manager_graceful_stop(&self->mgr, _evsrv_worker_graceful_stop_cb);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void _evsrv_worker_graceful_stop_cb(evsrv_manager* mgr) {
+    evsrv_worker* self = mgr->worker;
+    evsrv_manager* parent = self->parent;
+
+    ev_async_stop(self->loop, &self->cmd_w);
+    if (ev_is_active(&self->dispatch_w)) {
+        ev_async_stop(self->loop, &self->dispatch_w);
+    }
+    ev_break(self->loop, EVBREAK_ALL);
+
+    __atomic_add_fetch(&parent->stopped_workers, 1, __ATOMIC_SEQ_CST);
+    ev_async_send(parent->loop, &parent->notify_w);
+}
+
+void _evsrv_worker_dispatch_cb(struct ev_loop* loop, ev_async* w, int revents) {
+    evsrv_worker* self = SELFby(w, evsrv_worker, dispatch_w);
+    _evsrv_worker_drain_queue(self, self->mgr.state == EVSRV_MANAGER_ACCEPTING);
+}
+
+void _evsrv_worker_drain_queue(evsrv_worker* self, bool adopt) {
+    struct evsrv_dispatch_queue* q = &self->queue;
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct evsrv_dispatch_item item = q->items[head & q->mask];
+        __atomic_store_n(&q->head, ++head, __ATOMIC_RELEASE);
+
+        if (adopt) {
+            evsrv_add_conn(self->mgr.srvs[item.srv_idx], &item.info);
+        } else {
+            close(item.info.sock);
+        }
+    }
+}
@@ -0,0 +1,136 @@
+#include "evsrv_pool.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define EVSRV_POOL_ALIGN 16
+#define evsrv_pool_align(size) (((size) + EVSRV_POOL_ALIGN - 1) & ~((size_t) EVSRV_POOL_ALIGN - 1))
+
+/*************************** evsrv_pool ***************************/
+
+void evsrv_pool_init(evsrv_pool* self, size_t obj_size, size_t objs_per_slab) {
+    if (obj_size < sizeof(void*)) {
+        obj_size = sizeof(void*);
+    }
+    self->obj_size = evsrv_pool_align(obj_size);
+    self->objs_per_slab = objs_per_slab > 0 ? objs_per_slab : EVSRV_POOL_SLAB_OBJS;
+    self->free_list = NULL;
+    self->slabs = NULL;
+    self->capacity = 0;
+    self->used = 0;
+}
+
+void evsrv_pool_destroy(evsrv_pool* self) {
+    struct evsrv_pool_slab* slab = self->slabs;
+    while (slab != NULL) {
+        struct evsrv_pool_slab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    self->slabs = NULL;
+    self->free_list = NULL;
+    self->capacity = 0;
+    self->used = 0;
+}
+
+static int _evsrv_pool_grow(evsrv_pool* self) {
+    size_t header = evsrv_pool_align(sizeof(struct evsrv_pool_slab));
+    struct evsrv_pool_slab* slab = (struct evsrv_pool_slab*) malloc(header + self->obj_size * self->objs_per_slab);
+    if (slab == NULL) {
+        return -1;
+    }
+    slab->next = self->slabs;
+    self->slabs = slab;
+
+    char* objs = (char*) slab + header;
+    for (size_t i = self->objs_per_slab; i > 0; --i) {
+        void** obj = (void**) (objs + (i - 1) * self->obj_size);
+        *obj = self->free_list;
+        self->free_list = obj;
+    }
+    self->capacity += self->objs_per_slab;
+    return 0;
+}
+
+int evsrv_pool_prewarm(evsrv_pool* self, size_t count) {
+    while (self->capacity - self->used < count) {
+        if (_evsrv_pool_grow(self) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void* evsrv_pool_alloc(evsrv_pool* self) {
+    if (unlikely(self->free_list == NULL) && _evsrv_pool_grow(self) < 0) {
+        return NULL;
+    }
+    void** obj = (void**) self->free_list;
+    self->free_list = *obj;
+    ++self->used;
+    return obj;
+}
+
+void evsrv_pool_free(evsrv_pool* self, void* obj) {
+    if (obj == NULL) {
+        return;
+    }
+    *(void**) obj = self->free_list;
+    self->free_list = obj;
+    --self->used;
+}
+
+
+/*************************** evsrv_bufpool ***************************/
+
+#define EVSRV_BUFPOOL_SLAB_BYTES (64 * 1024)
+
+static int _evsrv_bufpool_class(size_t size) {
+    int cls = 0;
+    while (cls < EVSRV_BUFPOOL_CLASSES && ((size_t) 1 << (EVSRV_BUFPOOL_MIN_SHIFT + cls)) < size) {
+        ++cls;
+    }
+    return cls < EVSRV_BUFPOOL_CLASSES ? cls : -1;
+}
+
+void evsrv_bufpool_init(evsrv_bufpool* self) {
+    for (int i = 0; i < EVSRV_BUFPOOL_CLASSES; ++i) {
+        size_t size = (size_t) 1 << (EVSRV_BUFPOOL_MIN_SHIFT + i);
+        size_t objs = size < EVSRV_BUFPOOL_SLAB_BYTES ? EVSRV_BUFPOOL_SLAB_BYTES / size : 1;
+        evsrv_pool_init(&self->classes[i], size, objs);
+    }
+}
+
+void evsrv_bufpool_destroy(evsrv_bufpool* self) {
+    for (int i = 0; i < EVSRV_BUFPOOL_CLASSES; ++i) {
+        evsrv_pool_destroy(&self->classes[i]);
+    }
+}
+
+size_t evsrv_bufpool_size(size_t size) {
+    int cls = _evsrv_bufpool_class(size);
+    return cls < 0 ? size : (size_t) 1 << (EVSRV_BUFPOOL_MIN_SHIFT + cls);
+}
+
+char* evsrv_bufpool_alloc(evsrv_bufpool* self, size_t size, size_t* allocated) {
+    int cls = _evsrv_bufpool_class(size);
+    char* buf;
+    if (cls < 0) {
+        buf = (char*) malloc(size);
+    } else {
+        buf = (char*) evsrv_pool_alloc(&self->classes[cls]);
+        size = self->classes[cls].obj_size;
+    }
+    *allocated = buf != NULL ? size : 0;
+    return buf;
+}
+
+void evsrv_bufpool_free(evsrv_bufpool* self, char* buf, size_t size) {
+    int cls = _evsrv_bufpool_class(size);
+    if (cls < 0) {
+        free(buf);
+    } else {
+        evsrv_pool_free(&self->classes[cls], buf);
+    }
+}
@@ -0,0 +1,417 @@
+#include "evsrv_resp.h"
+#include "evsrv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+static void _evsrv_resp_on_read(evsrv_conn* conn, ssize_t nread);
+
+/*************************** evsrv_resp_conn ***************************/
+
+static inline void _evsrv_resp_reset(evsrv_resp_conn* self) {
+    self->parsed = 0;
+    self->argc = -1;
+    self->bulk = -1;
+    self->nargs = 0;
+}
+
+void evsrv_resp_conn_init(evsrv_resp_conn* self, evsrv* srv, struct evsrv_conn_info* info,
+                          evsrv_resp_on_command_cb on_command) {
+    evsrv_conn_init(&self->conn, srv, info);
+    self->conn.on_read = _evsrv_resp_on_read;
+    self->conn.on_drain = srv->on_drain;
+    self->conn.wcork = srv->wcork;
+    evsrv_conn_set_rbuf_mode(&self->conn, srv->rbuf_mode);
+
+    self->proto = 2;
+    _evsrv_resp_reset(self);
+    self->spans = self->spans_inline;
+    self->argv = self->argv_inline;
+    self->args_cap = EVSRV_RESP_INLINE_ARGS;
+    self->closing = false;
+
+    self->max_args = EVSRV_RESP_MAX_ARGS;
+    self->max_bulk = 0;
+    self->max_commands = 0;
+    self->on_command = on_command;
+}
+
+void evsrv_resp_conn_destroy(evsrv_resp_conn* self) {
+    if (self->spans != self->spans_inline) {
+        free(self->spans);
+        free(self->argv);
+    }
+    self->spans = self->spans_inline;
+    self->argv = self->argv_inline;
+    self->args_cap = EVSRV_RESP_INLINE_ARGS;
+    evsrv_conn_destroy(&self->conn);
+}
+
+static int _evsrv_resp_args_reserve(evsrv_resp_conn* self, size_t count) {
+    if (count <= self->args_cap) {
+        return 0;
+    }
+    size_t cap = self->args_cap * 2 > count ? self->args_cap * 2 : count;
+    struct evsrv_resp_span* spans = (struct evsrv_resp_span*) malloc(cap * sizeof(struct evsrv_resp_span));
+    struct evsrv_resp_arg* argv = (struct evsrv_resp_arg*) malloc(cap * sizeof(struct evsrv_resp_arg));
+    if (spans == NULL || argv == NULL) {
+        free(spans);
+        free(argv);
+        return -1;
+    }
+    memcpy(spans, self->spans, self->nargs * sizeof(struct evsrv_resp_span));
+    if (self->spans != self->spans_inline) {
+        free(self->spans);
+        free(self->argv);
+    }
+    self->spans = spans;
+    self->argv = argv;
+    self->args_cap = cap;
+    return 0;
+}
+
+// without an explicit limit an argument has to fit the largest buffer the connection may get
+static inline size_t _evsrv_resp_bulk_limit(evsrv_resp_conn* self) {
+    if (self->max_bulk > 0) {
+        return self->max_bulk;
+    }
+    evsrv_conn* conn = &self->conn;
+    return conn->rmode != EVSRV_RBUF_USER && conn->srv->rbuf_max > conn->rlen ? conn->srv->rbuf_max : conn->rlen;
+}
+
+// parses "<n>\r\n" of a header starting at p, returns bytes taken, 0 when incomplete and -1 when malformed
+static ssize_t _evsrv_resp_header(const char* p, size_t avail, int64_t* value) {
+    const char* cr = (const char*) memchr(p, '\r', avail);
+    if (cr == NULL) {
+        return avail > 21 ? -1 : 0;
+    }
+    if ((size_t) (cr - p) + 1 >= avail) {
+        return 0;
+    }
+    if (cr[1] != '\n' || cr == p) {
+        return -1;
+    }
+
+    const char* d = p;
+    bool neg = *d == '-';
+    if (neg) {
+        ++d;
+    }
+    if (d == cr || cr - d > 18) {
+        return -1;
+    }
+    int64_t v = 0;
+    for (; d < cr; ++d) {
+        if (*d < '0' || *d > '9') {
+            return -1;
+        }
+        v = v * 10 + (*d - '0');
+    }
+    *value = neg ? -v : v;
+    return cr + 2 - p;
+}
+
+static int _evsrv_resp_error(evsrv_resp_conn* self, const char* msg) {
+    char err[128];
+    int len = snprintf(err, sizeof(err), "ERR Protocol error: %s", msg);
+    evsrv_resp_write_error(self, err, (size_t) len);
+    return -1;
+}
+
+// splits an inline command by spaces, quoting is not supported
+static int _evsrv_resp_parse_inline(evsrv_resp_conn* self, const char* cmd, size_t avail) {
+    const char* nl = (const char*) memchr(cmd + self->parsed, '\n', avail - self->parsed);
+    if (nl == NULL) {
+        self->parsed = avail;
+        if (avail > EVSRV_RESP_MAX_INLINE) {
+            return _evsrv_resp_error(self, "too big inline request");
+        }
+        return 0;
+    }
+    size_t end = (size_t) (nl - cmd);
+    size_t line = end > 0 && cmd[end - 1] == '\r' ? end - 1 : end;
+
+    self->nargs = 0;
+    for (size_t i = 0; i < line;) {
+        while (i < line && (cmd[i] == ' ' || cmd[i] == '\t')) {
+            ++i;
+        }
+        if (i == line) {
+            break;
+        }
+        size_t from = i;
+        while (i < line && cmd[i] != ' ' && cmd[i] != '\t') {
+            ++i;
+        }
+        if (self->nargs == self->max_args) {
+            return _evsrv_resp_error(self, "too many arguments");
+        }
+        if (_evsrv_resp_args_reserve(self, self->nargs + 1) < 0) {
+            return _evsrv_resp_error(self, "out of memory");
+        }
+        self->spans[self->nargs].off = from;
+        self->spans[self->nargs].len = i - from;
+        ++self->nargs;
+    }
+    self->parsed = end + 1;
+    self->argc = (int64_t) self->nargs;
+    return 1;
+}
+
+// returns 1 once the command is complete, 0 when more data is needed and -1 on protocol errors
+static int _evsrv_resp_parse(evsrv_resp_conn* self, const char* cmd, size_t avail) {
+    if (self->argc < 0) {
+        if (avail == 0) {
+            return 0;
+        }
+        if (cmd[0] != '*') {
+            return _evsrv_resp_parse_inline(self, cmd, avail);
+        }
+        int64_t argc;
+        ssize_t taken = _evsrv_resp_header(cmd + 1, avail - 1, &argc);
+        if (taken <= 0) {
+            return taken == 0 ? 0 : _evsrv_resp_error(self, "invalid multibulk length");
+        }
+        if (argc > (int64_t) self->max_args) {
+            return _evsrv_resp_error(self, "invalid multibulk length");
+        }
+        // the count is only announced, arrays grow with the arguments beyond a few preallocated
+        size_t reserve = argc > EVSRV_RESP_PREALLOC_ARGS ? EVSRV_RESP_PREALLOC_ARGS : argc > 0 ? (size_t) argc : 0;
+        if (_evsrv_resp_args_reserve(self, reserve) < 0) {
+            return _evsrv_resp_error(self, "out of memory");
+        }
+        self->parsed = 1 + (size_t) taken;
+        self->argc = argc > 0 ? argc : 0;
+    }
+
+    while ((int64_t) self->nargs < self->argc) {
+        if (self->bulk < 0) {
+            if (self->parsed == avail) {
+                return 0;
+            }
+            if (cmd[self->parsed] != '$') {
+                char msg[32];
+                snprintf(msg, sizeof(msg), "expected '$', got '%c'", cmd[self->parsed]);
+                return _evsrv_resp_error(self, msg);
+            }
+            int64_t bulk;
+            ssize_t taken = _evsrv_resp_header(cmd + self->parsed + 1, avail - self->parsed - 1, &bulk);
+            if (taken <= 0) {
+                return taken == 0 ? 0 : _evsrv_resp_error(self, "invalid bulk length");
+            }
+            if (bulk < 0 || (uint64_t) bulk > _evsrv_resp_bulk_limit(self)) {
+                return _evsrv_resp_error(self, "invalid bulk length");
+            }
+            if (_evsrv_resp_args_reserve(self, self->nargs + 1) < 0) {
+                return _evsrv_resp_error(self, "out of memory");
+            }
+            self->parsed += 1 + (size_t) taken;
+            self->bulk = bulk;
+        }
+
+        size_t bulk = (size_t) self->bulk;
+        if (avail - self->parsed < bulk + 2) {
+            return 0;
+        }
+        if (cmd[self->parsed + bulk] != '\r' || cmd[self->parsed + bulk + 1] != '\n') {
+            return _evsrv_resp_error(self, "bulk is not terminated by CRLF");
+        }
+        self->spans[self->nargs].off = self->parsed;
+        self->spans[self->nargs].len = bulk;
+        ++self->nargs;
+        self->parsed += bulk + 2;
+        self->bulk = -1;
+    }
+    return 1;
+}
+
+// handles all the complete commands of rbuf, replies are corked until the last of them is handled
+void _evsrv_resp_on_read(evsrv_conn* conn, ssize_t nread) {
+    if (nread == 0) {
+        return;
+    }
+    evsrv_resp_conn* self = (evsrv_resp_conn*) conn;
+    if (self->closing) {
+        conn->ruse = 0; // the connection is ending
+        return;
+    }
+    evsrv* srv = conn->srv;
+    char* buf = conn->rbuf;
+    size_t start = 0;
+    size_t handled = 0;
+    bool wcork = conn->wcork;
+    conn->wcork = true;
+
+    while (!self->closing && conn->dto.deadline == 0) {
+        int rc = _evsrv_resp_parse(self, buf + start, conn->ruse - start);
+        if (rc == 0) {
+            break;
+        }
+        if (rc < 0) {
+            self->closing = true; // after the error reply
+            break;
+        }
+
+        if (self->max_commands > 0 && handled == self->max_commands) {
+            _evsrv_resp_reset(self); // parsed once more on resume
+            evsrv_conn_defer(conn);
+            break;
+        }
+        int argc = (int) self->nargs;
+        for (int i = 0; i < argc; ++i) {
+            self->argv[i].ptr = buf + start + self->spans[i].off;
+            self->argv[i].len = self->spans[i].len;
+        }
+        start += self->parsed;
+        _evsrv_resp_reset(self);
+        if (argc > 0) {
+            ++handled;
+            struct evsrv_conn_watch watch;
+            evsrv_conn_watch(conn, &watch);
+            self->on_command(self, argc, self->argv);
+            if (evsrv_conn_unwatch(srv, &watch)) {
+                return; // closed by on_command, the connection may be gone
+            }
+            if (conn->wend) {
+                self->closing = true; // ended by on_command
+            }
+        }
+    }
+
+    conn->wcork = wcork;
+    if (self->closing) {
+        conn->ruse = 0;
+        evsrv_conn_end(conn);
+    } else if (start > 0) {
+        size_t left = conn->ruse - start;
+        if (left > 0) {
+            memmove(buf, buf + start, left);
+        }
+        conn->ruse = left;
+    }
+    if (!wcork && conn->whead != NULL) {
+        evsrv_conn_flush(conn); // may close the connection
+    }
+}
+
+/*************************** encoder ***************************/
+
+static inline size_t _evsrv_resp_u64(char* p, uint64_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (size_t i = 0; i < n; ++i) {
+        p[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+// writes "<type><value>\r\n"
+static void _evsrv_resp_write_header(evsrv_resp_conn* self, char type, int64_t value) {
+    char hdr[24];
+    size_t n = 0;
+    hdr[n++] = type;
+    if (value < 0) {
+        hdr[n++] = '-';
+        n += _evsrv_resp_u64(hdr + n, (uint64_t) 0 - (uint64_t) value);
+    } else {
+        n += _evsrv_resp_u64(hdr + n, (uint64_t) value);
+    }
+    hdr[n++] = '\r';
+    hdr[n++] = '\n';
+    evsrv_conn_write(&self->conn, hdr, n);
+}
+
+static void _evsrv_resp_write_line(evsrv_resp_conn* self, char type, const char* str, size_t len) {
+    if (len == 0) {
+        len = strlen(str);
+    }
+    char line[EVSRV_RESP_SMALL_REPLY];
+    if (len + 3 <= sizeof(line)) {
+        line[0] = type;
+        memcpy(line + 1, str, len);
+        line[len + 1] = '\r';
+        line[len + 2] = '\n';
+        evsrv_conn_write(&self->conn, line, len + 3);
+        return;
+    }
+    evsrv_conn_write(&self->conn, &type, 1);
+    evsrv_conn_write(&self->conn, str, len);
+    evsrv_conn_write(&self->conn, "\r\n", 2);
+}
+
+// str may hold no CR or LF, len of 0 takes strlen(str)
+void evsrv_resp_write_simple(evsrv_resp_conn* self, const char* str, size_t len) {
+    _evsrv_resp_write_line(self, '+', str, len);
+}
+
+void evsrv_resp_write_error(evsrv_resp_conn* self, const char* str, size_t len) {
+    _evsrv_resp_write_line(self, '-', str, len);
+}
+
+void evsrv_resp_write_int(evsrv_resp_conn* self, int64_t value) {
+    _evsrv_resp_write_header(self, ':', value);
+}
+
+void evsrv_resp_write_bulk(evsrv_resp_conn* self, const void* data, size_t len) {
+    char reply[EVSRV_RESP_SMALL_REPLY];
+    if (len + 26 <= sizeof(reply)) {
+        size_t n = 0;
+        reply[n++] = '$';
+        n += _evsrv_resp_u64(reply + n, len);
+        reply[n++] = '\r';
+        reply[n++] = '\n';
+        memcpy(reply + n, data, len);
+        n += len;
+        reply[n++] = '\r';
+        reply[n++] = '\n';
+        evsrv_conn_write(&self->conn, reply, n);
+        return;
+    }
+    _evsrv_resp_write_header(self, '$', (int64_t) len);
+    evsrv_conn_write(&self->conn, data, len);
+    evsrv_conn_write(&self->conn, "\r\n", 2);
+}
+
+void evsrv_resp_write_null(evsrv_resp_conn* self) {
+    if (self->proto >= 3) {
+        evsrv_conn_write(&self->conn, "_\r\n", 3);
+    } else {
+        evsrv_conn_write(&self->conn, "$-1\r\n", 5);
+    }
+}
+
+void evsrv_resp_write_array(evsrv_resp_conn* self, size_t count) {
+    _evsrv_resp_write_header(self, '*', (int64_t) count);
+}
+
+// RESP2 gets a flat array of keys and values
+void evsrv_resp_write_map(evsrv_resp_conn* self, size_t count) {
+    if (self->proto >= 3) {
+        _evsrv_resp_write_header(self, '%', (int64_t) count);
+    } else {
+        _evsrv_resp_write_header(self, '*', (int64_t) count * 2);
+    }
+}
+
+void evsrv_resp_write_bool(evsrv_resp_conn* self, bool value) {
+    if (self->proto >= 3) {
+        evsrv_conn_write(&self->conn, value ? "#t\r\n" : "#f\r\n", 4);
+    } else {
+        evsrv_conn_write(&self->conn, value ? ":1\r\n" : ":0\r\n", 4);
+    }
+}
+
+// RESP2 gets a bulk string
+void evsrv_resp_write_double(evsrv_resp_conn* self, double value) {
+    char num[32];
+    int len = snprintf(num, sizeof(num), "%.17g", value);
+    if (self->proto >= 3) {
+        _evsrv_resp_write_line(self, ',', num, (size_t) len);
+    } else {
+        evsrv_resp_write_bulk(self, num, (size_t) len);
+    }
+}
@@ -0,0 +1,137 @@
+#include "evsrv_scan.h"
+
+#include <string.h>
+
+#if EVSRV_USE_SIMD && defined(__x86_64__)
+#  define EVSRV_SCAN_X86 1
+#  include <immintrin.h>
+#else
+#  define EVSRV_SCAN_X86 0
+#endif
+
+typedef size_t (* evsrv_scan_fn)(const char*, size_t, size_t, const char*, size_t, uint32_t*, size_t);
+
+static size_t _evsrv_scan_pick(const char* buf, size_t from, size_t len, const char* delim, size_t delim_len,
+                               uint32_t* pos, size_t max);
+
+static evsrv_scan_fn _evsrv_scan_impl = _evsrv_scan_pick;
+static const char* _evsrv_scan_name = "scalar";
+
+/*************************** evsrv_scan ***************************/
+
+static size_t _evsrv_scan_scalar(const char* buf, size_t from, size_t len, const char* delim, size_t delim_len,
+                                 uint32_t* pos, size_t max) {
+    if (len < delim_len) {
+        return 0;
+    }
+    size_t last = len - delim_len; // last offset a delimiter may start at
+    size_t n = 0;
+    for (size_t i = from; i <= last && n < max; ++i) {
+        const char* found = (const char*) memchr(buf + i, delim[0], last - i + 1);
+        if (found == NULL) {
+            break;
+        }
+        i = (size_t) (found - buf);
+        if (memcmp(found + 1, delim + 1, delim_len - 1) == 0) {
+            pos[n++] = (uint32_t) i;
+        }
+    }
+    return n;
+}
+
+#if EVSRV_SCAN_X86
+
+// a block matches where both the first two delimiter bytes do, longer delimiters are checked byte by byte
+#define _evsrv_scan_block_matches(mask, i) do { \
+    while (mask) { \
+        size_t at = (i) + (size_t) __builtin_ctz(mask); \
+        mask &= mask - 1; \
+        if (delim_len <= 2 || (at <= last && memcmp(buf + at + 2, delim + 2, delim_len - 2) == 0)) { \
+            pos[n++] = (uint32_t) at; \
+            if (n == max) { \
+                return n; \
+            } \
+        } \
+    } \
+} while (0)
+
+static size_t _evsrv_scan_sse2(const char* buf, size_t from, size_t len, const char* delim, size_t delim_len,
+                               uint32_t* pos, size_t max) {
+    if (len < delim_len || max == 0) {
+        return 0;
+    }
+    size_t last = len - delim_len;
+    size_t second = delim_len > 1; // the second byte is compared in a block loaded one byte further
+    __m128i d0 = _mm_set1_epi8(delim[0]);
+    __m128i d1 = _mm_set1_epi8(delim[second]);
+    size_t n = 0;
+    size_t i = from;
+    for (; i + 16 + second <= len; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (buf + i)), d0);
+        if (second) {
+            eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (buf + i + 1)), d1));
+        }
+        unsigned mask = (unsigned) _mm_movemask_epi8(eq);
+        _evsrv_scan_block_matches(mask, i);
+    }
+    return n + _evsrv_scan_scalar(buf, i, len, delim, delim_len, pos + n, max - n);
+}
+
+__attribute__((target("avx2")))
+static size_t _evsrv_scan_avx2(const char* buf, size_t from, size_t len, const char* delim, size_t delim_len,
+                               uint32_t* pos, size_t max) {
+    if (len < delim_len || max == 0) {
+        return 0;
+    }
+    size_t last = len - delim_len;
+    size_t second = delim_len > 1;
+    __m256i d0 = _mm256_set1_epi8(delim[0]);
+    __m256i d1 = _mm256_set1_epi8(delim[second]);
+    size_t n = 0;
+    size_t i = from;
+    for (; i + 32 + second <= len; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (buf + i)), d0);
+        if (second) {
+            eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (buf + i + 1)), d1));
+        }
+        unsigned mask = (unsigned) _mm256_movemask_epi8(eq);
+        _evsrv_scan_block_matches(mask, i);
+    }
+    return n + _evsrv_scan_sse2(buf, i, len, delim, delim_len, pos + n, max - n);
+}
+
+#endif // EVSRV_SCAN_X86
+
+// every thread picks the same implementation, so racing first calls are harmless
+size_t _evsrv_scan_pick(const char* buf, size_t from, size_t len, const char* delim, size_t delim_len,
+                        uint32_t* pos, size_t max) {
+    evsrv_scan_fn impl = _evsrv_scan_scalar;
+    const char* name = "scalar";
+#if EVSRV_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impl = _evsrv_scan_avx2;
+        name = "avx2";
+    } else {
+        impl = _evsrv_scan_sse2;
+        name = "sse2";
+    }
+#endif
+    __atomic_store_n(&_evsrv_scan_name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&_evsrv_scan_impl, impl, __ATOMIC_RELAXED);
+    return impl(buf, from, len, delim, delim_len, pos, max);
+}
+
+size_t evsrv_scan(const char* buf, size_t from, size_t len, const char* delim, size_t delim_len,
+                  uint32_t* pos, size_t max) {
+    evsrv_scan_fn impl = __atomic_load_n(&_evsrv_scan_impl, __ATOMIC_RELAXED);
+    return impl(buf, from, len, delim, delim_len, pos, max);
+}
+
+// name of the implementation in use: "avx2", "sse2" or "scalar"
+const char* evsrv_scan_isa(void) {
+    if (__atomic_load_n(&_evsrv_scan_impl, __ATOMIC_RELAXED) == _evsrv_scan_pick) {
+        _evsrv_scan_pick("", 0, 0, "\n", 1, NULL, 0);
+    }
+    return __atomic_load_n(&_evsrv_scan_name, __ATOMIC_RELAXED);
+}
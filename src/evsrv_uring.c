@@ -0,0 +1,332 @@
+#include "evsrv_uring.h"
+#include "util.h"
+
+#if EVSRV_USE_URING
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static void _evsrv_uring_read_cb(struct ev_loop* loop, ev_io* w, int revents);
+static void _evsrv_uring_submit_cb(struct ev_loop* loop, ev_prepare* w, int revents);
+
+#define _evsrv_uring_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define _evsrv_uring_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static inline int _evsrv_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int _evsrv_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int _evsrv_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*************************** evsrv_uring ***************************/
+
+static int _evsrv_uring_init_bufs(evsrv_uring* self, unsigned bufs_count, unsigned buf_len) {
+    self->bufs_count = bufs_count;
+    self->buf_len = buf_len;
+    self->bgid = 0;
+
+    self->br_len = bufs_count * sizeof(struct io_uring_buf);
+    self->br = (struct io_uring_buf_ring*) mmap(NULL, self->br_len, PROT_READ | PROT_WRITE,
+                                                MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (self->br == MAP_FAILED) {
+        self->br = NULL;
+        cerror("Could not allocate io_uring buffer ring");
+        return -1;
+    }
+
+    self->bufs = (char*) malloc((size_t) bufs_count * buf_len);
+    if (self->bufs == NULL) {
+        cerror("Could not allocate io_uring buffers");
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) self->br;
+    reg.ring_entries = bufs_count;
+    reg.bgid = self->bgid;
+    if (_evsrv_uring_register(self->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        cerror("Could not register io_uring buffer ring");
+        return -1;
+    }
+
+    self->br->tail = 0;
+    for (unsigned i = 0; i < bufs_count; ++i) {
+        evsrv_uring_buf_recycle(self, (uint16_t) i);
+    }
+    return 0;
+}
+
+// the engine relies on multishot accept and receive (Linux 6.0), older kernels set the ring and the buffers up,
+// but fail the requests. The operations are probed and a receive is tried on a socketpair
+static int _evsrv_uring_probe(evsrv_uring* self) {
+    size_t len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*) calloc(1, len);
+    if (probe == NULL) {
+        cerror("Could not allocate io_uring probe");
+        return -1;
+    }
+    static const int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ASYNC_CANCEL };
+    bool supported = _evsrv_uring_register(self->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) >= 0;
+    for (size_t i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); ++i) {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if (!supported) {
+        cerror("io_uring of this kernel lacks required operations");
+        return -1;
+    }
+
+    // a byte followed by EOF: a multishot receive completes with more to come, then ends
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        cerror("Could not create io_uring probe sockets");
+        return -1;
+    }
+    bool written = write(sv[1], "p", 1) == 1;
+    close(sv[1]);
+    struct io_uring_sqe* sqe = written ? evsrv_uring_get_sqe(self) : NULL;
+    if (sqe == NULL) {
+        close(sv[0]);
+        cerror("Could not queue io_uring probe");
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sv[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = self->bgid;
+    int rc = evsrv_uring_submit(self) == 0 && self->sq_pending == 0 ? 0 : -1;
+
+    bool more = rc == 0;
+    while (more) {
+        unsigned head = *self->cq_head;
+        if (head == _evsrv_uring_load(self->cq_tail)) {
+            if (_evsrv_uring_enter(self->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                rc = -1;
+                break;
+            }
+            continue;
+        }
+        struct io_uring_cqe cqe = self->cqes[head & self->cq_mask];
+        _evsrv_uring_store(self->cq_head, head + 1);
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            evsrv_uring_buf_recycle(self, (uint16_t) (cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        if (cqe.res < 0) {
+            errno = -cqe.res;
+            rc = -1;
+        }
+        more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+    }
+    close(sv[0]);
+    if (rc < 0) {
+        cerror("io_uring of this kernel has no multishot receive");
+        return -1;
+    }
+    return 0;
+}
+
+int evsrv_uring_init(struct ev_loop* loop, evsrv_uring* self, unsigned entries, unsigned bufs_count, unsigned buf_len) {
+    memset(self, 0, sizeof(*self));
+    self->loop = loop;
+    self->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4; // multishot requests produce many completions per submission
+
+    self->fd = _evsrv_uring_setup(entries, &p);
+    if (self->fd < 0) {
+        cerror("Could not set up io_uring");
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cerror("io_uring of this kernel is too old");
+        evsrv_uring_destroy(self);
+        return -1;
+    }
+
+    self->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    self->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (self->cq_ring_len > self->sq_ring_len) {
+        self->sq_ring_len = self->cq_ring_len;
+    }
+    self->cq_ring_len = self->sq_ring_len;
+
+    self->sq_ring = mmap(NULL, self->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         self->fd, IORING_OFF_SQ_RING);
+    if (self->sq_ring == MAP_FAILED) {
+        self->sq_ring = NULL;
+        cerror("Could not map io_uring rings");
+        evsrv_uring_destroy(self);
+        return -1;
+    }
+    self->cq_ring = self->sq_ring;
+
+    self->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    self->sqes = (struct io_uring_sqe*) mmap(NULL, self->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                             self->fd, IORING_OFF_SQES);
+    if (self->sqes == MAP_FAILED) {
+        self->sqes = NULL;
+        cerror("Could not map io_uring sqes");
+        evsrv_uring_destroy(self);
+        return -1;
+    }
+
+    char* sq = (char*) self->sq_ring;
+    self->sq_head = (unsigned*) (sq + p.sq_off.head);
+    self->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    self->sq_mask = *(unsigned*) (sq + p.sq_off.ring_mask);
+    self->sq_array = (unsigned*) (sq + p.sq_off.array);
+
+    char* cq = (char*) self->cq_ring;
+    self->cq_head = (unsigned*) (cq + p.cq_off.head);
+    self->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    self->cq_mask = *(unsigned*) (cq + p.cq_off.ring_mask);
+    self->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    if (_evsrv_uring_init_bufs(self, bufs_count, buf_len) < 0) {
+        evsrv_uring_destroy(self);
+        return -1;
+    }
+
+    ev_prepare_init(&self->submit_w, _evsrv_uring_submit_cb);
+    ev_set_priority(&self->submit_w, EV_MINPRI); // after the prepare watchers that queue requests
+    int rc = _evsrv_uring_probe(self);
+    if (ev_is_active(&self->submit_w)) {
+        ev_prepare_stop(loop, &self->submit_w);
+    }
+    if (rc < 0) {
+        evsrv_uring_destroy(self);
+        return -1;
+    }
+
+    ev_io_init(&self->rw, _evsrv_uring_read_cb, self->fd, EV_READ);
+    ev_io_start(loop, &self->rw);
+    return 0;
+}
+
+void evsrv_uring_destroy(evsrv_uring* self) {
+    if (self->loop) {
+        evsrv_stop_io(self->loop, &self->rw);
+        if (ev_is_active(&self->submit_w)) {
+            ev_prepare_stop(self->loop, &self->submit_w);
+        }
+    }
+    if (self->fd > -1) {
+        close(self->fd); // cancels everything in flight
+        self->fd = -1;
+    }
+    if (self->sqes) {
+        munmap(self->sqes, self->sqes_len);
+        self->sqes = NULL;
+    }
+    if (self->sq_ring) {
+        munmap(self->sq_ring, self->sq_ring_len);
+        self->sq_ring = NULL;
+        self->cq_ring = NULL;
+    }
+    if (self->br) {
+        munmap(self->br, self->br_len);
+        self->br = NULL;
+    }
+    free(self->bufs);
+    self->bufs = NULL;
+}
+
+struct io_uring_sqe* evsrv_uring_get_sqe(evsrv_uring* self) {
+    unsigned tail = *self->sq_tail;
+    if (tail - _evsrv_uring_load(self->sq_head) > self->sq_mask) {
+        // submission queue is full, hand it over to the kernel right away
+        if (evsrv_uring_submit(self) < 0 || tail - _evsrv_uring_load(self->sq_head) > self->sq_mask) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe* sqe = &self->sqes[tail & self->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    self->sq_array[tail & self->sq_mask] = tail & self->sq_mask;
+    _evsrv_uring_store(self->sq_tail, tail + 1);
+    ++self->sq_pending;
+
+    if (!ev_is_active(&self->submit_w)) {
+        ev_prepare_start(self->loop, &self->submit_w);
+    }
+    return sqe;
+}
+
+unsigned evsrv_uring_sq_space(evsrv_uring* self) {
+    return self->sq_mask + 1 - (*self->sq_tail - _evsrv_uring_load(self->sq_head));
+}
+
+int evsrv_uring_submit(evsrv_uring* self) {
+    while (self->sq_pending > 0) {
+        int rc = _evsrv_uring_enter(self->fd, self->sq_pending, 0, 0);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EBUSY) {
+                return 0; // completions have to be reaped first, retried on the next iteration
+            }
+            cerror("io_uring submit failed");
+            return -1;
+        }
+        self->sq_pending -= (unsigned) rc;
+    }
+    return 0;
+}
+
+char* evsrv_uring_buf(evsrv_uring* self, uint16_t bid) {
+    return self->bufs + (size_t) bid * self->buf_len;
+}
+
+void evsrv_uring_buf_recycle(evsrv_uring* self, uint16_t bid) {
+    uint16_t tail = self->br->tail;
+    struct io_uring_buf* buf = &self->br->bufs[tail & (self->bufs_count - 1)];
+    buf->addr = (uint64_t) (uintptr_t) evsrv_uring_buf(self, bid);
+    buf->len = self->buf_len;
+    buf->bid = bid;
+    _evsrv_uring_store(&self->br->tail, (uint16_t) (tail + 1));
+}
+
+void _evsrv_uring_read_cb(struct ev_loop* loop, ev_io* w, int revents) {
+    if (EV_ERROR & revents) {
+        cerror("error occured");
+        return;
+    }
+    evsrv_uring* self = SELFby(w, evsrv_uring, rw);
+
+    unsigned head = *self->cq_head;
+    unsigned tail = _evsrv_uring_load(self->cq_tail);
+    while (head != tail) {
+        struct io_uring_cqe cqe = self->cqes[head & self->cq_mask];
+        _evsrv_uring_store(self->cq_head, ++head); // the slot is free for the kernel before the handler runs
+        if (self->on_cqe) {
+            self->on_cqe(self, &cqe);
+        }
+        if (head == tail) {
+            tail = _evsrv_uring_load(self->cq_tail);
+        }
+    }
+}
+
+void _evsrv_uring_submit_cb(struct ev_loop* loop, ev_prepare* w, int revents) {
+    evsrv_uring* self = SELFby(w, evsrv_uring, submit_w);
+    evsrv_uring_submit(self);
+    if (self->sq_pending == 0) {
+        ev_prepare_stop(loop, w);
+    }
+}
+
+#endif // EVSRV_USE_URING
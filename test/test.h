@@ -0,0 +1,109 @@
+#ifndef LIBEVSERVER_TEST_H
+#define LIBEVSERVER_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "evsrv.h"
+
+// Tests are plain programs failing with a non-zero exit code. Connections are socketpairs handed to
+// the server with evsrv_add_conn, so no port is needed, and the test talks to the other end.
+
+#define check(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+
+// returns the peer's end of a new connection of srv
+static inline int test_conn(evsrv* srv) {
+    int sv[2];
+    check(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    struct evsrv_conn_info info;
+    memset(&info, 0, sizeof(info));
+    info.sock = sv[0];
+    evsrv_add_conn(srv, &info);
+    return sv[1];
+}
+
+struct test_wait {
+    ev_timer timer;
+    bool (* done)(void* arg);
+    void* arg;
+    int ticks;
+};
+
+static inline void _test_wait_cb(struct ev_loop* loop, ev_timer* w, int revents) {
+    struct test_wait* self = (struct test_wait*) w;
+    if (self->done(self->arg) || --self->ticks == 0) {
+        ev_timer_stop(loop, w);
+        ev_break(loop, EVBREAK_ONE);
+    }
+}
+
+// runs the loop until done returns true, for at most two seconds, returns what done says then
+static inline bool test_run(struct ev_loop* loop, bool (* done)(void*), void* arg) {
+    struct test_wait wait = { .done = done, .arg = arg, .ticks = 400 };
+    ev_timer_init(&wait.timer, _test_wait_cb, 0.005, 0.005);
+    ev_timer_start(loop, &wait.timer);
+    ev_run(loop, 0);
+    ev_timer_stop(loop, &wait.timer);
+    return done(arg);
+}
+
+struct test_peer {
+    int fd;
+    char* buf;
+    size_t cap;
+    size_t len;
+    bool eof;
+};
+
+static inline bool _test_peer_read(void* arg) {
+    struct test_peer* self = (struct test_peer*) arg;
+    while (self->len < self->cap) {
+        ssize_t n = recv(self->fd, self->buf + self->len, self->cap - self->len, MSG_DONTWAIT);
+        if (n <= 0) {
+            self->eof = n == 0 || (errno != EAGAIN && errno != EINTR);
+            break;
+        }
+        self->len += (size_t) n;
+    }
+    return self->eof || self->len == self->cap;
+}
+
+// reads on the peer's end until len bytes arrive or the connection is ended, running the loop
+// meanwhile. Returns the bytes read, eof tells whether the server is done sending
+static inline size_t test_read(struct ev_loop* loop, int fd, char* buf, size_t len, bool* eof) {
+    struct test_peer peer = { .fd = fd, .buf = buf, .cap = len };
+    test_run(loop, _test_peer_read, &peer);
+    if (eof != NULL) {
+        *eof = peer.eof;
+    }
+    return peer.len;
+}
+
+// sends the request and expects exactly the reply, end tells whether the server has to be done sending
+static inline void test_exchange(struct ev_loop* loop, int fd, const char* req, const char* reply, bool end) {
+    size_t len = strlen(req);
+    check(write(fd, req, len) == (ssize_t) len);
+    char buf[4096];
+    size_t want = strlen(reply);
+    bool eof;
+    size_t got = test_read(loop, fd, buf, end ? sizeof(buf) - 1 : want, &eof);
+    buf[got] = '\0';
+    if (got != want || memcmp(buf, reply, want) != 0) {
+        fprintf(stderr, "expected \"%s\", got \"%s\"\n", reply, buf);
+    }
+    check(got == want && memcmp(buf, reply, want) == 0);
+    check(eof == end);
+}
+
+#endif //LIBEVSERVER_TEST_H
@@ -0,0 +1,83 @@
+#include <unistd.h>
+#include <string.h>
+
+#include "test.h"
+
+// on_read closing its connection must be the last thing touching it: the connection is back in the
+// server's pool by the time on_read returns
+
+#define CONNS 64
+
+static int reads;
+static int eofs;
+
+static bool all_closed(void* arg) {
+    return ((evsrv*) arg)->active_connections == 0;
+}
+
+static void close_on_data(evsrv_conn* conn, ssize_t nread) {
+    if (nread > 0) {
+        ++reads;
+        evsrv_conn_close(conn, 0);
+    }
+}
+
+static void close_on_eof(evsrv_conn* conn, ssize_t nread) {
+    if (nread == 0) {
+        ++eofs;
+        evsrv_conn_close(conn, 0);
+    }
+}
+
+static void defer_then_close(evsrv_conn* conn, ssize_t nread) {
+    if (nread == EVSRV_READ_RESUMED) {
+        ++reads;
+        evsrv_conn_close(conn, 0);
+    } else if (nread > 0) {
+        conn->ruse = 0;
+        evsrv_conn_defer(conn);
+    }
+}
+
+static void run(enum evsrv_conn_rbuf_mode mode, evsrv_on_read_cb on_read, bool eof) {
+    struct ev_loop* loop = EV_DEFAULT;
+    evsrv srv;
+    evsrv_init(loop, &srv, "127.0.0.1", "0");
+    evsrv_set_on_read(&srv, on_read);
+    srv.rbuf_mode = mode;
+
+    int peers[CONNS];
+    for (int i = 0; i < CONNS; ++i) {
+        peers[i] = test_conn(&srv);
+        check(write(peers[i], "0123456789", 10) == 10);
+        if (eof) {
+            shutdown(peers[i], SHUT_WR);
+        }
+    }
+    check(srv.active_connections == CONNS);
+    check(test_run(loop, all_closed, &srv));
+
+    char buf[16];
+    for (int i = 0; i < CONNS; ++i) {
+        check(read(peers[i], buf, sizeof(buf)) == 0); // closed, nothing was written
+        close(peers[i]);
+    }
+    evsrv_destroy(&srv);
+}
+
+int main() {
+    enum evsrv_conn_rbuf_mode modes[] = { EVSRV_RBUF_POOLED, EVSRV_RBUF_LAZY };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        reads = eofs = 0;
+        run(modes[i], close_on_data, false);
+        check(reads == CONNS);
+
+        run(modes[i], close_on_eof, true);
+        check(eofs == CONNS);
+
+        reads = 0;
+        run(modes[i], defer_then_close, false);
+        check(reads == CONNS);
+    }
+    return EXIT_SUCCESS;
+}
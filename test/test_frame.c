@@ -0,0 +1,199 @@
+#include <unistd.h>
+#include <string.h>
+
+#include "test.h"
+
+// frames seen by on_frame, joined with '|'
+static char seen[16 * 1024];
+static size_t seen_len;
+static int frames;
+static int close_after;             // on_frame closes the connection every close_after frames
+
+static void on_frame(evsrv_conn* conn, char* frame, size_t len) {
+    check(seen_len + len + 1 < sizeof(seen));
+    memcpy(seen + seen_len, frame, len);
+    seen_len += len;
+    seen[seen_len++] = '|';
+    seen[seen_len] = '\0';
+    if (++frames % close_after == 0) {
+        evsrv_conn_close(conn, 0);
+    }
+}
+
+static int want;
+
+static bool frames_seen(void* arg) {
+    return frames >= want;
+}
+
+static bool all_closed(void* arg) {
+    return ((evsrv*) arg)->active_connections == 0;
+}
+
+static void setup(evsrv* srv) {
+    evsrv_init(EV_DEFAULT, srv, "127.0.0.1", "0");
+    seen_len = 0;
+    seen[0] = '\0';
+    frames = 0;
+    close_after = INT32_MAX;
+}
+
+// sends data in parts, waiting for the frames each part completes
+static void send_parts(evsrv* srv, int peer, const char* const* parts, const int* frames_after, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        size_t len = strlen(parts[i]);
+        check(write(peer, parts[i], len) == (ssize_t) len);
+        want = frames_after[i];
+        check(test_run(srv->loop, frames_seen, NULL));
+        check(frames == frames_after[i]);
+    }
+}
+
+static void test_fixed() {
+    evsrv srv;
+    setup(&srv);
+    check(evsrv_framing_set_fixed(&srv.framing, 4, on_frame) == 0);
+    int peer = test_conn(&srv);
+
+    const char* parts[] = { "abcdef", "gh", "ijklmnop" };
+    int after[] = { 1, 2, 4 };
+    send_parts(&srv, peer, parts, after, 3);
+    check(strcmp(seen, "abcd|efgh|ijkl|mnop|") == 0);
+    close(peer);
+    evsrv_destroy(&srv);
+}
+
+static void test_prefix() {
+    evsrv srv;
+    setup(&srv);
+    check(evsrv_framing_set_prefix(&srv.framing, 2, true, on_frame) == 0);
+    int peer = test_conn(&srv);
+
+    const char* parts[] = { "\0", "\3abc\0\0\0\2x", "y" };
+    size_t lens[] = { 1, 9, 1 };
+    int after[] = { 0, 2, 3 };
+    for (size_t i = 0; i < 3; ++i) {
+        check(write(peer, parts[i], lens[i]) == (ssize_t) lens[i]);
+        want = after[i];
+        test_run(srv.loop, frames_seen, NULL);
+        check(frames == after[i]);
+    }
+    check(strcmp(seen, "abc||xy|") == 0);
+    close(peer);
+    evsrv_destroy(&srv);
+
+    // little endian, 4 byte prefix
+    setup(&srv);
+    check(evsrv_framing_set_prefix(&srv.framing, 4, false, on_frame) == 0);
+    peer = test_conn(&srv);
+    check(write(peer, "\5\0\0\0hello", 9) == 9);
+    want = 1;
+    check(test_run(srv.loop, frames_seen, NULL));
+    check(strcmp(seen, "hello|") == 0);
+    close(peer);
+    evsrv_destroy(&srv);
+}
+
+// the limit covers the prefix: a frame has to fit the buffer along with its prefix
+static void test_prefix_limit() {
+    evsrv srv;
+    setup(&srv);
+    check(evsrv_framing_set_prefix(&srv.framing, 2, true, on_frame) == 0);
+    evsrv_framing_set_limits(&srv.framing, 10, 0);
+    int peer = test_conn(&srv);
+    check(write(peer, "\0\x08" "12345678", 10) == 10);
+    want = 1;
+    check(test_run(srv.loop, frames_seen, NULL));
+    check(srv.active_connections == 1);
+
+    check(write(peer, "\0\x09" "123456789", 11) == 11);
+    check(test_run(srv.loop, all_closed, &srv));
+    check(frames == 1);
+    close(peer);
+    evsrv_destroy(&srv);
+
+    // with no explicit limit the prefix and the frame have to fit rbuf_max
+    setup(&srv);
+    check(evsrv_framing_set_prefix(&srv.framing, 4, true, on_frame) == 0);
+    peer = test_conn(&srv);
+    uint32_t plen = (uint32_t) srv.rbuf_max - 3;
+    unsigned char prefix[4] = { plen >> 24, plen >> 16, plen >> 8, plen };
+    check(write(peer, prefix, 4) == 4);
+    check(test_run(srv.loop, all_closed, &srv));
+    check(frames == 0);
+    close(peer);
+    evsrv_destroy(&srv);
+}
+
+static void test_delim() {
+    evsrv srv;
+    setup(&srv);
+    check(evsrv_framing_set_delim(&srv.framing, "\r\n", 2, on_frame) == 0);
+    int peer = test_conn(&srv);
+
+    // the delimiter split between reads, an empty frame, more frames than a scan batch finds
+    const char* parts[] = { "one\r", "\ntwo\r\n\r\nthr", "ee\r\n" };
+    int after[] = { 0, 3, 4 };
+    send_parts(&srv, peer, parts, after, 3);
+    check(strcmp(seen, "one|two||three|") == 0);
+
+    char many[1024];
+    size_t len = 0;
+    for (int i = 0; i < 200; ++i) {
+        len += (size_t) snprintf(many + len, sizeof(many) - len, "%c\r\n", 'a' + i % 26);
+    }
+    seen_len = 0;
+    check(write(peer, many, len) == (ssize_t) len);
+    want = 204;
+    check(test_run(srv.loop, frames_seen, NULL));
+    check(seen_len == 400 && seen[0] == 'a' && seen[398] == 'a' + 199 % 26);
+    close(peer);
+    evsrv_destroy(&srv);
+}
+
+static void test_max_frames() {
+    evsrv srv;
+    setup(&srv);
+    check(evsrv_framing_set_fixed(&srv.framing, 1, on_frame) == 0);
+    evsrv_framing_set_limits(&srv.framing, 0, 2);
+    int peer = test_conn(&srv);
+    check(write(peer, "abcde", 5) == 5);
+    want = 5;
+    check(test_run(srv.loop, frames_seen, NULL));
+    check(strcmp(seen, "a|b|c|d|e|") == 0);
+    close(peer);
+    evsrv_destroy(&srv);
+}
+
+// frames after the one whose on_frame closed the connection are dropped
+static void test_close_in_on_frame() {
+    enum evsrv_conn_rbuf_mode modes[] = { EVSRV_RBUF_POOLED, EVSRV_RBUF_LAZY };
+    for (size_t m = 0; m < 2; ++m) {
+        evsrv srv;
+        setup(&srv);
+        srv.rbuf_mode = modes[m];
+        close_after = 2;
+        check(evsrv_framing_set_delim(&srv.framing, "\n", 1, on_frame) == 0);
+        int peers[16];
+        for (int i = 0; i < 16; ++i) {
+            peers[i] = test_conn(&srv);
+            check(write(peers[i], "a\nb\nc\n", 6) == 6);
+        }
+        check(test_run(srv.loop, all_closed, &srv));
+        check(frames == 32);
+        for (int i = 0; i < 16; ++i) {
+            close(peers[i]);
+        }
+        evsrv_destroy(&srv);
+    }
+}
+
+int main() {
+    test_fixed();
+    test_prefix();
+    test_prefix_limit();
+    test_delim();
+    test_max_frames();
+    test_close_in_on_frame();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+#include <unistd.h>
+
+#include "test.h"
+
+// connections come in pairs, closing one closes its peer as well, like a proxy would
+
+#define CONNS 16
+
+static evsrv_conn* conns[CONNS];
+static int destroyed[CONNS];
+static evsrv_conn* created;
+static int stops;
+
+static int conn_index(evsrv_conn* conn) {
+    for (int i = 0; i < CONNS; ++i) {
+        if (conns[i] == conn) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// every fourth connection finishes its work before closing
+static bool on_graceful_close(evsrv_conn* conn) {
+    return false;
+}
+
+static evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
+    evsrv_conn* conn = evsrv_alloc_conn(srv);
+    evsrv_conn_init(conn, srv, info);
+    created = conn;
+    return conn;
+}
+
+static void on_conn_destroy(evsrv_conn* conn, int err) {
+    evsrv* srv = conn->srv;
+    int i = conn_index(conn);
+    check(i >= 0);
+    conns[i] = NULL;
+    destroyed[i]++;
+    evsrv_conn_destroy(conn);
+    evsrv_free_conn(srv, conn);
+    if (conns[i ^ 1] != NULL) {
+        evsrv_conn_close(conns[i ^ 1], 0);
+    }
+}
+
+static void on_graceful_stop(evsrv* srv) {
+    ++stops;
+}
+
+int main() {
+    evsrv srv;
+    evsrv_init(EV_DEFAULT, &srv, "127.0.0.1", "0");
+    evsrv_set_on_conn(&srv, on_conn_create, on_conn_destroy);
+    int peers[CONNS];
+    for (int i = 0; i < CONNS; ++i) {
+        peers[i] = test_conn(&srv);
+        conns[i] = created;
+        if (i % 4 == 3) {
+            conns[i]->on_graceful_close = on_graceful_close;
+        }
+    }
+
+    // pending connections are closed along with their peers, the walk doesn't trip over them
+    evsrv_graceful_stop(&srv, on_graceful_stop);
+    check(srv.active_connections == 0);
+    check(stops == 1);
+    for (int i = 0; i < CONNS; ++i) {
+        check(destroyed[i] == 1);
+        close(peers[i]);
+    }
+    evsrv_destroy(&srv);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+#include <unistd.h>
+#include <string.h>
+
+#include "test.h"
+#include "evsrv_http.h"
+
+static void on_request(evsrv_http_conn* c, struct evsrv_http_request* req);
+
+static evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
+    evsrv_http_conn* c = (evsrv_http_conn*) evsrv_alloc_conn(srv);
+    evsrv_http_conn_init(c, srv, info, on_request);
+    return &c->conn;
+}
+
+static void on_conn_destroy(evsrv_conn* conn, int err) {
+    evsrv* srv = conn->srv;
+    evsrv_http_conn_destroy((evsrv_http_conn*) conn);
+    evsrv_free_conn(srv, conn);
+}
+
+// answers with "<method> <target> <X-Test header> <body>", /close closes the connection instead
+void on_request(evsrv_http_conn* c, struct evsrv_http_request* req) {
+    if (evsrv_http_str_is(&req->target, "/close")) {
+        evsrv_conn_close(&c->conn, 0);
+        return;
+    }
+    const struct evsrv_http_str* x = evsrv_http_header(req, "x-test");
+    char body[1024];
+    int len = snprintf(body, sizeof(body), "%.*s %.*s %.*s %.*s",
+                       (int) req->method.len, req->method.ptr, (int) req->target.len, req->target.ptr,
+                       x ? (int) x->len : 1, x ? x->ptr : "-", (int) req->body.len, req->body.ptr);
+    evsrv_http_respond(c, 200, "text/plain", body, (size_t) len);
+}
+
+static bool all_closed(void* arg) {
+    return ((evsrv*) arg)->active_connections == 0;
+}
+
+static void setup(evsrv* srv) {
+    evsrv_init(EV_DEFAULT, srv, "127.0.0.1", "0");
+    evsrv_set_conn_size(srv, sizeof(evsrv_http_conn));
+    evsrv_set_on_conn(srv, on_conn_create, on_conn_destroy);
+}
+
+// the response of on_request
+static const char* ok(const char* body, bool close) {
+    static char response[4096];
+    snprintf(response, sizeof(response),
+             "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n%s\r\n%s",
+             strlen(body), close ? "Connection: close\r\n" : "", body);
+    return response;
+}
+
+static const char* error(const char* status) {
+    static char response[256];
+    snprintf(response, sizeof(response), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    return response;
+}
+
+static void test_requests() {
+    evsrv srv;
+    setup(&srv);
+    int peer = test_conn(&srv);
+    test_exchange(srv.loop, peer, "GET / HTTP/1.1\r\nHost: a\r\n\r\n", ok("GET / - ", false), false);
+    test_exchange(srv.loop, peer, "GET /h HTTP/1.1\r\nX-Test:  v a l \r\nx-test: 2\r\n\r\n", ok("GET /h v a l ", false), false);
+    test_exchange(srv.loop, peer, "\r\nPOST /p HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello", ok("POST /p - hello", false), false);
+
+    // a request split at every byte, lines ending with LF only
+    const char* req = "POST /s HTTP/1.1\nContent-Length: 3\n\nabc";
+    for (size_t i = 0; i < strlen(req) - 1; ++i) {
+        check(write(peer, req + i, 1) == 1);
+        test_read(srv.loop, peer, NULL, 0, NULL);
+    }
+    test_exchange(srv.loop, peer, "c", ok("POST /s - abc", false), false);
+
+    // a pipeline is answered in order
+    char pipeline[4096] = "";
+    char responses[8192] = "";
+    for (int i = 0; i < 20; ++i) {
+        char line[64];
+        snprintf(line, sizeof(line), "GET /%d HTTP/1.1\r\n\r\n", i);
+        strcat(pipeline, line);
+        snprintf(line, sizeof(line), "GET /%d - ", i);
+        strcat(responses, ok(line, false));
+    }
+    size_t plen = strlen(pipeline);
+    size_t rlen = strlen(responses);
+    check(write(peer, pipeline, plen) == (ssize_t) plen);
+    char buf[8192];
+    check(test_read(srv.loop, peer, buf, rlen, NULL) == rlen);
+    check(memcmp(buf, responses, rlen) == 0);
+
+    // HTTP/1.0 closes unless asked to keep alive
+    test_exchange(srv.loop, peer, "GET /c HTTP/1.1\r\nConnection: close\r\n\r\nGET /x HTTP/1.1\r\n\r\n",
+                  ok("GET /c - ", true), true);
+    close(peer);
+    peer = test_conn(&srv);
+    test_exchange(srv.loop, peer, "GET / HTTP/1.0\r\n\r\n", ok("GET / - ", true), true);
+    close(peer);
+    check(test_run(srv.loop, all_closed, &srv));
+    evsrv_destroy(&srv);
+}
+
+static void test_chunked() {
+    evsrv srv;
+    setup(&srv);
+    int peer = test_conn(&srv);
+    test_exchange(srv.loop, peer,
+                  "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                  "5;ext=1\r\nhello\r\n6\r\n world\r\n0\r\nX-Trailer: t\r\n\r\n",
+                  ok("POST /c - hello world", false), false);
+
+    // split at every byte, followed by a pipelined request
+    const char* req = "POST /s HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nA\r\n0123456789\r\n1\r\n!\r\n0\r\n\r\n";
+    for (size_t i = 0; i < strlen(req); ++i) {
+        check(write(peer, req + i, 1) == 1);
+        test_read(srv.loop, peer, NULL, 0, NULL);
+    }
+    char both[1024];
+    snprintf(both, sizeof(both), "%s", ok("POST /s - 0123456789!", false));
+    strcat(both, ok("GET /n - ", false));
+    test_exchange(srv.loop, peer, "GET /n HTTP/1.1\r\n\r\n", both, false);
+
+    test_exchange(srv.loop, peer, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", error("400 Bad Request"), true);
+    close(peer);
+    check(test_run(srv.loop, all_closed, &srv));
+    evsrv_destroy(&srv);
+}
+
+// requests which could be framed differently by another hop are rejected and end the connection
+static void test_rejected() {
+    const char* reqs[][2] = {
+        { "POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n", "400 Bad Request" },
+        { "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n0\r\n\r\n", "400 Bad Request" },
+        { "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\nabcd", "400 Bad Request" },
+        { "POST / HTTP/1.1\r\nContent-Length: -3\r\n\r\n", "400 Bad Request" },
+        { "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n", "501 Not Implemented" },
+        { "GET / HTTP/1.1\r\nX: a\r\n b\r\n\r\n", "400 Bad Request" },
+        { "GET / HTTP/2.0\r\n\r\n", "505 HTTP Version Not Supported" },
+    };
+    evsrv srv;
+    setup(&srv);
+    for (size_t i = 0; i < sizeof(reqs) / sizeof(reqs[0]); ++i) {
+        int peer = test_conn(&srv);
+        test_exchange(srv.loop, peer, reqs[i][0], error(reqs[i][1]), true);
+        close(peer);
+    }
+    check(test_run(srv.loop, all_closed, &srv));
+    evsrv_destroy(&srv);
+}
+
+// closing from on_request with more requests pipelined
+static void test_close_in_on_request() {
+    evsrv srv;
+    setup(&srv);
+    int peers[16];
+    const char* reqs = "GET / HTTP/1.1\r\n\r\nGET /close HTTP/1.1\r\n\r\nGET / HTTP/1.1\r\n\r\n";
+    for (int i = 0; i < 16; ++i) {
+        peers[i] = test_conn(&srv);
+        check(write(peers[i], reqs, strlen(reqs)) == (ssize_t) strlen(reqs));
+    }
+    check(test_run(srv.loop, all_closed, &srv));
+    for (int i = 0; i < 16; ++i) {
+        close(peers[i]);
+    }
+    evsrv_destroy(&srv);
+}
+
+int main() {
+    test_requests();
+    test_chunked();
+    test_rejected();
+    test_close_in_on_request();
+    return EXIT_SUCCESS;
+}
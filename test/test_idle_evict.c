@@ -0,0 +1,92 @@
+#include <unistd.h>
+
+#include "test.h"
+
+#define CONNS 8
+
+static evsrv_conn* conns[CONNS];
+static int destroyed[CONNS];
+static int ndestroyed;
+static evsrv_conn* created;
+static bool chained;                    // destroying an even connection closes the one accepted after it
+
+static int conn_index(evsrv_conn* conn) {
+    for (int i = 0; i < CONNS; ++i) {
+        if (conns[i] == conn) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
+    evsrv_conn* conn = evsrv_alloc_conn(srv);
+    evsrv_conn_init(conn, srv, info);
+    created = conn;
+    return conn;
+}
+
+static void on_conn_destroy(evsrv_conn* conn, int err) {
+    evsrv* srv = conn->srv;
+    int i = conn_index(conn);
+    check(i >= 0);
+    conns[i] = NULL;
+    destroyed[ndestroyed++] = i;
+    evsrv_conn_destroy(conn);
+    evsrv_free_conn(srv, conn);
+    if (chained && i % 2 == 0 && i + 1 < CONNS && conns[i + 1] != NULL) {
+        evsrv_conn_close(conns[i + 1], 0);
+    }
+}
+
+static void setup(evsrv* srv, int* peers) {
+    evsrv_init(EV_DEFAULT, srv, "127.0.0.1", "0");
+    evsrv_set_on_conn(srv, on_conn_create, on_conn_destroy);
+    evsrv_set_idle_evict(srv, 0, 0.0, false);
+    ndestroyed = 0;
+    for (int i = 0; i < CONNS; ++i) {
+        peers[i] = test_conn(srv);
+        conns[i] = created;
+    }
+}
+
+static void teardown(evsrv* srv, int* peers) {
+    chained = false;
+    for (int i = 0; i < CONNS; ++i) {
+        if (conns[i] != NULL) {
+            evsrv_conn_close(conns[i], 0);
+        }
+        close(peers[i]);
+    }
+    evsrv_destroy(srv);
+}
+
+// the least recently active connections go first, busy ones are skipped
+static void test_order() {
+    evsrv srv;
+    int peers[CONNS];
+    setup(&srv, peers);
+    evsrv_conn_read_pause(conns[1]);
+    check(evsrv_conn_evict_idle(&srv, 3) == 3);
+    check(ndestroyed == 3 && destroyed[0] == 0 && destroyed[1] == 2 && destroyed[2] == 3);
+    check(srv.active_connections == CONNS - 3);
+    teardown(&srv, peers);
+}
+
+// closing a connection may close the next one the scan would pick
+static void test_chained() {
+    evsrv srv;
+    int peers[CONNS];
+    setup(&srv, peers);
+    chained = true;
+    check(evsrv_conn_evict_idle(&srv, 2) == 2);
+    check(ndestroyed == 4 && destroyed[0] == 0 && destroyed[1] == 1 && destroyed[2] == 2 && destroyed[3] == 3);
+    check(conns[4] != NULL);
+    teardown(&srv, peers);
+}
+
+int main() {
+    test_order();
+    test_chained();
+    return EXIT_SUCCESS;
+}
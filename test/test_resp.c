@@ -0,0 +1,198 @@
+#include <unistd.h>
+#include <string.h>
+
+#include "test.h"
+#include "evsrv_resp.h"
+
+static void on_command(evsrv_resp_conn* c, int argc, struct evsrv_resp_arg* argv);
+
+static evsrv_resp_conn* created;
+
+static evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
+    evsrv_resp_conn* c = (evsrv_resp_conn*) evsrv_alloc_conn(srv);
+    evsrv_resp_conn_init(c, srv, info, on_command);
+    created = c;
+    return &c->conn;
+}
+
+static void on_conn_destroy(evsrv_conn* conn, int err) {
+    evsrv* srv = conn->srv;
+    evsrv_resp_conn_destroy((evsrv_resp_conn*) conn);
+    evsrv_free_conn(srv, conn);
+}
+
+// ARGS answers with its arguments, ENC with a sample of every type
+void on_command(evsrv_resp_conn* c, int argc, struct evsrv_resp_arg* argv) {
+    if (evsrv_resp_arg_is(&argv[0], "PING")) {
+        evsrv_resp_write_simple(c, "PONG", 0);
+    } else if (evsrv_resp_arg_is(&argv[0], "ARGS")) {
+        evsrv_resp_write_array(c, (size_t) argc - 1);
+        for (int i = 1; i < argc; ++i) {
+            evsrv_resp_write_bulk(c, argv[i].ptr, argv[i].len);
+        }
+    } else if (evsrv_resp_arg_is(&argv[0], "HELLO")) {
+        evsrv_resp_set_proto(c, 3);
+        evsrv_resp_write_simple(c, "OK", 2);
+    } else if (evsrv_resp_arg_is(&argv[0], "ENC")) {
+        evsrv_resp_write_int(c, -42);
+        evsrv_resp_write_null(c);
+        evsrv_resp_write_map(c, 1);
+        evsrv_resp_write_bool(c, true);
+        evsrv_resp_write_double(c, 1.5);
+        evsrv_resp_write_error(c, "ERR no", 0);
+    } else if (evsrv_resp_arg_is(&argv[0], "QUIT")) {
+        evsrv_resp_write_simple(c, "OK", 2);
+        evsrv_conn_end(&c->conn);
+    } else if (evsrv_resp_arg_is(&argv[0], "CLOSE")) {
+        evsrv_conn_close(&c->conn, 0);
+    } else {
+        evsrv_resp_write_error(c, "ERR unknown command", 0);
+    }
+}
+
+static bool all_closed(void* arg) {
+    return ((evsrv*) arg)->active_connections == 0;
+}
+
+static void setup(evsrv* srv) {
+    evsrv_init(EV_DEFAULT, srv, "127.0.0.1", "0");
+    evsrv_set_conn_size(srv, sizeof(evsrv_resp_conn));
+    evsrv_set_on_conn(srv, on_conn_create, on_conn_destroy);
+}
+
+static void test_parse() {
+    evsrv srv;
+    setup(&srv);
+    int peer = test_conn(&srv);
+    test_exchange(srv.loop, peer, "PING\r\n", "+PONG\r\n", false);
+    test_exchange(srv.loop, peer, "ARGS  a\tbc \n", "*2\r\n$1\r\na\r\n$2\r\nbc\r\n", false);
+    test_exchange(srv.loop, peer, "*3\r\n$4\r\nARGS\r\n$0\r\n\r\n$4\r\nx\r\ny\r\n", "*2\r\n$0\r\n\r\n$4\r\nx\r\ny\r\n", false);
+
+    // a command split at every byte
+    const char* cmd = "*2\r\n$4\r\nARGS\r\n$3\r\nabc\r\n";
+    for (size_t i = 0; i < strlen(cmd) - 1; ++i) {
+        check(write(peer, cmd + i, 1) == 1);
+        test_read(srv.loop, peer, NULL, 0, NULL);
+    }
+    test_exchange(srv.loop, peer, "\n", "*1\r\n$3\r\nabc\r\n", false);
+
+    // a pipeline is answered in order
+    char pipeline[4096];
+    char replies[4096];
+    size_t plen = 0;
+    size_t rlen = 0;
+    for (int i = 0; i < 100; ++i) {
+        plen += (size_t) snprintf(pipeline + plen, sizeof(pipeline) - plen, "*2\r\n$4\r\nARGS\r\n$2\r\n%02d\r\n", i);
+        rlen += (size_t) snprintf(replies + rlen, sizeof(replies) - rlen, "*1\r\n$2\r\n%02d\r\n", i);
+    }
+    check(write(peer, pipeline, plen) == (ssize_t) plen);
+    char buf[4096];
+    check(test_read(srv.loop, peer, buf, rlen, NULL) == rlen);
+    check(memcmp(buf, replies, rlen) == 0);
+
+    close(peer);
+    check(test_run(srv.loop, all_closed, &srv));
+    evsrv_destroy(&srv);
+}
+
+static void test_encode() {
+    evsrv srv;
+    setup(&srv);
+    int peer = test_conn(&srv);
+    test_exchange(srv.loop, peer, "ENC\r\n", ":-42\r\n$-1\r\n*2\r\n:1\r\n$3\r\n1.5\r\n-ERR no\r\n", false);
+    test_exchange(srv.loop, peer, "HELLO\r\nENC\r\n", "+OK\r\n:-42\r\n_\r\n%1\r\n#t\r\n,1.5\r\n-ERR no\r\n", false);
+
+    // bulks larger than the small reply buffer are written in parts
+    char big[3000];
+    memset(big, 'x', sizeof(big));
+    char req[3100];
+    int len = snprintf(req, sizeof(req), "*2\r\n$4\r\nARGS\r\n$%zu\r\n%.*s\r\n", sizeof(big), (int) sizeof(big), big);
+    check(write(peer, req, (size_t) len) == len);
+    char reply[3100];
+    size_t want = (size_t) snprintf(reply, sizeof(reply), "*1\r\n$%zu\r\n%.*s\r\n", sizeof(big), (int) sizeof(big), big);
+    char buf[3100];
+    check(test_read(srv.loop, peer, buf, want, NULL) == want);
+    check(memcmp(buf, reply, want) == 0);
+
+    close(peer);
+    check(test_run(srv.loop, all_closed, &srv));
+    evsrv_destroy(&srv);
+}
+
+// the connection ends after the error reply or QUIT, the commands following are dropped
+static void test_end() {
+    evsrv srv;
+    setup(&srv);
+    int peer = test_conn(&srv);
+    test_exchange(srv.loop, peer, "PING\r\n*1\r\n+x\r\nPING\r\n", "+PONG\r\n-ERR Protocol error: expected '$', got '+'\r\n", true);
+    check(srv.active_connections == 1); // until the peer closes as well
+    close(peer);
+    check(test_run(srv.loop, all_closed, &srv));
+
+    peer = test_conn(&srv);
+    test_exchange(srv.loop, peer, "*-1\r\n*1\r\n$4\r\nPING\r\n", "+PONG\r\n", false);
+    test_exchange(srv.loop, peer, "*2000000\r\n", "-ERR Protocol error: invalid multibulk length\r\n", true);
+    close(peer);
+
+    peer = test_conn(&srv);
+    test_exchange(srv.loop, peer, "PING\r\nQUIT\r\nPING\r\n", "+PONG\r\n+OK\r\n", true);
+    close(peer);
+    check(test_run(srv.loop, all_closed, &srv));
+    evsrv_destroy(&srv);
+}
+
+static bool header_parsed(void* arg) {
+    return created->argc >= 0;
+}
+
+// a multibulk count allocates for a few arguments only, the arrays grow as the arguments arrive
+static void test_huge_count() {
+    evsrv srv;
+    setup(&srv);
+    int peer = test_conn(&srv);
+    check(write(peer, "*1048576\r\n", 10) == 10);
+    check(test_run(srv.loop, header_parsed, NULL));
+    check(created->argc == 1048576 && created->args_cap <= EVSRV_RESP_PREALLOC_ARGS);
+    close(peer);
+    check(test_run(srv.loop, all_closed, &srv));
+
+    peer = test_conn(&srv);
+    static char cmd[32 * 1024];
+    size_t len = (size_t) snprintf(cmd, sizeof(cmd), "*%d\r\n$4\r\nPING\r\n", 3 * EVSRV_RESP_PREALLOC_ARGS);
+    for (int i = 1; i < 3 * EVSRV_RESP_PREALLOC_ARGS; ++i) {
+        len += (size_t) snprintf(cmd + len, sizeof(cmd) - len, "$1\r\na\r\n");
+    }
+    check(len < sizeof(cmd) - 1);
+    check(write(peer, cmd, len) == (ssize_t) len);
+    char buf[16];
+    check(test_read(srv.loop, peer, buf, 7, NULL) == 7);
+    check(memcmp(buf, "+PONG\r\n", 7) == 0);
+    close(peer);
+    check(test_run(srv.loop, all_closed, &srv));
+    evsrv_destroy(&srv);
+}
+
+// closing from on_command with more commands pipelined
+static void test_close_in_on_command() {
+    evsrv srv;
+    setup(&srv);
+    int peers[16];
+    for (int i = 0; i < 16; ++i) {
+        peers[i] = test_conn(&srv);
+        check(write(peers[i], "PING\r\nCLOSE\r\nPING\r\n", 19) == 19);
+    }
+    check(test_run(srv.loop, all_closed, &srv));
+    for (int i = 0; i < 16; ++i) {
+        close(peers[i]);
+    }
+    evsrv_destroy(&srv);
+}
+
+int main() {
+    test_parse();
+    test_encode();
+    test_end();
+    test_huge_count();
+    test_close_in_on_command();
+    return EXIT_SUCCESS;
+}
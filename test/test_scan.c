@@ -0,0 +1,92 @@
+#include <sys/mman.h>
+
+#include "test.h"
+
+// the implementations are static, they are all compared with the scalar one and a naive search
+#include "../src/evsrv_scan.c"
+
+struct impl {
+    const char* name;
+    evsrv_scan_fn scan;
+};
+
+static size_t naive(const char* buf, size_t from, size_t len, const char* delim, size_t delim_len,
+                    uint32_t* pos, size_t max) {
+    size_t n = 0;
+    for (size_t i = from; i + delim_len <= len && n < max; ++i) {
+        if (memcmp(buf + i, delim, delim_len) == 0) {
+            pos[n++] = (uint32_t) i;
+        }
+    }
+    return n;
+}
+
+static void compare(const struct impl* impl, const char* buf, size_t from, size_t len,
+                    const char* delim, size_t delim_len, size_t max) {
+    uint32_t pos[1024];
+    uint32_t ref[1024];
+    size_t n = impl->scan(buf, from, len, delim, delim_len, pos, max);
+    size_t m = naive(buf, from, len, delim, delim_len, ref, max);
+    if (n != m || memcmp(pos, ref, n * sizeof(pos[0])) != 0) {
+        fprintf(stderr, "%s: %zu found instead of %zu, from %zu, len %zu, delim of %zu, max %zu\n",
+                impl->name, n, m, from, len, delim_len, max);
+    }
+    check(n == m && memcmp(pos, ref, n * sizeof(pos[0])) == 0);
+}
+
+int main() {
+    struct impl impls[3] = { { "scalar", _evsrv_scan_scalar } };
+    size_t nimpls = 1;
+#if EVSRV_SCAN_X86
+    impls[nimpls++] = (struct impl) { "sse2", _evsrv_scan_sse2 };
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impls[nimpls++] = (struct impl) { "avx2", _evsrv_scan_avx2 };
+    }
+#endif
+    check(strcmp(evsrv_scan_isa(), impls[nimpls - 1].name) == 0);
+
+    // the buffer ends right before an inaccessible page, reading past len faults
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    char* pages = (char*) mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check(pages != MAP_FAILED);
+    check(mprotect(pages + page, page, PROT_NONE) == 0);
+
+    // few letters make for many matches, overlapping ones included
+    srand(1);
+    for (int round = 0; round < 20000; ++round) {
+        size_t len = (size_t) rand() % 300;
+        size_t from = len > 0 ? (size_t) rand() % (len + 1) : 0;
+        int letters = 1 + rand() % 3;
+        char* buf = pages + page - len;
+        for (size_t i = 0; i < len; ++i) {
+            buf[i] = (char) ('a' + rand() % letters);
+        }
+        char delim[EVSRV_FRAME_DELIM_MAX];
+        size_t delim_len = 1 + (size_t) rand() % 4;
+        for (size_t i = 0; i < delim_len; ++i) {
+            delim[i] = (char) ('a' + rand() % letters);
+        }
+        size_t max = 1 + (size_t) rand() % 64;
+        for (size_t i = 0; i < nimpls; ++i) {
+            compare(&impls[i], buf, from, len, delim, delim_len, max);
+        }
+    }
+
+    // CRLF in blocks of every alignment, the delimiter straddling their boundaries
+    for (size_t len = 0; len <= 130; ++len) {
+        char* buf = pages + page - len;
+        memset(buf, 'x', len);
+        for (size_t i = 1; i < len; i += 7) {
+            buf[i - 1] = '\r';
+            buf[i] = '\n';
+        }
+        for (size_t i = 0; i < nimpls; ++i) {
+            compare(&impls[i], buf, 0, len, "\r\n", 2, 1024);
+            compare(&impls[i], buf, 0, len, "\n", 1, 1024);
+        }
+    }
+
+    munmap(pages, 2 * page);
+    return EXIT_SUCCESS;
+}
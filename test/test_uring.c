@@ -0,0 +1,176 @@
+#include <unistd.h>
+
+#include "test.h"
+#include "evsrv_uring.h"
+
+#define LEN (16 * 1024 * 1024)
+
+static evsrv_conn* created;
+static char got[8192];
+static size_t got_len;
+static bool paused_once;                // on_read pauses reading on its first call
+static int paused_calls;
+static int released;
+
+static void on_read(evsrv_conn* conn, ssize_t nread) {
+    if (nread == 0) {
+        return;
+    }
+    if (conn->rpaused & EVSRV_CONN_RPAUSE_USER) {
+        paused_calls++;
+    }
+    check(got_len + conn->ruse <= sizeof(got));
+    memcpy(got + got_len, conn->rbuf, conn->ruse);
+    got_len += conn->ruse;
+    conn->ruse = 0;
+    if (!paused_once) {
+        paused_once = true;
+        evsrv_conn_read_pause(conn);
+    }
+}
+
+static evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
+    evsrv_conn* conn = evsrv_alloc_conn(srv);
+    evsrv_conn_init(conn, srv, info);
+    evsrv_conn_set_rbuf_mode(conn, srv->rbuf_mode);
+    conn->on_read = on_read;
+    created = conn;
+    return conn;
+}
+
+static void on_conn_destroy(evsrv_conn* conn, int err) {
+    evsrv* srv = conn->srv;
+    evsrv_conn_destroy(conn);
+    evsrv_free_conn(srv, conn);
+}
+
+static bool setup(evsrv* srv, int* peer) {
+    evsrv_init(EV_DEFAULT, srv, "127.0.0.1", "0");
+    evsrv_set_on_conn(srv, on_conn_create, on_conn_destroy);
+    evsrv_set_engine(srv, EVSRV_ENGINE_URING);
+    srv->rbuf_size = 1024;
+    *peer = test_conn(srv);
+    if (srv->uring == NULL) {
+        fprintf(stderr, "io_uring is not available, skipped\n");
+        close(*peer);
+        evsrv_destroy(srv);
+        return false;
+    }
+    return true;
+}
+
+static size_t want;
+
+static bool got_all(void* arg) {
+    return got_len >= want;
+}
+
+// data received along with what made on_read pause reading waits until reading resumes
+static void test_paused_recv() {
+    evsrv srv;
+    int peer;
+    if (!setup(&srv, &peer)) {
+        return;
+    }
+    char data[4000];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (char) ('a' + i % 26);
+    }
+    check(write(peer, data, sizeof(data)) == sizeof(data));
+    want = sizeof(data);
+    check(!test_run(srv.loop, got_all, NULL));
+    check(got_len == 1024 && created->rpaused);
+
+    evsrv_conn_read_resume(created);
+    check(test_run(srv.loop, got_all, NULL));
+    check(got_len == sizeof(data) && memcmp(got, data, sizeof(data)) == 0);
+    check(paused_calls == 0);
+
+    close(peer);
+    evsrv_destroy(&srv);
+}
+
+static void release(void* buf, void* ctx) {
+    released++;
+}
+
+static bool sending(void* arg) {
+    return created->usends > 0;
+}
+
+static bool all_released(void* arg) {
+    return released == 1;
+}
+
+// the chunks of sends in flight outlive the connection until the sends complete
+static void test_close_sending() {
+    evsrv srv;
+    int peer;
+    if (!setup(&srv, &peer)) {
+        return;
+    }
+    char* data = (char*) malloc(LEN);
+    check(data != NULL);
+    memset(data, 'u', LEN);
+    evsrv_conn_write_ref(created, data, LEN, release, NULL);
+    check(test_run(srv.loop, sending, NULL));
+    evsrv_conn_close(created, 0);
+    check(released == 0);
+    check(srv.uring_orphans != NULL);
+
+    check(test_run(srv.loop, all_released, NULL));
+    check(srv.uring_orphans == NULL);
+    close(peer);
+    evsrv_destroy(&srv);
+    free(data);
+}
+
+#if EVSRV_USE_URING
+static void complete_send(evsrv* srv, int res) {
+    struct io_uring_cqe cqe;
+    memset(&cqe, 0, sizeof(cqe));
+    cqe.user_data = evsrv_uring_data(EVSRV_URING_SEND, created->info->sock, created->ugen);
+    cqe.res = res;
+    evsrv_conn_uring_complete(srv, &cqe);
+}
+
+// the first send of a chain of two comes back short, the second cancelled: the rest is sent again
+// and the connection ends after it
+static void test_short_send() {
+    evsrv srv;
+    int peer;
+    if (!setup(&srv, &peer)) {
+        return;
+    }
+    static char a[1000];
+    static char b[1000];
+    memset(a, 'a', sizeof(a));
+    memset(b, 'b', sizeof(b));
+    evsrv_conn_write_ref(created, a, sizeof(a), NULL, NULL);
+    evsrv_conn_write_ref(created, b, sizeof(b), NULL, NULL);
+    evsrv_conn_end(created);
+
+    // completions of a chain the loop didn't get to submit yet
+    created->usends = 2;
+    complete_send(&srv, 400);
+    complete_send(&srv, -ECANCELED);
+    check(created->usends > 0);
+
+    char buf[2048];
+    bool eof;
+    check(test_read(srv.loop, peer, buf, sizeof(buf), &eof) == 1600);
+    check(eof);
+    check(buf[0] == 'a' && buf[599] == 'a' && buf[600] == 'b' && buf[1599] == 'b');
+    close(peer);
+    evsrv_destroy(&srv);
+}
+#endif
+
+int main() {
+    test_paused_recv();
+    test_close_sending();
+#if EVSRV_USE_URING
+    test_short_send();
+#endif
+    return EXIT_SUCCESS;
+}
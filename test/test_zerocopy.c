@@ -0,0 +1,125 @@
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "test.h"
+
+#define LEN (16 * 1024 * 1024)
+
+static evsrv_conn* created;
+static int released;
+
+static evsrv_conn* on_conn_create(evsrv* srv, struct evsrv_conn_info* info) {
+    evsrv_conn* conn = evsrv_alloc_conn(srv);
+    evsrv_conn_init(conn, srv, info);
+    created = conn;
+    return conn;
+}
+
+static void on_conn_destroy(evsrv_conn* conn, int err) {
+    evsrv* srv = conn->srv;
+    evsrv_conn_destroy(conn);
+    evsrv_free_conn(srv, conn);
+}
+
+static void release(void* buf, void* ctx) {
+    released++;
+}
+
+static bool all_released(void* arg) {
+    return released == 1;
+}
+
+// SO_ZEROCOPY needs TCP, the peer connects over loopback and the accepted socket goes to the server
+static int tcp_conn(evsrv* srv) {
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+    check(lsock > -1);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    check(bind(lsock, (struct sockaddr*) &addr, addrlen) == 0);
+    check(listen(lsock, 1) == 0);
+    check(getsockname(lsock, (struct sockaddr*) &addr, &addrlen) == 0);
+
+    int peer = socket(AF_INET, SOCK_STREAM, 0);
+    check(peer > -1);
+    int rcvbuf = 64 * 1024;
+    check(setsockopt(peer, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == 0);
+    check(connect(peer, (struct sockaddr*) &addr, addrlen) == 0);
+
+    struct evsrv_conn_info info;
+    memset(&info, 0, sizeof(info));
+    info.sock = accept(lsock, NULL, NULL);
+    check(info.sock > -1);
+    close(lsock);
+    evsrv_add_conn(srv, &info);
+    return peer;
+}
+
+// a closed connection releases data the kernel may still read only after its completion
+static void test_close_pending() {
+    evsrv srv;
+    evsrv_init(EV_DEFAULT, &srv, "127.0.0.1", "0");
+    evsrv_set_on_conn(&srv, on_conn_create, on_conn_destroy);
+    srv.zerocopy_min = 1;
+    int peer = tcp_conn(&srv);
+    if (!created->zcopy) {
+        fprintf(stderr, "SO_ZEROCOPY is not supported, skipped\n");
+        close(peer);
+        evsrv_destroy(&srv);
+        return;
+    }
+
+    char* data = (char*) malloc(LEN);
+    check(data != NULL);
+    memset(data, 'z', LEN);
+    evsrv_conn_write_ref(created, data, LEN, release, NULL);
+    check(created->whead != NULL && created->whead->zpending);
+    evsrv_conn_close(created, 0);
+    check(released == 0);
+    check(srv.orphans != NULL);
+
+    // reading lets the sent part complete, the orphan goes away along with its socket
+    char buf[64 * 1024];
+    while (recv(peer, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+    check(test_run(srv.loop, all_released, NULL));
+    check(srv.orphans == NULL);
+    close(peer);
+    evsrv_destroy(&srv);
+    free(data);
+}
+
+// orphans still waiting are released along with the server
+static void test_destroy_pending() {
+    evsrv srv;
+    evsrv_init(EV_DEFAULT, &srv, "127.0.0.1", "0");
+    evsrv_set_on_conn(&srv, on_conn_create, on_conn_destroy);
+    srv.zerocopy_min = 1;
+    int peer = tcp_conn(&srv);
+    if (!created->zcopy) {
+        close(peer);
+        evsrv_destroy(&srv);
+        return;
+    }
+
+    released = 0;
+    char* data = (char*) malloc(LEN);
+    check(data != NULL);
+    memset(data, 'z', LEN);
+    evsrv_conn_write_ref(created, data, LEN, release, NULL);
+    evsrv_conn_close(created, 0);
+    check(released == 0);
+    evsrv_destroy(&srv);
+    check(released == 1);
+    close(peer);
+    free(data);
+}
+
+int main() {
+    test_close_pending();
+    test_destroy_pending();
+    return EXIT_SUCCESS;
+}